@@ -0,0 +1,44 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include "allocation_counter.h"
+
+#ifndef __TESTING
+#error "allocation_counter.cc should only be linked into tests"
+#endif
+
+#include <atomic>
+#include <new>
+
+namespace {
+
+std::atomic<size_t> g_num_allocations(0);
+
+void* Allocate(size_t size) {
+  g_num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size ? size : 1);
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+}  // namespace
+
+void* operator new(size_t size) { return Allocate(size); }
+void* operator new[](size_t size) { return Allocate(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+namespace xsettingsd {
+
+ScopedAllocationCounter::ScopedAllocationCounter()
+    : start_count_(g_num_allocations.load(std::memory_order_relaxed)) {
+}
+
+size_t ScopedAllocationCounter::count() const {
+  return g_num_allocations.load(std::memory_order_relaxed) - start_count_;
+}
+
+}  // namespace xsettingsd
@@ -0,0 +1,32 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_ALLOCATION_COUNTER_H__
+#define __XSETTINGSD_ALLOCATION_COUNTER_H__
+
+#include <cstdlib>  // for size_t
+
+#include "common.h"
+
+namespace xsettingsd {
+
+// Counts heap allocations made through the global operator new while it's
+// in scope, so that tests can enforce allocation budgets.  Only available
+// in test binaries built with __TESTING that link allocation_counter.cc,
+// which replaces the global operator new.
+class ScopedAllocationCounter {
+ public:
+  ScopedAllocationCounter();
+
+  // Number of allocations made since the counter was created.
+  size_t count() const;
+
+ private:
+  size_t start_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedAllocationCounter);
+};
+
+}  // namespace xsettingsd
+
+#endif
@@ -0,0 +1,183 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include "baseline_image.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common.h"
+#include "config_parser.h"
+#include "data_reader.h"
+#include "data_writer.h"
+#include "logging.h"
+#include "setting.h"
+
+using std::make_pair;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace xsettingsd {
+
+namespace {
+
+// Identifies an image and its format version.  It's followed by a header in
+// the same format as a property's (a byte-order byte, three bytes of
+// padding, a serial that's always 0, and the number of settings) and then
+// the settings' records.
+const char kMagic[] = "XSDBASE1";
+const size_t kMagicSize = sizeof(kMagic) - 1;
+
+}  // namespace
+
+bool BuildBaselineImage(const string& config_path, const string& image_path) {
+  if (IsBaselineImage(config_path)) {
+    LOG(ERROR, "%s is already a baseline image", config_path.c_str());
+    return false;
+  }
+  std::shared_ptr<string> data(new string);
+  if (!ReadFile(config_path, data.get())) {
+    LOG(ERROR, "Unable to read %s: %s", config_path.c_str(), strerror(errno));
+    return false;
+  }
+  ConfigParser parser(new ConfigParser::StringCharStream(data));
+  SettingsMap settings;
+  if (!parser.Parse(&settings, NULL, 0)) {
+    LOG(ERROR, "Unable to parse %s: %s", config_path.c_str(),
+        parser.FormatError().c_str());
+    return false;
+  }
+  if (!WriteBaselineImage(image_path, settings)) {
+    LOG(ERROR, "Unable to write %s: %s", image_path.c_str(), strerror(errno));
+    return false;
+  }
+  LOG(INFO, "Wrote %zu setting%s to %s", settings.map().size(),
+      (settings.map().size() == 1) ? "" : "s", image_path.c_str());
+  return true;
+}
+
+bool WriteBaselineImage(const string& image_path,
+                        const SettingsMap& settings) {
+  // Grow the buffer until everything fits.
+  vector<char> buffer(4096);
+  while (true) {
+    DataWriter writer(&buffer[0], buffer.size());
+    bool write_ok =
+        writer.WriteBytes(kMagic, kMagicSize) &&
+        writer.WriteInt8(IsLittleEndian() ? 0 : 1) &&  // LSBFirst, MSBFirst
+        writer.WriteZeros(3) &&
+        writer.WriteInt32(0) &&
+        writer.WriteInt32(settings.map().size());
+    for (SettingsMap::Map::const_iterator it = settings.map().begin();
+         write_ok && it != settings.map().end(); ++it) {
+      write_ok = it->second->Write(it->first, &writer);
+    }
+    if (write_ok) {
+      return WriteFileAtomically(
+          image_path, string(&buffer[0], writer.bytes_written()));
+    }
+    buffer.resize(buffer.size() * 2);
+  }
+}
+
+bool IsBaselineImage(const string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  char magic[kMagicSize];
+  bool is_image = read(fd, magic, kMagicSize) == kMagicSize &&
+                  memcmp(magic, kMagic, kMagicSize) == 0;
+  close(fd);
+  return is_image;
+}
+
+bool LoadBaselineImage(const string& path,
+                       const shared_ptr<const string>& prev_identity,
+                       shared_ptr<const string>* identity_out,
+                       SettingsMap* settings_out) {
+  assert(identity_out);
+  assert(settings_out);
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(ERROR, "Unable to open %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat stat_buf;
+  if (fstat(fd, &stat_buf) != 0) {
+    LOG(ERROR, "Unable to stat %s: %s", path.c_str(), strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  // Images are replaced by renaming, so a new image has a new inode.
+  const string identity = StringPrintf(
+      "%llu:%llu:%lld:%lld.%09ld",
+      static_cast<unsigned long long>(stat_buf.st_dev),
+      static_cast<unsigned long long>(stat_buf.st_ino),
+      static_cast<long long>(stat_buf.st_size),
+      static_cast<long long>(stat_buf.st_mtim.tv_sec),
+      stat_buf.st_mtim.tv_nsec);
+  if (prev_identity && identity == *prev_identity) {
+    close(fd);
+    *identity_out = prev_identity;
+    return true;
+  }
+
+  const size_t size = stat_buf.st_size;
+  void* addr = (size > kMagicSize) ?
+      mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOG(ERROR, "Unable to map %s: %s", path.c_str(),
+        (size > kMagicSize) ? strerror(errno) : "File is too short");
+    return false;
+  }
+  // String settings keep the mapping alive.
+  shared_ptr<const void> mapping(addr, [size](const void* addr) {
+    munmap(const_cast<void*>(addr), size);
+  });
+
+  const char* data = static_cast<const char*>(addr);
+  SettingsMap settings;
+  bool decode_ok = memcmp(data, kMagic, kMagicSize) == 0 &&
+      ReadProperty(data + kMagicSize, size - kMagicSize, [&](auto* reader) {
+    int32_t num_settings = 0;
+    if (!reader->ReadBytes(NULL, 8) ||
+        !reader->ReadInt32(&num_settings) ||
+        num_settings < 0) {
+      return false;
+    }
+    for (int32_t i = 0; i < num_settings; ++i) {
+      SettingView view;
+      if (!Setting::ReadView(reader, &view))
+        return false;
+      Setting* setting = Setting::FromView(view, mapping);
+      if (!settings.mutable_map()->insert(
+              make_pair(string(view.name), setting)).second) {
+        delete setting;
+        return false;
+      }
+    }
+    return true;
+  });
+  if (!decode_ok) {
+    LOG(ERROR, "Malformed baseline image %s", path.c_str());
+    return false;
+  }
+
+  LOG(INFO, "Mapped %zu setting%s from %s", settings.map().size(),
+      (settings.map().size() == 1) ? "" : "s", path.c_str());
+  settings_out->swap(&settings);
+  *identity_out = std::make_shared<const string>(identity);
+  return true;
+}
+
+}  // namespace xsettingsd
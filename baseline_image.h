@@ -0,0 +1,50 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_BASELINE_IMAGE_H__
+#define __XSETTINGSD_BASELINE_IMAGE_H__
+
+#include <memory>
+#include <string>
+
+namespace xsettingsd {
+
+class SettingsMap;
+
+// A baseline image is a compiled form of a defaults file that's meant to be
+// shared by every xsettingsd instance on a host.  It holds the settings as
+// records in the XSETTINGS wire format, so loading it just means mapping it
+// and decoding the records in place: string values refer directly to the
+// mapping, which the page cache shares between processes.
+//
+// Images are mapped rather than read, so they must be replaced by renaming
+// a new file over the old one, never rewritten in place.
+
+// Compile the defaults file (which may not contain profiles) at
+// 'config_path' into an image at 'image_path'.  Returns false and logs an
+// error on failure.
+bool BuildBaselineImage(const std::string& config_path,
+                        const std::string& image_path);
+
+// Write 'settings' as an image to 'image_path'.  Returns false and leaves
+// errno set on failure.
+bool WriteBaselineImage(const std::string& image_path,
+                        const SettingsMap& settings);
+
+// Returns true if the file at 'path' is a baseline image rather than a text
+// config.
+bool IsBaselineImage(const std::string& path);
+
+// Map the image at 'path' and decode its settings into 'settings_out'.
+// 'identity_out' receives a description of the file (its device, inode,
+// size, and modification time).  If that matches 'prev_identity', it's set
+// to 'prev_identity' and nothing is decoded.  Returns false and logs an
+// error on failure.
+bool LoadBaselineImage(const std::string& path,
+                       const std::shared_ptr<const std::string>& prev_identity,
+                       std::shared_ptr<const std::string>* identity_out,
+                       SettingsMap* settings_out);
+
+}  // namespace xsettingsd
+
+#endif
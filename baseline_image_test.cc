@@ -0,0 +1,128 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "baseline_image.h"
+#include "common.h"
+#include "setting.h"
+
+using std::shared_ptr;
+using std::string;
+
+namespace xsettingsd {
+
+class BaselineImageTest : public testing::Test {
+ protected:
+  void SetUp() {
+    char dir[] = "/tmp/baseline_image_test.XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+    config_path_ = dir_ + "/defaults.conf";
+    image_path_ = dir_ + "/defaults.img";
+  }
+
+  void TearDown() {
+    unlink(config_path_.c_str());
+    unlink(image_path_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  string dir_;
+  string config_path_;
+  string image_path_;
+};
+
+TEST_F(BaselineImageTest, RoundTrip) {
+  ASSERT_TRUE(WriteFileAtomically(
+      config_path_,
+      "Net/ThemeName \"Adwaita\"\n"
+      "Xft/DPI 98304\n"
+      "Gtk/ColorBg (65535, 0, 32768)\n"));
+  EXPECT_FALSE(IsBaselineImage(config_path_));
+  ASSERT_TRUE(BuildBaselineImage(config_path_, image_path_));
+  EXPECT_TRUE(IsBaselineImage(image_path_));
+
+  // Images can't be compiled again.
+  EXPECT_FALSE(BuildBaselineImage(image_path_, config_path_));
+
+  shared_ptr<const string> identity;
+  SettingsMap settings;
+  ASSERT_TRUE(LoadBaselineImage(image_path_, NULL, &identity, &settings));
+  ASSERT_TRUE(identity != NULL);
+  ASSERT_EQ(3U, settings.map().size());
+  EXPECT_EQ("\"Adwaita\"",
+            settings.GetSetting("Net/ThemeName")->FormatValue());
+  EXPECT_EQ("98304", settings.GetSetting("Xft/DPI")->FormatValue());
+  EXPECT_EQ("(65535, 0, 32768, 65535)",
+            settings.GetSetting("Gtk/ColorBg")->FormatValue());
+
+  // String values outlive the map that they were decoded into.
+  Setting* theme = settings.GetSetting("Net/ThemeName")->Clone();
+  {
+    SettingsMap discarded;
+    discarded.swap(&settings);
+  }
+  EXPECT_EQ("\"Adwaita\"", theme->FormatValue());
+  delete theme;
+
+  // An unchanged image isn't decoded again.
+  SettingsMap unchanged;
+  shared_ptr<const string> new_identity;
+  ASSERT_TRUE(LoadBaselineImage(image_path_, identity, &new_identity,
+                                &unchanged));
+  EXPECT_EQ(identity, new_identity);
+  EXPECT_TRUE(unchanged.map().empty());
+
+  // A rebuilt one is.
+  ASSERT_TRUE(WriteFileAtomically(config_path_, "Xft/DPI 1\n"));
+  ASSERT_TRUE(BuildBaselineImage(config_path_, image_path_));
+  ASSERT_TRUE(LoadBaselineImage(image_path_, identity, &new_identity,
+                                &unchanged));
+  EXPECT_NE(*identity, *new_identity);
+  ASSERT_EQ(1U, unchanged.map().size());
+  EXPECT_EQ("1", unchanged.GetSetting("Xft/DPI")->FormatValue());
+}
+
+TEST_F(BaselineImageTest, Malformed) {
+  shared_ptr<const string> identity;
+  SettingsMap settings;
+  EXPECT_FALSE(LoadBaselineImage(image_path_, NULL, &identity, &settings));
+
+  ASSERT_TRUE(WriteFileAtomically(config_path_, "Xft/DPI 98304\n"));
+  ASSERT_TRUE(BuildBaselineImage(config_path_, image_path_));
+  string data;
+  ASSERT_TRUE(ReadFile(image_path_, &data));
+
+  // Truncated images, images claiming more settings than they contain, and
+  // images with duplicate settings are all rejected.
+  ASSERT_TRUE(WriteFileAtomically(image_path_,
+                                  data.substr(0, data.size() - 1)));
+  EXPECT_FALSE(LoadBaselineImage(image_path_, NULL, &identity, &settings));
+  const size_t count_byte = IsLittleEndian() ? 16 : 19;
+  string extra = data;
+  extra[count_byte]++;
+  ASSERT_TRUE(WriteFileAtomically(image_path_, extra));
+  EXPECT_FALSE(LoadBaselineImage(image_path_, NULL, &identity, &settings));
+  string duplicate = data + data.substr(24);
+  duplicate[count_byte]++;
+  ASSERT_TRUE(WriteFileAtomically(image_path_, duplicate));
+  EXPECT_FALSE(LoadBaselineImage(image_path_, NULL, &identity, &settings));
+  EXPECT_TRUE(settings.map().empty());
+
+  ASSERT_TRUE(WriteFileAtomically(image_path_, "XSDBASE1"));
+  EXPECT_FALSE(LoadBaselineImage(image_path_, NULL, &identity, &settings));
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -3,9 +3,14 @@
 
 #include "common.h"
 
+#include <cassert>
+#include <cerrno>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#include <ctime>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using std::string;
 using std::vector;
@@ -45,9 +50,50 @@ vector<string> SplitString(const string& str, const string& delim) {
   return parts;
 }
 
-bool IsLittleEndian() {
-  int i = 1;
-  return reinterpret_cast<char*>(&i)[0];
+double GetMonotonicTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool ReadFile(const string& path, string* data_out) {
+  assert(data_out);
+  data_out->clear();
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file)
+    return false;
+
+  struct stat stat_buf;
+  if (fstat(fileno(file), &stat_buf) == 0 && stat_buf.st_size > 0)
+    data_out->reserve(stat_buf.st_size);
+
+  char buffer[4096];
+  size_t bytes_read = 0;
+  while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    data_out->append(buffer, bytes_read);
+  bool success = !ferror(file);
+  fclose(file);
+  if (!success)
+    errno = EIO;
+  return success;
+}
+
+bool WriteFileAtomically(const string& path, const string& data) {
+  string temp_path = path + ".tmp";
+  FILE* file = fopen(temp_path.c_str(), "w");
+  if (!file)
+    return false;
+
+  bool success = fwrite(data.data(), 1, data.size(), file) == data.size();
+  if (fclose(file) != 0)
+    success = false;
+  if (!success || rename(temp_path.c_str(), path.c_str()) != 0) {
+    int saved_errno = errno;
+    unlink(temp_path.c_str());
+    errno = saved_errno;
+    return false;
+  }
+  return true;
 }
 
 int GetPadding(int length, int increment) {
@@ -21,10 +21,26 @@ std::string StringPrintf(const char* format, ...);
 std::vector<std::string> SplitString(const std::string& str,
                                      const std::string& delim);
 
-bool IsLittleEndian();
+// Returns true if the host is little-endian.
+constexpr bool IsLittleEndian() {
+  return __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+}
 
 int GetPadding(int length, int increment);
 
+// Returns the current time from the monotonic clock, in seconds.
+double GetMonotonicTime();
+
+// Read the contents of the file at 'path' into 'data_out', replacing its
+// previous contents but reusing its storage.  Returns false and leaves
+// errno set on failure.
+bool ReadFile(const std::string& path, std::string* data_out);
+
+// Replace the file at 'path' with 'data' by writing it to a temporary file
+// and renaming that over 'path', so that readers never see a partial file.
+// Returns false and leaves errno set on failure.
+bool WriteFileAtomically(const std::string& path, const std::string& data);
+
 // Returns $HOME/.xsettingsd followed by all of the config file locations
 // specified by the XDG Base Directory Specification
 // (http://standards.freedesktop.org/basedir-spec/basedir-spec-latest.html).
@@ -0,0 +1,267 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include "config_loader.h"
+
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "baseline_image.h"
+#include "config_parser.h"
+#include "logging.h"
+
+using std::make_pair;
+using std::shared_ptr;
+using std::string;
+
+namespace xsettingsd {
+
+ConfigLoader::ConfigLoader(const string& config_filename)
+    : config_filename_(config_filename),
+      thread_(NULL),
+      requested_id_(0),
+      stopping_(false),
+      mailbox_(NULL),
+      wake_pending_(false) {
+  wake_fds_[0] = wake_fds_[1] = -1;
+}
+
+ConfigLoader::~ConfigLoader() {
+  if (thread_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_.store(true);
+    }
+    cond_.notify_one();
+    thread_->join();
+    delete thread_;
+    thread_ = NULL;
+    close(wake_fds_[0]);
+    close(wake_fds_[1]);
+    wake_fds_[0] = wake_fds_[1] = -1;
+  }
+  delete mailbox_.exchange(NULL);
+}
+
+ConfigGeneration* ConfigLoader::Load(
+    const shared_ptr<const string>& prev_defaults,
+    const shared_ptr<const string>& prev_config) {
+  assert(!thread_);
+  return LoadFiles(prev_defaults, prev_config, requested_id_.load());
+}
+
+bool ConfigLoader::Start() {
+  assert(!thread_);
+  if (pipe2(wake_fds_, O_CLOEXEC | O_NONBLOCK) != 0) {
+    LOG(ERROR, "Unable to create config loader pipe: %s", strerror(errno));
+    return false;
+  }
+
+  // Block all signals in the worker thread so that they're delivered to the
+  // main thread (which relies on SIGHUP interrupting select()).
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  thread_ = new std::thread(&ConfigLoader::RunWorkerThread, this);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  return true;
+}
+
+void ConfigLoader::RequestLoad(const shared_ptr<const string>& prev_defaults,
+                               const shared_ptr<const string>& prev_config) {
+  assert(thread_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requested_defaults_ = prev_defaults;
+    requested_config_ = prev_config;
+    requested_id_.fetch_add(1);
+  }
+  cond_.notify_one();
+}
+
+ConfigGeneration* ConfigLoader::TakeGeneration() {
+  // Drain the pipe before clearing the flag so that a generation that's
+  // published in between still gets a byte written for it, and clear the
+  // flag before emptying the mailbox so that one that's published after
+  // we've looked does too.
+  if (thread_) {
+    char buffer[64];
+    while (read(wake_fds_[0], buffer, sizeof(buffer)) > 0) {}
+    wake_pending_.store(false);
+  }
+  return mailbox_.exchange(NULL);
+}
+
+void ConfigLoader::RunWorkerThread() {
+  uint64_t handled_id = 0;
+  while (true) {
+    shared_ptr<const string> prev_defaults, prev_config;
+    uint64_t request_id = 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [&]() {
+        return stopping_.load() || requested_id_.load() != handled_id;
+      });
+      if (stopping_.load())
+        return;
+      request_id = requested_id_.load();
+      prev_defaults = requested_defaults_;
+      prev_config = requested_config_;
+    }
+    handled_id = request_id;
+
+    // If a newer request came in, we'll pick it up next time around.
+    ConfigGeneration* gen = LoadFiles(prev_defaults, prev_config, request_id);
+    if (!gen)
+      continue;
+
+    // Replace any generation that the event loop hasn't taken yet.
+    delete mailbox_.exchange(gen);
+    if (!wake_pending_.exchange(true)) {
+      char ch = 0;
+      // The pipe is non-blocking; if it's somehow full, the event loop is
+      // already going to wake up.
+      if (write(wake_fds_[1], &ch, 1) < 0) {}
+    }
+  }
+}
+
+bool ConfigLoader::IsCanceled(uint64_t request_id) const {
+  return stopping_.load() || requested_id_.load() != request_id;
+}
+
+ConfigGeneration* ConfigLoader::LoadFiles(
+    const shared_ptr<const string>& prev_defaults,
+    const shared_ptr<const string>& prev_config,
+    uint64_t request_id) {
+  ConfigGeneration* gen = new ConfigGeneration;
+  bool ok = true;
+  if (!defaults_filename_.empty() && IsBaselineImage(defaults_filename_)) {
+    // Images are decoded in place, so mapping them counts as reading.
+    const double start_time = GetMonotonicTime();
+    ok = LoadBaselineImage(defaults_filename_, prev_defaults,
+                           &gen->defaults_text, &gen->defaults);
+    gen->read_time += GetMonotonicTime() - start_time;
+    gen->defaults_parsed = ok && gen->defaults_text != prev_defaults;
+  } else if (!defaults_filename_.empty()) {
+    ok = ReadConfigFile(defaults_filename_, prev_defaults,
+                        &gen->defaults_text, gen);
+    if (ok && gen->defaults_text != prev_defaults) {
+      gen->defaults_parsed = true;
+      ok = ParseConfigFile(defaults_filename_, gen->defaults_text,
+                           &gen->defaults, NULL, gen);
+    }
+  }
+
+  if (ok && !IsCanceled(request_id))
+    ok = ReadConfigFile(config_filename_, prev_config, &gen->config_text, gen);
+  if (ok && !IsCanceled(request_id) && gen->config_text != prev_config) {
+    SettingsMap base;
+    ProfileMap sections;
+    gen->config_parsed = true;
+    ok = ParseConfigFile(config_filename_, gen->config_text, &base, &sections,
+                         gen);
+    if (ok) {
+      LOG(INFO, "Loaded %zu setting%s and %zu profile%s from %s",
+          base.map().size(), (base.map().size() == 1) ? "" : "s",
+          sections.map().size(), (sections.map().size() == 1) ? "" : "s",
+          config_filename_.c_str());
+      BuildProfiles(&base, &sections, &gen->config);
+    }
+  }
+
+  if (IsCanceled(request_id)) {
+    delete gen;
+    return NULL;
+  }
+  gen->ok = ok;
+  return gen;
+}
+
+bool ConfigLoader::ReadConfigFile(const string& path,
+                                  const shared_ptr<const string>& prev_text,
+                                  shared_ptr<const string>* text_out,
+                                  ConfigGeneration* gen) {
+  assert(text_out);
+  assert(gen);
+
+  // Read the whole file up front so that disk I/O and parsing can be timed
+  // separately.
+  const double start_time = GetMonotonicTime();
+  const bool read_ok = ReadFile(path, &read_buffer_);
+  gen->read_time += GetMonotonicTime() - start_time;
+  if (!read_ok) {
+    LOG(ERROR, "Unable to read %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  // String settings refer directly to the file's text where they can, so a
+  // changed file is handed off to a buffer that lives as long as they do.
+  if (prev_text && read_buffer_ == *prev_text)
+    *text_out = prev_text;
+  else
+    *text_out = std::make_shared<const string>(std::move(read_buffer_));
+  return true;
+}
+
+// static
+bool ConfigLoader::ParseConfigFile(const string& path,
+                                   const shared_ptr<const string>& text,
+                                   SettingsMap* settings_out,
+                                   ProfileMap* sections_out,
+                                   ConfigGeneration* gen) {
+  assert(settings_out);
+  assert(gen);
+
+  // Serials are assigned when the settings are merged.
+  ConfigParser parser(new ConfigParser::StringCharStream(text));
+  const double start_time = GetMonotonicTime();
+  const bool parse_ok = parser.Parse(settings_out, NULL, 0, sections_out);
+  gen->parse_time += GetMonotonicTime() - start_time;
+  if (!parse_ok) {
+    LOG(ERROR, "Unable to parse %s: %s", path.c_str(),
+        parser.FormatError().c_str());
+  }
+  return parse_ok;
+}
+
+// static
+void ConfigLoader::BuildProfiles(SettingsMap* base,
+                                 ProfileMap* sections,
+                                 ProfileMap* profiles_out) {
+  assert(base);
+  assert(sections);
+  assert(profiles_out);
+
+  for (ProfileMap::Map::iterator it = sections->mutable_map()->begin();
+       it != sections->mutable_map()->end(); ++it) {
+    SettingsMap* settings = new SettingsMap;
+    SettingsMap::Map* map = settings->mutable_map();
+    for (SettingsMap::Map::const_iterator base_it = base->map().begin();
+         base_it != base->map().end(); ++base_it) {
+      map->insert(make_pair(base_it->first, base_it->second->Clone()));
+    }
+
+    SettingsMap::Map* section = it->second->mutable_map();
+    for (SettingsMap::Map::iterator section_it = section->begin();
+         section_it != section->end(); ++section_it) {
+      Setting*& setting = (*map)[section_it->first];
+      delete setting;
+      setting = section_it->second;
+      section_it->second = NULL;
+    }
+    profiles_out->mutable_map()->insert(make_pair(it->first, settings));
+  }
+
+  SettingsMap* default_settings = new SettingsMap;
+  default_settings->swap(base);
+  profiles_out->mutable_map()->insert(
+      make_pair(string(kDefaultProfileName), default_settings));
+}
+
+}  // namespace xsettingsd
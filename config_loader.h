@@ -0,0 +1,176 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_CONFIG_LOADER_H__
+#define __XSETTINGSD_CONFIG_LOADER_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+
+#include "common.h"
+#include "setting.h"
+
+namespace xsettingsd {
+
+// The result of reading and parsing the config files.  Once a generation
+// has been handed to its consumer, nothing else refers to it.
+struct ConfigGeneration {
+  ConfigGeneration()
+      : ok(false),
+        defaults_parsed(false),
+        config_parsed(false),
+        read_time(0),
+        parse_time(0) {
+  }
+
+  // False if a file couldn't be read or parsed.  The error has already been
+  // logged.
+  bool ok;
+
+  // Text of each file.  A file whose text matched the text that the load
+  // was requested relative to isn't parsed again; its pointer is the same
+  // as the previous one and its settings below are empty.  The defaults
+  // text is NULL if there's no defaults file, and if the defaults file is a
+  // baseline image, it's the image's identity from LoadBaselineImage().
+  std::shared_ptr<const std::string> defaults_text;
+  std::shared_ptr<const std::string> config_text;
+  bool defaults_parsed;
+  bool config_parsed;
+
+  // Settings from the defaults file and complete settings for each of the
+  // config file's profiles, including the default one.  Serials aren't
+  // assigned.
+  SettingsMap defaults;
+  ProfileMap config;
+
+  // Seconds spent reading and parsing the files.
+  double read_time;
+  double parse_time;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ConfigGeneration);
+};
+
+// ConfigLoader reads and parses the config files, either on the calling
+// thread or on a worker thread so that a large config doesn't keep the
+// X event loop from running.  The worker hands each generation that it
+// produces to the event loop through a single-slot mailbox, replacing any
+// generation that hasn't been taken yet, and writes to a pipe to wake it.
+class ConfigLoader {
+ public:
+  ConfigLoader(const std::string& config_filename);
+  ~ConfigLoader();
+
+  const std::string& defaults_filename() const { return defaults_filename_; }
+  const std::string& config_filename() const { return config_filename_; }
+
+  // Also load default settings from 'path'.  Must be called before Start().
+  void set_defaults_filename(const std::string& path) {
+    defaults_filename_ = path;
+  }
+
+  // Read and parse the files on the calling thread.  'prev_defaults' and
+  // 'prev_config' are the texts that were last loaded (or NULL); files
+  // whose text is unchanged aren't parsed again.  Returns a
+  // newly-allocated generation that the caller is responsible for
+  // deleting.  May only be called before Start().
+  ConfigGeneration* Load(
+      const std::shared_ptr<const std::string>& prev_defaults,
+      const std::shared_ptr<const std::string>& prev_config);
+
+  // Start the worker thread.
+  bool Start();
+  bool started() const { return thread_ != NULL; }
+
+  // File descriptor that becomes readable when a generation is waiting in
+  // the mailbox.  Only valid after Start().
+  int wake_fd() const { return wake_fds_[0]; }
+
+  // Ask the worker thread to load the files, like Load().  A load that's
+  // already in progress is abandoned rather than finished.
+  void RequestLoad(const std::shared_ptr<const std::string>& prev_defaults,
+                   const std::shared_ptr<const std::string>& prev_config);
+
+  // Take the newest generation from the mailbox, or NULL if it's empty.
+  // The caller is responsible for deleting it.
+  ConfigGeneration* TakeGeneration();
+
+ private:
+  // Body of the worker thread.
+  void RunWorkerThread();
+
+  // Returns true if the load with ID 'request_id' has been superseded by a
+  // newer request or the worker is stopping.
+  bool IsCanceled(uint64_t request_id) const;
+
+  // Implementation of Load().  Returns NULL if 'request_id' is canceled
+  // partway through.
+  ConfigGeneration* LoadFiles(
+      const std::shared_ptr<const std::string>& prev_defaults,
+      const std::shared_ptr<const std::string>& prev_config,
+      uint64_t request_id);
+
+  // Read the file at 'path' into 'read_buffer_' and, if its contents differ
+  // from 'prev_text', move them to 'text_out'; otherwise, copy 'prev_text'
+  // to 'text_out'.  Returns false on failure.  Adds the time taken to
+  // 'gen'.
+  bool ReadConfigFile(const std::string& path,
+                      const std::shared_ptr<const std::string>& prev_text,
+                      std::shared_ptr<const std::string>* text_out,
+                      ConfigGeneration* gen);
+
+  // Parse 'text' (read from 'path') into 'settings_out'.  Profile sections
+  // are only allowed if 'sections_out' is non-NULL.  Returns false on
+  // failure.  Adds the time taken to 'gen'.
+  static bool ParseConfigFile(const std::string& path,
+                              const std::shared_ptr<const std::string>& text,
+                              SettingsMap* settings_out,
+                              ProfileMap* sections_out,
+                              ConfigGeneration* gen);
+
+  // Combine the config's top-level settings ('base') and its profile
+  // sections (as returned by ConfigParser::Parse()) into complete settings
+  // for each profile, including the default one.  Takes ownership of the
+  // settings in 'base' and 'sections'.
+  static void BuildProfiles(SettingsMap* base,
+                            ProfileMap* sections,
+                            ProfileMap* profiles_out);
+
+  std::string defaults_filename_;
+  std::string config_filename_;
+
+  // Scratch buffer that files are read into.  Kept around so that reloads
+  // of an unchanged file can reuse its storage.  Only used by one thread at
+  // a time: the caller of Load() before Start(), and the worker after.
+  std::string read_buffer_;
+
+  std::thread* thread_;
+
+  // Protects the request below.  'requested_id_' is also read without the
+  // lock to notice that a load has been superseded.
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::atomic<uint64_t> requested_id_;
+  std::atomic<bool> stopping_;
+  std::shared_ptr<const std::string> requested_defaults_;
+  std::shared_ptr<const std::string> requested_config_;
+
+  // Newest generation that hasn't been taken, or NULL.
+  std::atomic<ConfigGeneration*> mailbox_;
+
+  // Pipe used to wake the event loop.  'wake_pending_' is set while a byte
+  // is (or is about to be) in the pipe.
+  int wake_fds_[2];
+  std::atomic<bool> wake_pending_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConfigLoader);
+};
+
+}  // namespace xsettingsd
+
+#endif
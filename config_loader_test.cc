@@ -0,0 +1,141 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "config_loader.h"
+#include "config_parser.h"
+#include "setting.h"
+
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+
+namespace xsettingsd {
+
+class ConfigLoaderTest : public testing::Test {
+ protected:
+  void SetUp() {
+    char dir[] = "/tmp/config_loader_test.XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+    path_ = dir_ + "/xsettingsd.conf";
+    defaults_path_ = dir_ + "/defaults.conf";
+  }
+
+  void TearDown() {
+    unlink(path_.c_str());
+    unlink(defaults_path_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  // Replace the contents of the file at 'path' with 'data'.
+  void WriteFile(const string& path, const string& data) {
+    FILE* file = fopen(path.c_str(), "w");
+    ASSERT_TRUE(file != NULL);
+    ASSERT_EQ(data.size(), fwrite(data.data(), 1, data.size(), file));
+    ASSERT_EQ(0, fclose(file));
+  }
+
+  // Wait for 'loader' to produce a generation and take it.
+  ConfigGeneration* WaitForGeneration(ConfigLoader* loader) {
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(loader->wake_fd(), &read_fds);
+    struct timeval timeout = { 10, 0 };
+    if (select(loader->wake_fd() + 1, &read_fds, NULL, NULL, &timeout) != 1)
+      return NULL;
+    return loader->TakeGeneration();
+  }
+
+  string dir_;
+  string path_;
+  string defaults_path_;
+};
+
+TEST_F(ConfigLoaderTest, Load) {
+  WriteFile(defaults_path_, "Xft/Hinting 1\n");
+  WriteFile(path_, "Net/ThemeName \"Adwaita\"\n"
+                   "[night]\nNet/ThemeName \"Adwaita-dark\"\n");
+  ConfigLoader loader(path_);
+  loader.set_defaults_filename(defaults_path_);
+  unique_ptr<ConfigGeneration> gen(loader.Load(NULL, NULL));
+  ASSERT_TRUE(gen->ok);
+  EXPECT_TRUE(gen->defaults_parsed);
+  EXPECT_TRUE(gen->config_parsed);
+  EXPECT_EQ("Xft/Hinting 1\n", *gen->defaults_text);
+  EXPECT_TRUE(gen->defaults.GetSetting("Xft/Hinting") != NULL);
+  ASSERT_EQ(2U, gen->config.map().size());
+  EXPECT_EQ("\"Adwaita\"", gen->config.GetProfile(kDefaultProfileName)->
+                GetSetting("Net/ThemeName")->FormatValue());
+  EXPECT_EQ("\"Adwaita-dark\"", gen->config.GetProfile("night")->
+                GetSetting("Net/ThemeName")->FormatValue());
+
+  // Files that haven't changed aren't parsed again.
+  const shared_ptr<const string> defaults_text = gen->defaults_text;
+  const shared_ptr<const string> config_text = gen->config_text;
+  WriteFile(defaults_path_, "Xft/Hinting 0\n");
+  gen.reset(loader.Load(defaults_text, config_text));
+  ASSERT_TRUE(gen->ok);
+  EXPECT_TRUE(gen->defaults_parsed);
+  EXPECT_FALSE(gen->config_parsed);
+  EXPECT_EQ(config_text, gen->config_text);
+  EXPECT_TRUE(gen->config.map().empty());
+
+  // Errors are reported.
+  WriteFile(path_, "Net/ThemeName\n");
+  gen.reset(loader.Load(defaults_text, config_text));
+  EXPECT_FALSE(gen->ok);
+  unlink(path_.c_str());
+  gen.reset(loader.Load(defaults_text, config_text));
+  EXPECT_FALSE(gen->ok);
+}
+
+TEST_F(ConfigLoaderTest, Worker) {
+  WriteFile(path_, "Net/ThemeName \"Adwaita\"\n");
+  ConfigLoader loader(path_);
+  ASSERT_TRUE(loader.Start());
+  EXPECT_TRUE(loader.TakeGeneration() == NULL);
+
+  loader.RequestLoad(NULL, NULL);
+  unique_ptr<ConfigGeneration> gen(WaitForGeneration(&loader));
+  ASSERT_TRUE(gen.get() != NULL);
+  ASSERT_TRUE(gen->ok);
+  EXPECT_TRUE(gen->config_parsed);
+  EXPECT_TRUE(loader.TakeGeneration() == NULL);
+
+  // In a burst of requests, loads that are in progress are abandoned and
+  // generations that haven't been taken are replaced, but the last one
+  // reflects the last change.
+  const shared_ptr<const string> config_text = gen->config_text;
+  for (int i = 0; i < 20; ++i) {
+    ASSERT_TRUE(WriteFileAtomically(path_, StringPrintf("Xft/DPI %d\n", i)));
+    loader.RequestLoad(NULL, config_text);
+  }
+  while (true) {
+    gen.reset(WaitForGeneration(&loader));
+    ASSERT_TRUE(gen.get() != NULL);
+    ASSERT_TRUE(gen->ok);
+    const SettingsMap* settings =
+        gen->config.GetProfile(kDefaultProfileName);
+    ASSERT_TRUE(settings != NULL);
+    const Setting* dpi = settings->GetSetting("Xft/DPI");
+    ASSERT_TRUE(dpi != NULL);
+    if (dpi->FormatValue() == "19")
+      break;
+  }
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -8,16 +8,28 @@
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
-#include <vector>
 
+#include "probes.h"
 #include "setting.h"
+#include "well_known_settings.h"
 
 using std::map;
 using std::string;
-using std::vector;
 
 namespace xsettingsd {
 
+const char kDefaultProfileName[] = "default";
+
+// Describe 'type' for error messages.
+static const char* GetTypeDescription(Setting::Type type) {
+  switch (type) {
+    case Setting::TYPE_INTEGER: return "an integer";
+    case Setting::TYPE_STRING:  return "a string";
+    case Setting::TYPE_COLOR:   return "a color";
+  }
+  return "unknown";
+}
+
 ConfigParser::ConfigParser(CharStream* stream)
     : stream_(NULL),
       error_line_num_(0) {
@@ -46,8 +58,17 @@ void ConfigParser::Reset(CharStream* stream) {
 bool ConfigParser::Parse(SettingsMap* settings,
                          const SettingsMap* prev_settings,
                          uint32_t serial) {
+  return Parse(settings, prev_settings, serial, NULL);
+}
+
+bool ConfigParser::Parse(SettingsMap* settings,
+                         const SettingsMap* prev_settings,
+                         uint32_t serial,
+                         ProfileMap* profiles) {
   assert(settings);
   settings->mutable_map()->clear();
+  if (profiles)
+    ProfileMap().swap(profiles);
 
   string stream_error;
   if (!stream_->Init(&stream_error)) {
@@ -69,6 +90,10 @@ bool ConfigParser::Parse(SettingsMap* settings,
   string setting_name;
   bool in_comment = false;
 
+  // Map that settings are currently being added to: either 'settings' or
+  // the current profile section's map.
+  SettingsMap* section_settings = settings;
+
   while (!stream_->AtEOF()) {
     int ch = stream_->GetChar();
 
@@ -94,9 +119,30 @@ bool ConfigParser::Parse(SettingsMap* settings,
 
     switch (state) {
       case NO_SETTING_NAME:
+        if (ch == '[') {
+          if (!profiles) {
+            SetErrorF("Got profile section where none are allowed");
+            return false;
+          }
+          string profile_name;
+          if (!ReadProfileName(&profile_name))
+            return false;
+          if (profile_name == kDefaultProfileName ||
+              profiles->map().count(profile_name)) {
+            SetErrorF("Got duplicate profile name \"%s\"",
+                      profile_name.c_str());
+            return false;
+          }
+          section_settings = new SettingsMap;
+          profiles->mutable_map()->insert(
+              make_pair(profile_name, section_settings));
+          // Only a comment can follow the header.
+          state = GOT_VALUE;
+          break;
+        }
         if (!ReadSettingName(&setting_name))
           return false;
-        if (settings->map().count(setting_name)) {
+        if (section_settings->map().count(setting_name)) {
           SetErrorF("Got duplicate setting name \"%s\"", setting_name.c_str());
           return false;
         }
@@ -107,10 +153,25 @@ bool ConfigParser::Parse(SettingsMap* settings,
           Setting* setting = NULL;
           if (!ReadValue(&setting))
             return false;
+          // Catch values that clients would ignore because they have the
+          // wrong type.
+          const int known_id = LookupWellKnownSetting(setting_name);
+          if (known_id >= 0 &&
+              setting->type() != GetWellKnownSettingType(known_id)) {
+            SetErrorF("Setting \"%s\" should be %s", setting_name.c_str(),
+                      GetTypeDescription(GetWellKnownSettingType(known_id)));
+            delete setting;
+            return false;
+          }
           const Setting* prev_setting =
-              prev_settings ? prev_settings->GetSetting(setting_name) : NULL;
+              (prev_settings && section_settings == settings) ?
+              prev_settings->GetSetting(setting_name) :
+              NULL;
           setting->UpdateSerial(prev_setting, serial);
-          settings->mutable_map()->insert(make_pair(setting_name, setting));
+          section_settings->mutable_map()->insert(
+              make_pair(setting_name, setting));
+          XSETTINGSD_PROBE2(setting_parsed, setting_name.c_str(),
+                            setting->serial());
         }
         state = GOT_VALUE;
         break;
@@ -161,6 +222,16 @@ int ConfigParser::CharStream::GetChar() {
   return ch;
 }
 
+const std::shared_ptr<const string>* ConfigParser::CharStream::GetBuffer(
+    size_t* offset_out) {
+  assert(initialized_);
+  assert(offset_out);
+  const std::shared_ptr<const string>* buffer = GetBufferImpl(offset_out);
+  if (buffer && have_buffered_char_)
+    (*offset_out)--;
+  return buffer;
+}
+
 void ConfigParser::CharStream::UngetChar(int ch) {
   if (prev_at_line_end_)
     line_num_--;
@@ -208,16 +279,70 @@ int ConfigParser::FileCharStream::GetCharImpl() {
 }
 
 ConfigParser::StringCharStream::StringCharStream(const string& data)
+    : data_(std::make_shared<const string>(data)),
+      pos_(0) {
+}
+
+ConfigParser::StringCharStream::StringCharStream(
+    const std::shared_ptr<const string>& data)
     : data_(data),
       pos_(0) {
+  assert(data_);
 }
 
 bool ConfigParser::StringCharStream::AtEOFImpl() {
-  return pos_ == data_.size();
+  return pos_ == data_->size();
 }
 
 int ConfigParser::StringCharStream::GetCharImpl() {
-  return data_.at(pos_++);
+  return data_->at(pos_++);
+}
+
+const std::shared_ptr<const string>*
+ConfigParser::StringCharStream::GetBufferImpl(size_t* offset_out) {
+  *offset_out = pos_;
+  return &data_;
+}
+
+bool ConfigParser::ReadProfileName(string* name_out) {
+  assert(name_out);
+  name_out->clear();
+
+  if (stream_->AtEOF() || stream_->GetChar() != '[') {
+    SetErrorF("Expected '[' at start of profile section");
+    return false;
+  }
+
+  while (true) {
+    if (stream_->AtEOF()) {
+      SetErrorF("Got unterminated profile section");
+      return false;
+    }
+
+    int ch = stream_->GetChar();
+    if (ch == ']')
+      break;
+
+    if (!(ch >= 'A' && ch <= 'Z') &&
+        !(ch >= 'a' && ch <= 'z') &&
+        !(ch >= '0' && ch <= '9') &&
+        !(ch == '_' || ch == '-')) {
+      if (ch == '\n') {
+        stream_->UngetChar(ch);
+        SetErrorF("Got unterminated profile section");
+      } else {
+        SetErrorF("Got invalid character '%c' in profile name", ch);
+      }
+      return false;
+    }
+    name_out->push_back(ch);
+  }
+
+  if (name_out->empty()) {
+    SetErrorF("Got empty profile name");
+    return false;
+  }
+  return true;
 }
 
 bool ConfigParser::ReadSettingName(string* name_out) {
@@ -295,10 +420,26 @@ bool ConfigParser::ReadValue(Setting** setting_ptr) {
       return false;
     *setting_ptr = new IntegerSetting(value);
   } else if (ch == '"') {
-    string value;
-    if (!ReadString(&value))
+    size_t start = 0;
+    const std::shared_ptr<const string>* buffer = stream_->GetBuffer(&start);
+
+    // Reuse the same buffer for every string so that it only needs to grow
+    // a few times per parse.
+    if (!ReadString(&string_buffer_))
       return false;
-    *setting_ptr = new StringSetting(value);
+
+    // Each escape sequence is one character longer than the character it
+    // decodes to, so if the quoted text is the same length as the value, it
+    // contains no escapes and the value can be used from the buffer.
+    size_t end = 0;
+    if (buffer && stream_->GetBuffer(&end) &&
+        end - start - 2 == string_buffer_.size()) {
+      *setting_ptr = new StringSetting(
+          std::string_view((*buffer)->data() + start + 1, end - start - 2),
+          *buffer);
+    } else {
+      *setting_ptr = new StringSetting(string_buffer_);
+    }
   } else if (ch == '(') {
     uint16_t red, green, blue, alpha;
     if (!ReadColor(&red, &green, &blue, &alpha))
@@ -409,6 +550,14 @@ bool ConfigParser::ReadString(string* str_out) {
   return true;
 }
 
+// Append 'num' to 'nums' (which has room for four numbers) if there's space
+// and increment 'num_nums' regardless.
+static void AddColorComponent(int num, uint16_t* nums, size_t* num_nums) {
+  if (*num_nums < 4)
+    nums[*num_nums] = num;
+  (*num_nums)++;
+}
+
 bool ConfigParser::ReadColor(uint16_t* red_out,
                              uint16_t* green_out,
                              uint16_t* blue_out,
@@ -423,7 +572,10 @@ bool ConfigParser::ReadColor(uint16_t* red_out,
     return false;
   }
 
-  vector<uint16_t> nums;
+  // Only the first four numbers are saved, but we keep counting so that we
+  // can report how many there were.
+  uint16_t nums[4];
+  size_t num_nums = 0;
 
   enum State {
     BEFORE_NUM,
@@ -451,14 +603,14 @@ bool ConfigParser::ReadColor(uint16_t* red_out,
         return false;
       }
       if (state == IN_NUM)
-        nums.push_back(num);
+        AddColorComponent(num, nums, &num_nums);
       break;
     }
 
     if (isspace(ch)) {
       if (state == IN_NUM) {
         state = AFTER_NUM;
-        nums.push_back(num);
+        AddColorComponent(num, nums, &num_nums);
       }
       continue;
     }
@@ -469,7 +621,7 @@ bool ConfigParser::ReadColor(uint16_t* red_out,
         return false;
       }
       if (state == IN_NUM)
-        nums.push_back(num);
+        AddColorComponent(num, nums, &num_nums);
       state = BEFORE_NUM;
       continue;
     }
@@ -493,16 +645,16 @@ bool ConfigParser::ReadColor(uint16_t* red_out,
     // nice to warn the user that their setting is going to wrap).
   }
 
-  if (nums.size() < 3 || nums.size() > 4) {
+  if (num_nums < 3 || num_nums > 4) {
     SetErrorF("Got %d number%s instead of 3 or 4",
-              nums.size(), (nums.size() == 1 ? "" : "s"));
+              static_cast<int>(num_nums), (num_nums == 1 ? "" : "s"));
     return false;
   }
 
-  *red_out = nums.at(0);
-  *green_out = nums.at(1);
-  *blue_out = nums.at(2);
-  *alpha_out = (nums.size() == 4) ? nums.at(3) : 65535;
+  *red_out = nums[0];
+  *green_out = nums[1];
+  *blue_out = nums[2];
+  *alpha_out = (num_nums == 4) ? nums[3] : 65535;
   return true;
 }
 
@@ -5,6 +5,7 @@
 #define __XSETTINGSD_CONFIG_PARSER_H__
 
 #include <map>
+#include <memory>
 #include <stdint.h>
 #include <string>
 
@@ -16,9 +17,14 @@
 
 namespace xsettingsd {
 
+class ProfileMap;
 class Setting;
 class SettingsMap;
 
+// Name of the profile made up of the settings that appear before any
+// "[name]" section in a config file.
+extern const char kDefaultProfileName[];
+
 // Doing the parsing by hand like this for a line-based config format is
 // pretty much the worst idea ever -- it would've been much easier to use
 // libpcrecpp. :-(  The tests all pass, though, for whatever that's worth.
@@ -47,6 +53,15 @@ class ConfigParser {
              const SettingsMap* prev_settings,
              uint32_t serial);
 
+  // Like the above, but also accepts "[name]" lines that start profile
+  // sections.  Settings that appear in a section are added to a
+  // newly-allocated map in 'profiles' (keyed by the section's name) instead
+  // of to 'settings', and are given 'serial' unconditionally.
+  bool Parse(SettingsMap* settings,
+             const SettingsMap* prev_settings,
+             uint32_t serial,
+             ProfileMap* profiles);
+
   // Abstract base class for reading a stream of characters.
   class CharStream {
    public:
@@ -76,10 +91,19 @@ class ConfigParser {
     // At most one character can be buffered.
     void UngetChar(int ch);
 
+    // If the stream reads from a shareable in-memory buffer, returns the
+    // buffer and saves the offset of the next character that GetChar()
+    // will return to 'offset_out'.  Returns NULL otherwise.
+    const std::shared_ptr<const std::string>* GetBuffer(size_t* offset_out);
+
    private:
     virtual bool InitImpl(std::string* error_out) { return true; }
     virtual bool AtEOFImpl() = 0;
     virtual int GetCharImpl() = 0;
+    virtual const std::shared_ptr<const std::string>* GetBufferImpl(
+        size_t* /* offset_out */) {
+      return NULL;
+    }
 
     // Has Init() been called?
     bool initialized_;
@@ -119,15 +143,20 @@ class ConfigParser {
   };
 
   // An implementation of CharStream that reads from an in-memory string.
+  // String settings parsed from it may refer directly to the string.
   class StringCharStream : public CharStream {
    public:
     StringCharStream(const std::string& data);
+    explicit StringCharStream(
+        const std::shared_ptr<const std::string>& data);
 
    private:
     bool AtEOFImpl();
     int GetCharImpl();
+    const std::shared_ptr<const std::string>* GetBufferImpl(
+        size_t* offset_out);
 
-    std::string data_;
+    std::shared_ptr<const std::string> data_;
     size_t pos_;
 
     DISALLOW_COPY_AND_ASSIGN(StringCharStream);
@@ -143,6 +172,10 @@ class ConfigParser {
   // Returns false if the setting name is invalid.
   bool ReadSettingName(std::string* name_out);
 
+  // Read a profile section header of the form "[name]" starting at the
+  // current position in the stream.  Returns false if the name is invalid.
+  bool ReadProfileName(std::string* name_out);
+
   // Read the value starting at the current position in the stream.
   // Its type is inferred from the first character.  'setting_ptr' is
   // updated to point at a newly-allocated Setting object (which the caller
@@ -174,6 +207,9 @@ class ConfigParser {
   int error_line_num_;
   std::string error_str_;
 
+  // Scratch space for string values, reused across settings.
+  std::string string_buffer_;
+
   DISALLOW_COPY_AND_ASSIGN(ConfigParser);
 };
 
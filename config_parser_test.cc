@@ -9,6 +9,7 @@
 
 #include <gtest/gtest.h>
 
+#include "allocation_counter.h"
 #include "config_parser.h"
 #include "setting.h"
 
@@ -439,6 +440,172 @@ TEST_F(ConfigParserTest, Parse) {
   const char* duplicate_name = "SettingName 4\nSettingName 3";
   parser.Reset(new ConfigParser::StringCharStream(duplicate_name));
   EXPECT_FALSE(parser.Parse(&settings, NULL, 0));
+
+  // Well-known settings need to have the types that clients expect.
+  const char* wrong_type = "Xft/Antialias 1\nXft/DPI \"96\"\n";
+  parser.Reset(new ConfigParser::StringCharStream(wrong_type));
+  EXPECT_FALSE(parser.Parse(&settings, NULL, 0));
+  EXPECT_EQ("2: Setting \"Xft/DPI\" should be an integer",
+            parser.FormatError());
+}
+
+TEST_F(ConfigParserTest, ParseSharedStrings) {
+  std::shared_ptr<const string> config = std::make_shared<const string>(
+      "Plain \"no escapes\"\n"
+      "Escaped \"two\\nlines\"\n"
+      "Empty \"\"\n");
+  ConfigParser parser(new ConfigParser::StringCharStream(config));
+  SettingsMap settings;
+  ASSERT_TRUE(parser.Parse(&settings, NULL, 1));
+
+  // Values without escape sequences should point into the config.
+  const StringSetting* plain =
+      dynamic_cast<const StringSetting*>(settings.GetSetting("Plain"));
+  ASSERT_TRUE(plain != NULL);
+  EXPECT_EQ("no escapes", plain->value());
+  EXPECT_EQ(config->data() + config->find("no escapes"),
+            plain->value().data());
+
+  const StringSetting* escaped =
+      dynamic_cast<const StringSetting*>(settings.GetSetting("Escaped"));
+  ASSERT_TRUE(escaped != NULL);
+  EXPECT_EQ("two\nlines", escaped->value());
+  EXPECT_TRUE(escaped->value().data() < config->data() ||
+              escaped->value().data() >= config->data() + config->size());
+
+  EXPECT_PRED_FORMAT2(StringSettingEquals, "", settings.GetSetting("Empty"));
+
+  // The settings keep the config alive, as do their clones.
+  Setting* clone = plain->Clone();
+  const char* data = config->data();
+  config.reset();
+  SettingsMap().swap(&settings);
+  EXPECT_EQ("no escapes", dynamic_cast<StringSetting*>(clone)->value());
+  EXPECT_EQ(data + 7, dynamic_cast<StringSetting*>(clone)->value().data());
+  delete clone;
+}
+
+TEST_F(ConfigParserTest, ParseProfiles) {
+  const char* good_input =
+      "Setting1 5\n"
+      "Setting2 \"default\"\n"
+      "[night]  # comment\n"
+      "Setting2 \"night\"\n"
+      "Setting3 (1, 2, 3)\n"
+      "[presentation-2]\n"
+      "Setting1 6\n"
+      "[empty]\n";
+  ConfigParser parser(new ConfigParser::StringCharStream(good_input));
+  SettingsMap settings;
+  ProfileMap profiles;
+  ASSERT_TRUE(parser.Parse(&settings, NULL, 3, &profiles));
+  ASSERT_EQ(2, settings.map().size());
+  EXPECT_PRED_FORMAT2(IntegerSettingEquals, 5, settings.GetSetting("Setting1"));
+  EXPECT_PRED_FORMAT2(StringSettingEquals,
+                      "default",
+                      settings.GetSetting("Setting2"));
+  ASSERT_EQ(3, profiles.map().size());
+
+  const SettingsMap* night = profiles.GetProfile("night");
+  ASSERT_TRUE(night != NULL);
+  ASSERT_EQ(2, night->map().size());
+  EXPECT_PRED_FORMAT2(StringSettingEquals,
+                      "night",
+                      night->GetSetting("Setting2"));
+  EXPECT_PRED_FORMAT2(ColorSettingEquals,
+                      "(1,2,3,65535)",
+                      night->GetSetting("Setting3"));
+  EXPECT_EQ(3, night->GetSetting("Setting2")->serial());
+
+  const SettingsMap* presentation = profiles.GetProfile("presentation-2");
+  ASSERT_TRUE(presentation != NULL);
+  ASSERT_EQ(1, presentation->map().size());
+  EXPECT_PRED_FORMAT2(IntegerSettingEquals,
+                      6,
+                      presentation->GetSetting("Setting1"));
+
+  ASSERT_TRUE(profiles.GetProfile("empty") != NULL);
+  EXPECT_TRUE(profiles.GetProfile("empty")->map().empty());
+
+  // Sections aren't allowed when the caller doesn't ask for profiles.
+  // Parse() doesn't delete settings that are already in the map that it's
+  // passed, so each call gets a fresh one.
+  {
+    SettingsMap new_settings;
+    parser.Reset(new ConfigParser::StringCharStream(good_input));
+    EXPECT_FALSE(parser.Parse(&new_settings, NULL, 0));
+  }
+
+  const char* bad_inputs[] = {
+    "[night]\n[night]\n",
+    "[default]\n",
+    "[]\n",
+    "[night\nSetting 3\n",
+    "[bad/name]\n",
+    "[night] Setting 3\n",
+    "[night]\nSetting 3\nSetting 4\n",
+  };
+  for (size_t i = 0; i < sizeof(bad_inputs) / sizeof(bad_inputs[0]); ++i) {
+    SettingsMap new_settings;
+    parser.Reset(new ConfigParser::StringCharStream(bad_inputs[i]));
+    EXPECT_FALSE(parser.Parse(&new_settings, NULL, 0, &profiles))
+        << bad_inputs[i];
+  }
+
+  // Settings can repeat across sections.
+  const char* repeated = "Setting 1\n[a]\nSetting 2\n[b]\nSetting 3\n";
+  SettingsMap repeated_settings;
+  parser.Reset(new ConfigParser::StringCharStream(repeated));
+  EXPECT_TRUE(parser.Parse(&repeated_settings, NULL, 0, &profiles));
+}
+
+// Builds a config with 'num_settings' settings of each type, with names and
+// string values that are too long for std::string's small-string buffer.
+static string MakeLargeConfig(int num_settings) {
+  string config;
+  for (int i = 0; i < num_settings; ++i) {
+    config += StringPrintf("Net/SomewhatLongIntegerName%d %d\n", i, i);
+    config += StringPrintf("Net/SomewhatLongStringName%d "
+                           "\"a string that is long enough to allocate\"\n",
+                           i);
+    config += StringPrintf("Net/SomewhatLongColorName%d (1, 2, 3, 4)\n", i);
+  }
+  return config;
+}
+
+// Parsing shouldn't need more than a few allocations per setting: the
+// setting itself, its map node, and a copy of its name.  String values
+// without escape sequences refer to the config's text instead of being
+// copied.
+TEST_F(ConfigParserTest, ParseAllocations) {
+  static const int kNumSettings = 100;
+  const string config = MakeLargeConfig(kNumSettings);
+
+  SettingsMap settings;
+  size_t num_allocations = 0;
+  {
+    ConfigParser parser(new ConfigParser::StringCharStream(config));
+    ScopedAllocationCounter counter;
+    ASSERT_TRUE(parser.Parse(&settings, NULL, 1));
+    num_allocations = counter.count();
+  }
+  ASSERT_EQ(3 * kNumSettings, settings.map().size());
+  EXPECT_LE(num_allocations, 3 * settings.map().size() + 10);
+
+  // Reparsing the same config and assigning serials against the previous
+  // settings shouldn't need any extra allocations.
+  SettingsMap new_settings;
+  {
+    ConfigParser parser(new ConfigParser::StringCharStream(config));
+    ScopedAllocationCounter counter;
+    ASSERT_TRUE(parser.Parse(&new_settings, &settings, 2));
+    num_allocations = counter.count();
+  }
+  EXPECT_LE(num_allocations, 3 * settings.map().size() + 10);
+  for (SettingsMap::Map::const_iterator it = new_settings.map().begin();
+       it != new_settings.map().end(); ++it) {
+    EXPECT_EQ(1, it->second->serial()) << it->first;
+  }
 }
 
 }  // namespace xsettingsd
@@ -0,0 +1,482 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include "control_server.h"
+
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "config_parser.h"
+#include "logging.h"
+#include "setting.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace xsettingsd {
+
+// Maximum length of a command line.  Clients sending longer lines are
+// disconnected.
+static const size_t kMaxLineLength = 64 * 1024;
+
+// Number of bytes to read from a client at a time.
+static const size_t kReadSize = 4096;
+
+// Maximum number of distinct settings with pending notifications per
+// client.  Beyond this, the client is just told that it missed updates.
+static const size_t kMaxPendingNotifications = 1024;
+
+// Pending notifications are only moved into a client's output buffer while
+// it's smaller than this, so that the rest can still be coalesced.  Clients
+// also aren't read from while their buffers are this large, so that ones
+// that send commands without reading the replies can't make us buffer
+// unbounded amounts of data.
+static const size_t kMaxBufferedOutput = 16 * 1024;
+
+// Set O_NONBLOCK on 'fd'.
+static bool SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+// Remove a socket at 'addr' left behind by an instance that's no longer
+// running.  Returns false (after logging an error) if something else is
+// at the path or another instance is still listening on it.
+static bool RemoveStaleSocket(const struct sockaddr_un& addr) {
+  struct stat st;
+  if (lstat(addr.sun_path, &st) != 0) {
+    if (errno == ENOENT)
+      return true;
+    LOG(ERROR, "Unable to stat %s: %s", addr.sun_path, strerror(errno));
+    return false;
+  }
+  if (!S_ISSOCK(st.st_mode)) {
+    LOG(ERROR, "%s exists and isn't a socket", addr.sun_path);
+    return false;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOG(ERROR, "Unable to create socket: %s", strerror(errno));
+    return false;
+  }
+  const bool live = connect(fd, reinterpret_cast<const struct sockaddr*>(
+                                    &addr), sizeof(addr)) == 0;
+  const int connect_errno = errno;
+  close(fd);
+  if (live) {
+    LOG(ERROR, "Another instance is listening on %s", addr.sun_path);
+    return false;
+  }
+  if (connect_errno != ECONNREFUSED) {
+    LOG(ERROR, "Unable to check %s: %s", addr.sun_path,
+        strerror(connect_errno));
+    return false;
+  }
+  if (unlink(addr.sun_path) != 0) {
+    LOG(ERROR, "Unable to remove stale socket %s: %s", addr.sun_path,
+        strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+ControlServer::Client::Client(int fd)
+    : fd(fd),
+      in_transaction(false),
+      subscribed(false),
+      overflowed(false) {
+}
+
+ControlServer::ControlServer(const string& socket_path, Delegate* delegate)
+    : socket_path_(socket_path),
+      delegate_(delegate),
+      listen_fd_(-1) {
+  assert(delegate_);
+}
+
+ControlServer::~ControlServer() {
+  while (!clients_.empty())
+    CloseClient(clients_.begin()->first);
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+    unlink(socket_path_.c_str());
+  }
+}
+
+bool ControlServer::Init() {
+  assert(listen_fd_ < 0);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path_.empty() || socket_path_.size() >= sizeof(addr.sun_path)) {
+    LOG(ERROR, "Invalid control socket path \"%s\"", socket_path_.c_str());
+    return false;
+  }
+  strncpy(addr.sun_path, socket_path_.c_str(), sizeof(addr.sun_path) - 1);
+
+  if (!RemoveStaleSocket(addr))
+    return false;
+
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    LOG(ERROR, "Unable to create control socket: %s", strerror(errno));
+    return false;
+  }
+
+  // Anyone who can connect can change settings, so only let our own user
+  // in.  The socket's permissions come from the umask when it's bound.
+  const mode_t old_umask = umask(0177);
+  const int bind_result =
+      bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr),
+           sizeof(addr));
+  const int bind_errno = errno;
+  umask(old_umask);
+  errno = bind_errno;
+  if (bind_result != 0 ||
+      listen(listen_fd_, 16) != 0 ||
+      !SetNonBlocking(listen_fd_)) {
+    LOG(ERROR, "Unable to listen on %s: %s", socket_path_.c_str(),
+        strerror(errno));
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+
+  LOG(INFO, "Listening for control connections on %s", socket_path_.c_str());
+  return true;
+}
+
+void ControlServer::AddFds(fd_set* read_fds, fd_set* write_fds, int* max_fd) {
+  assert(read_fds);
+  assert(write_fds);
+  assert(max_fd);
+
+  if (listen_fd_ < 0)
+    return;
+
+  FD_SET(listen_fd_, read_fds);
+  if (listen_fd_ > *max_fd)
+    *max_fd = listen_fd_;
+
+  for (ClientMap::const_iterator it = clients_.begin();
+       it != clients_.end(); ++it) {
+    const Client* client = it->second;
+    if (client->output.size() < kMaxBufferedOutput)
+      FD_SET(it->first, read_fds);
+    if (!client->output.empty() || !client->pending.empty() ||
+        client->overflowed)
+      FD_SET(it->first, write_fds);
+    if (it->first > *max_fd)
+      *max_fd = it->first;
+  }
+}
+
+void ControlServer::HandleFds(const fd_set& read_fds,
+                              const fd_set& write_fds) {
+  if (listen_fd_ < 0)
+    return;
+
+  // Handle the existing clients before accepting new ones, since
+  // 'read_fds' doesn't describe the new descriptors.
+  ClientMap::iterator it = clients_.begin();
+  while (it != clients_.end()) {
+    Client* client = it->second;
+    ++it;
+
+    bool keep = true;
+    if (FD_ISSET(client->fd, &write_fds) && !client->output.empty())
+      keep = WriteToClient(client);
+    if (keep && FD_ISSET(client->fd, &read_fds))
+      keep = ReadFromClient(client);
+    // Commands that were held back while the output buffer was full can
+    // run now that it's been drained.
+    if (keep)
+      keep = HandleInput(client);
+    FillOutput(client);
+    if (!keep)
+      CloseClient(client->fd);
+  }
+
+  if (FD_ISSET(listen_fd_, &read_fds))
+    AcceptClient();
+}
+
+void ControlServer::NotifySubscribers(const ChangeMap& changes) {
+  for (ClientMap::iterator client_it = clients_.begin();
+       client_it != clients_.end(); ++client_it) {
+    Client* client = client_it->second;
+    if (!client->subscribed || client->overflowed)
+      continue;
+
+    for (ChangeMap::const_iterator it = changes.begin();
+         it != changes.end(); ++it) {
+      if (!IsSubscribedTo(*client, it->first))
+        continue;
+      // Replace any older notification about the same setting.
+      client->pending[it->first] = it->second ?
+          "changed " + it->first + " " + it->second->FormatValue() :
+          "removed " + it->first;
+    }
+
+    if (client->pending.size() > kMaxPendingNotifications) {
+      client->pending.clear();
+      client->overflowed = true;
+    }
+    FillOutput(client);
+  }
+}
+
+void ControlServer::AcceptClient() {
+  while (true) {
+    int fd = accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        LOG_RATE_LIMITED(WARNING, "Unable to accept control connection: %s",
+                         strerror(errno));
+      return;
+    }
+    clients_[fd] = new Client(fd);
+  }
+}
+
+bool ControlServer::ReadFromClient(Client* client) {
+  assert(client);
+
+  char buffer[kReadSize];
+  ssize_t bytes_read = read(client->fd, buffer, sizeof(buffer));
+  if (bytes_read == 0)
+    return false;
+  if (bytes_read < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+  client->input.append(buffer, bytes_read);
+  return true;
+}
+
+bool ControlServer::HandleInput(Client* client) {
+  assert(client);
+
+  size_t start = 0;
+  size_t end = string::npos;
+  while (client->output.size() < kMaxBufferedOutput &&
+         (end = client->input.find('\n', start)) != string::npos) {
+    string line = client->input.substr(start, end - start);
+    if (!line.empty() && line[line.size() - 1] == '\r')
+      line.resize(line.size() - 1);
+    client->output += HandleCommand(client, line);
+    client->output.push_back('\n');
+    start = end + 1;
+  }
+  client->input.erase(0, start);
+
+  if (client->input.size() > kMaxLineLength &&
+      client->input.find('\n') == string::npos) {
+    LOG_RATE_LIMITED(WARNING,
+                     "Dropping control client that sent a %zu-byte line",
+                     client->input.size());
+    return false;
+  }
+  return true;
+}
+
+bool ControlServer::WriteToClient(Client* client) {
+  assert(client);
+
+  ssize_t bytes_written = send(client->fd,
+                               client->output.data(),
+                               client->output.size(),
+                               MSG_NOSIGNAL);
+  if (bytes_written < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  client->output.erase(0, bytes_written);
+  return true;
+}
+
+void ControlServer::FillOutput(Client* client) {
+  assert(client);
+
+  if (client->overflowed && client->output.size() < kMaxBufferedOutput) {
+    client->output += "overflow\n";
+    client->overflowed = false;
+  }
+  while (!client->pending.empty() &&
+         client->output.size() < kMaxBufferedOutput) {
+    std::map<string, string>::iterator it = client->pending.begin();
+    client->output += it->second;
+    client->output.push_back('\n');
+    client->pending.erase(it);
+  }
+}
+
+bool ControlServer::IsSubscribedTo(const Client& client,
+                                   const string& name) const {
+  if (client.prefixes.empty())
+    return true;
+  for (size_t i = 0; i < client.prefixes.size(); ++i) {
+    if (name.compare(0, client.prefixes[i].size(), client.prefixes[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+string ControlServer::HandleCommand(Client* client, const string& line) {
+  assert(client);
+
+  size_t command_end = line.find(' ');
+  string command = line.substr(0, command_end);
+  string args;
+  if (command_end != string::npos)
+    args = line.substr(command_end + 1);
+
+  if (command == "get") {
+    const Setting* setting = delegate_->GetCurrentSetting(args);
+    if (!setting)
+      return StringPrintf("error %s isn't set", args.c_str());
+    return "ok " + args + " " + setting->FormatValue();
+
+  } else if (command == "set" || command == "unset") {
+    string name, error;
+    Setting* setting = NULL;
+    if (command == "set") {
+      setting = ParseSetting(args, &name, &error);
+      if (!setting)
+        return "error " + error;
+    } else {
+      name = args;
+      if (name.empty())
+        return "error Missing setting name";
+    }
+
+    SettingsMap::Map* changes = client->changes.mutable_map();
+    SettingsMap::Map::iterator it = changes->find(name);
+    if (it != changes->end()) {
+      delete it->second;
+      it->second = setting;
+    } else {
+      changes->insert(make_pair(name, setting));
+    }
+
+    if (client->in_transaction)
+      return "ok";
+    if (!delegate_->ApplyChanges(&client->changes, &error)) {
+      SettingsMap().swap(&client->changes);
+      return "error " + error;
+    }
+    return "ok";
+
+  } else if (command == "begin") {
+    if (client->in_transaction)
+      return "error Already in a transaction";
+    client->in_transaction = true;
+    return "ok";
+
+  } else if (command == "commit" || command == "abort") {
+    if (!client->in_transaction)
+      return "error Not in a transaction";
+    client->in_transaction = false;
+
+    string error;
+    bool success = true;
+    if (command == "commit")
+      success = delegate_->ApplyChanges(&client->changes, &error);
+
+    // Discard whatever the delegate didn't take.
+    SettingsMap discarded;
+    discarded.swap(&client->changes);
+    return success ? "ok" : "error " + error;
+
+  } else if (command == "stats") {
+    return "ok " + delegate_->FormatStats();
+
+  } else if (command == "profile") {
+    if (args.empty())
+      return "error Missing profile name";
+    string error;
+    if (!delegate_->SwitchProfile(args, &error))
+      return "error " + error;
+    return "ok";
+
+  } else if (command == "rollback") {
+    int generations = 1;
+    if (!args.empty()) {
+      char* endptr = NULL;
+      errno = 0;
+      const long value = strtol(args.c_str(), &endptr, 10);
+      if (endptr[0] != '\0' || errno == ERANGE || value <= 0 ||
+          value > INT_MAX) {
+        return StringPrintf("error Invalid generation count \"%s\"",
+                            args.c_str());
+      }
+      generations = static_cast<int>(value);
+    }
+    string error;
+    if (!delegate_->RollBack(generations, &error))
+      return "error " + error;
+    return "ok";
+
+  } else if (command == "subscribe") {
+    vector<string> prefixes = SplitString(args, " ");
+    client->prefixes.clear();
+    for (size_t i = 0; i < prefixes.size(); ++i) {
+      if (!prefixes[i].empty())
+        client->prefixes.push_back(prefixes[i]);
+    }
+    client->subscribed = true;
+    return "ok";
+
+  } else if (command.empty()) {
+    return "error Empty command";
+  }
+
+  return StringPrintf("error Unknown command \"%s\"", command.c_str());
+}
+
+Setting* ControlServer::ParseSetting(const string& text,
+                                     string* name_out,
+                                     string* error_out) {
+  assert(name_out);
+  assert(error_out);
+
+  // Reuse the config parser so that values are written exactly as they
+  // would be in the config file.
+  ConfigParser parser(new ConfigParser::StringCharStream(text));
+  SettingsMap parsed;
+  if (!parser.Parse(&parsed, NULL, 0)) {
+    *error_out = parser.FormatError();
+    return NULL;
+  }
+  if (parsed.map().size() != 1) {
+    *error_out = "Expected a single setting";
+    return NULL;
+  }
+
+  SettingsMap::Map::iterator it = parsed.mutable_map()->begin();
+  *name_out = it->first;
+  Setting* setting = it->second;
+  parsed.mutable_map()->clear();
+  return setting;
+}
+
+void ControlServer::CloseClient(int fd) {
+  ClientMap::iterator it = clients_.find(fd);
+  assert(it != clients_.end());
+  close(fd);
+  delete it->second;
+  clients_.erase(it);
+}
+
+}  // namespace xsettingsd
@@ -0,0 +1,211 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_CONTROL_SERVER_H__
+#define __XSETTINGSD_CONTROL_SERVER_H__
+
+#include <map>
+#include <string>
+#include <sys/select.h>
+#include <vector>
+
+#ifdef __TESTING
+#include <gtest/gtest_prod.h>
+#endif
+
+#include "common.h"
+#include "setting.h"
+
+namespace xsettingsd {
+
+// ControlServer listens on a Unix domain socket and lets local clients
+// inspect and modify settings at runtime without rewriting the config file.
+// It's driven by the owner's select() loop and never blocks.
+//
+// The protocol is line-based.  Each command produces a single reply line
+// that starts with either "ok" or "error":
+//
+//   get NAME          Reply with "ok NAME VALUE" in the config file syntax.
+//   set NAME VALUE    Set a setting, using the config file syntax.
+//   unset NAME        Remove a setting.
+//   begin             Start a transaction.
+//   commit            Apply all changes made since "begin" at once.
+//   abort             Discard all changes made since "begin".
+//   stats             Reply with "ok" followed by the daemon's counters and
+//                     timings as space-separated NAME=VALUE pairs.
+//   profile NAME      Switch to the config file's profile named NAME.
+//   rollback [N]      Republish the settings that were published N
+//                     publishes ago (default 1).  Rolling back again goes
+//                     further back rather than undoing the rollback.  The
+//                     restored settings are applied as runtime changes:
+//                     until the next reload discards them, they take
+//                     precedence over the config file and over settings
+//                     derived from the screen's size.
+//   subscribe [PREFIX]...
+//                     Receive notifications about settings whose names
+//                     start with any of the prefixes (or about all
+//                     settings, if no prefixes are given).  Replaces any
+//                     earlier subscription.
+//
+// "set" and "unset" commands issued outside of a transaction are applied
+// immediately, as if they were wrapped in their own transaction.
+//
+// Subscribed clients are sent "changed NAME VALUE" and "removed NAME" lines
+// (interleaved with any replies) once the property containing the changes
+// has been published, so a client that reads the property after getting a
+// notification sees the new value.  Pending
+// notifications are coalesced per setting so that only the latest state of
+// each one is sent to clients that fall behind; if too many distinct
+// settings pile up, they're dropped in favor of a single "overflow" line,
+// after which the client should re-fetch whatever it's interested in.
+class ControlServer {
+ public:
+  // Changed settings, keyed by name.  NULL values represent removed
+  // settings.  The settings are not owned.
+  typedef std::map<std::string, const Setting*> ChangeMap;
+
+  class Delegate {
+   public:
+    virtual ~Delegate() {}
+
+    // Atomically apply 'changes', in which a NULL setting means that the
+    // setting should be removed.  The delegate takes ownership of the
+    // Setting objects and leaves 'changes' empty.  Returns false and
+    // updates 'error_out' on failure.
+    virtual bool ApplyChanges(SettingsMap* changes, std::string* error_out) = 0;
+
+    // Get the current value of a setting, or NULL if it isn't set.
+    virtual const Setting* GetCurrentSetting(const std::string& name) = 0;
+
+    // Get a single line describing the daemon's stats.
+    virtual std::string FormatStats() = 0;
+
+    // Publish the settings from the profile named 'name'.  Returns false
+    // and updates 'error_out' on failure.
+    virtual bool SwitchProfile(const std::string& name,
+                               std::string* error_out) = 0;
+
+    // Republish the settings that were published 'generations' publishes
+    // ago, discarding the later ones from the history (along with any
+    // unpublished changes).  Returns false and updates 'error_out' on
+    // failure.
+    virtual bool RollBack(int generations, std::string* error_out) = 0;
+  };
+
+  // 'delegate' is not owned.
+  ControlServer(const std::string& socket_path, Delegate* delegate);
+  ~ControlServer();
+
+  const std::string& socket_path() const { return socket_path_; }
+
+  // Create the socket and start listening on it.  Returns false and prints
+  // an error to stderr on failure.
+  bool Init();
+
+  // Add the descriptors that we're interested in to the passed-in sets,
+  // updating 'max_fd' if needed.
+  void AddFds(fd_set* read_fds, fd_set* write_fds, int* max_fd);
+
+  // Service any of our descriptors that select() reported as ready.
+  void HandleFds(const fd_set& read_fds, const fd_set& write_fds);
+
+  // Queue notifications about 'changes' for subscribed clients.  They're
+  // written as the clients' sockets become writable.
+  void NotifySubscribers(const ChangeMap& changes);
+
+ private:
+#ifdef __TESTING
+  friend class ControlServerTest;
+  FRIEND_TEST(ControlServerTest, Subscriptions);
+  FRIEND_TEST(ControlServerTest, PipelinedCommands);
+#endif
+
+  struct Client {
+    explicit Client(int fd);
+
+    int fd;
+
+    // Data read from the client that doesn't form a complete line yet.
+    std::string input;
+
+    // Replies that haven't been written to the client yet.
+    std::string output;
+
+    // Are we between "begin" and "commit" or "abort"?
+    bool in_transaction;
+
+    // Changes made in the current transaction.  NULL settings represent
+    // removals.
+    SettingsMap changes;
+
+    // Has the client sent "subscribe"?
+    bool subscribed;
+
+    // Name prefixes that the client is interested in.  Empty if it wants
+    // to hear about everything.
+    std::vector<std::string> prefixes;
+
+    // Notification lines that haven't been moved to 'output' yet, keyed by
+    // setting name.
+    std::map<std::string, std::string> pending;
+
+    // Were notifications dropped since the last ones were sent?
+    bool overflowed;
+
+    DISALLOW_COPY_AND_ASSIGN(Client);
+  };
+
+  // Accept a new connection on 'listen_fd_'.
+  void AcceptClient();
+
+  // Read from a client's socket into its input buffer.  Returns false if
+  // the client should be disconnected.
+  bool ReadFromClient(Client* client);
+
+  // Handle complete commands in a client's input buffer until its output
+  // buffer fills up.  Returns false if the client should be disconnected.
+  bool HandleInput(Client* client);
+
+  // Write as much buffered output as possible to a client's socket.
+  // Returns false if the client should be disconnected.
+  bool WriteToClient(Client* client);
+
+  // Move pending notifications into the client's output buffer until it's
+  // full.
+  void FillOutput(Client* client);
+
+  // Does 'name' match any of the client's subscription prefixes?
+  bool IsSubscribedTo(const Client& client, const std::string& name) const;
+
+  // Handle a single command, returning the reply (without a trailing
+  // newline).
+  std::string HandleCommand(Client* client, const std::string& line);
+
+  // Parse "NAME VALUE" in the config file syntax, returning a
+  // newly-allocated setting or NULL (after updating 'error_out').
+  Setting* ParseSetting(const std::string& text,
+                        std::string* name_out,
+                        std::string* error_out);
+
+  // Close a client's socket and delete it.
+  void CloseClient(int fd);
+
+  // Path of the socket.
+  std::string socket_path_;
+
+  // Not owned.
+  Delegate* delegate_;
+
+  // Listening socket, or -1 if uninitialized.
+  int listen_fd_;
+
+  // Connected clients, keyed by file descriptor.
+  typedef std::map<int, Client*> ClientMap;
+  ClientMap clients_;
+
+  DISALLOW_COPY_AND_ASSIGN(ControlServer);
+};
+
+}  // namespace xsettingsd
+
+#endif
@@ -0,0 +1,319 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "control_server.h"
+#include "setting.h"
+
+using std::string;
+
+namespace xsettingsd {
+
+// Delegate that applies changes to an in-memory map.
+class TestDelegate : public ControlServer::Delegate {
+ public:
+  TestDelegate() : num_applies_(0), fail_applies_(false), last_rollback_(0) {}
+
+  const SettingsMap& settings() const { return settings_; }
+  int num_applies() const { return num_applies_; }
+  void set_fail_applies(bool fail) { fail_applies_ = fail; }
+
+  virtual bool ApplyChanges(SettingsMap* changes, string* error_out) {
+    SettingsMap new_settings;
+    new_settings.swap(changes);
+    if (fail_applies_) {
+      *error_out = "failed";
+      return false;
+    }
+
+    num_applies_++;
+    SettingsMap::Map* map = new_settings.mutable_map();
+    for (SettingsMap::Map::iterator it = map->begin(); it != map->end(); ++it) {
+      SettingsMap::Map::iterator existing =
+          settings_.mutable_map()->find(it->first);
+      if (existing != settings_.mutable_map()->end()) {
+        delete existing->second;
+        settings_.mutable_map()->erase(existing);
+      }
+      if (it->second)
+        settings_.mutable_map()->insert(make_pair(it->first, it->second));
+      it->second = NULL;
+    }
+    return true;
+  }
+
+  virtual const Setting* GetCurrentSetting(const string& name) {
+    return settings_.GetSetting(name);
+  }
+
+  virtual string FormatStats() {
+    return "applies=" + StringPrintf("%d", num_applies_);
+  }
+
+  virtual bool SwitchProfile(const string& name, string* error_out) {
+    if (name != "night") {
+      *error_out = "No profile named \"" + name + "\"";
+      return false;
+    }
+    profile_ = name;
+    return true;
+  }
+
+  virtual bool RollBack(int generations, string* error_out) {
+    if (generations > 2) {
+      *error_out = "Only 2 earlier generations are available";
+      return false;
+    }
+    last_rollback_ = generations;
+    return true;
+  }
+
+  const string& profile() const { return profile_; }
+  int last_rollback() const { return last_rollback_; }
+
+ private:
+  SettingsMap settings_;
+  int num_applies_;
+  bool fail_applies_;
+  string profile_;
+  int last_rollback_;
+};
+
+class ControlServerTest : public testing::Test {
+ protected:
+  ControlServerTest()
+      : server_("unused", &delegate_),
+        client_(new ControlServer::Client(-1)) {
+  }
+  ~ControlServerTest() {
+    delete client_;
+  }
+
+  string Run(const string& line) {
+    return server_.HandleCommand(client_, line);
+  }
+
+  TestDelegate delegate_;
+  ControlServer server_;
+  ControlServer::Client* client_;
+};
+
+TEST_F(ControlServerTest, SetAndGet) {
+  EXPECT_EQ("ok", Run("set Net/ThemeName \"Adwaita\""));
+  EXPECT_EQ("ok", Run("set Xft/DPI 98304"));
+  EXPECT_EQ("ok", Run("set Gtk/Color (1, 2, 3)"));
+  EXPECT_EQ(3, delegate_.num_applies());
+
+  EXPECT_EQ("ok Net/ThemeName \"Adwaita\"", Run("get Net/ThemeName"));
+  EXPECT_EQ("ok Xft/DPI 98304", Run("get Xft/DPI"));
+  EXPECT_EQ("ok Gtk/Color (1, 2, 3, 65535)", Run("get Gtk/Color"));
+  EXPECT_EQ("error Missing isn't set", Run("get Missing"));
+
+  EXPECT_EQ("ok", Run("unset Xft/DPI"));
+  EXPECT_EQ("error Xft/DPI isn't set", Run("get Xft/DPI"));
+  EXPECT_EQ("ok applies=4", Run("stats"));
+}
+
+TEST_F(ControlServerTest, Profile) {
+  EXPECT_EQ("ok", Run("profile night"));
+  EXPECT_EQ("night", delegate_.profile());
+  EXPECT_EQ("error No profile named \"day\"", Run("profile day"));
+  EXPECT_EQ("error Missing profile name", Run("profile"));
+  EXPECT_EQ("night", delegate_.profile());
+}
+
+TEST_F(ControlServerTest, Rollback) {
+  EXPECT_EQ("ok", Run("rollback"));
+  EXPECT_EQ(1, delegate_.last_rollback());
+  EXPECT_EQ("ok", Run("rollback 2"));
+  EXPECT_EQ(2, delegate_.last_rollback());
+  EXPECT_EQ("error Only 2 earlier generations are available",
+            Run("rollback 3"));
+  EXPECT_EQ("error Invalid generation count \"0\"", Run("rollback 0"));
+  EXPECT_EQ("error Invalid generation count \"x\"", Run("rollback x"));
+  EXPECT_EQ("error Invalid generation count \"4294967297\"",
+            Run("rollback 4294967297"));
+  EXPECT_EQ("error Invalid generation count \"99999999999999999999\"",
+            Run("rollback 99999999999999999999"));
+  EXPECT_EQ(2, delegate_.last_rollback());
+}
+
+TEST_F(ControlServerTest, InvalidCommands) {
+  EXPECT_EQ("error Empty command", Run(""));
+  EXPECT_EQ("error Unknown command \"bogus\"", Run("bogus"));
+  EXPECT_EQ("error 1: Got invalid setting value", Run("set Name bogus"));
+  EXPECT_EQ("error 1: Unexpected end of file", Run("set Name"));
+  EXPECT_EQ("error Expected a single setting", Run("set"));
+  EXPECT_EQ("error Missing setting name", Run("unset"));
+  EXPECT_EQ("error Not in a transaction", Run("commit"));
+  EXPECT_EQ("error Not in a transaction", Run("abort"));
+  EXPECT_EQ(0, delegate_.num_applies());
+}
+
+TEST_F(ControlServerTest, Transactions) {
+  EXPECT_EQ("ok", Run("begin"));
+  EXPECT_EQ("error Already in a transaction", Run("begin"));
+  EXPECT_EQ("ok", Run("set A 1"));
+  EXPECT_EQ("ok", Run("set B 2"));
+  EXPECT_EQ("ok", Run("set A 3"));
+  EXPECT_EQ("error A isn't set", Run("get A"));
+  EXPECT_EQ("ok", Run("commit"));
+  EXPECT_EQ(1, delegate_.num_applies());
+  EXPECT_EQ("ok A 3", Run("get A"));
+  EXPECT_EQ("ok B 2", Run("get B"));
+
+  // Aborted transactions shouldn't be applied.
+  EXPECT_EQ("ok", Run("begin"));
+  EXPECT_EQ("ok", Run("unset A"));
+  EXPECT_EQ("ok", Run("abort"));
+  EXPECT_EQ(1, delegate_.num_applies());
+  EXPECT_EQ("ok A 3", Run("get A"));
+
+  // A failed commit should be reported and leave the client out of the
+  // transaction.
+  delegate_.set_fail_applies(true);
+  EXPECT_EQ("ok", Run("begin"));
+  EXPECT_EQ("ok", Run("set C 4"));
+  EXPECT_EQ("error failed", Run("commit"));
+  EXPECT_EQ("error Not in a transaction", Run("commit"));
+}
+
+TEST_F(ControlServerTest, Subscriptions) {
+  ControlServer::Client* other = new ControlServer::Client(-1);
+  server_.clients_[-1] = client_;
+  server_.clients_[-2] = other;
+
+  IntegerSetting net_setting(1);
+  StringSetting gtk_setting("foo");
+  ControlServer::ChangeMap changes;
+  changes["Net/Foo"] = &net_setting;
+  changes["Gtk/Bar"] = &gtk_setting;
+  changes["Xft/Baz"] = NULL;
+
+  // Clients that haven't subscribed shouldn't hear about anything.
+  server_.NotifySubscribers(changes);
+  EXPECT_EQ("", client_->output);
+
+  EXPECT_EQ("ok", Run("subscribe Net/ Xft/"));
+  EXPECT_EQ("ok", server_.HandleCommand(other, "subscribe"));
+  server_.NotifySubscribers(changes);
+  EXPECT_EQ("changed Net/Foo 1\nremoved Xft/Baz\n", client_->output);
+  EXPECT_EQ("changed Gtk/Bar \"foo\"\n"
+            "changed Net/Foo 1\n"
+            "removed Xft/Baz\n", other->output);
+
+  // Once the output buffer is full, notifications about the same setting
+  // should be coalesced.
+  client_->output.assign(64 * 1024, 'x');
+  IntegerSetting net_setting2(2);
+  changes.clear();
+  changes["Net/Foo"] = &net_setting;
+  server_.NotifySubscribers(changes);
+  changes["Net/Foo"] = &net_setting2;
+  server_.NotifySubscribers(changes);
+  ASSERT_EQ(1, client_->pending.size());
+  client_->output.clear();
+  server_.FillOutput(client_);
+  EXPECT_EQ("changed Net/Foo 2\n", client_->output);
+
+  // Too many pending notifications should result in an overflow.
+  client_->output.assign(64 * 1024, 'x');
+  changes.clear();
+  for (int i = 0; i < 2000; ++i)
+    changes[StringPrintf("Net/Setting%d", i)] = &net_setting;
+  server_.NotifySubscribers(changes);
+  EXPECT_TRUE(client_->pending.empty());
+  client_->output.clear();
+  server_.FillOutput(client_);
+  EXPECT_EQ("overflow\n", client_->output);
+
+  server_.clients_.clear();
+  delete other;
+}
+
+TEST_F(ControlServerTest, PipelinedCommands) {
+  // Commands stop being handled once the replies fill the output buffer,
+  // and resume once it's drained.
+  const int kNumCommands = 10000;
+  for (int i = 0; i < kNumCommands; ++i)
+    client_->input += "stats\n";
+  ASSERT_TRUE(server_.HandleInput(client_));
+  const size_t reply_size = string("ok applies=0\n").size();
+  const size_t num_handled = client_->output.size() / reply_size;
+  EXPECT_LT(num_handled, static_cast<size_t>(kNumCommands));
+  EXPECT_EQ((kNumCommands - num_handled) * string("stats\n").size(),
+            client_->input.size());
+  client_->output.clear();
+  ASSERT_TRUE(server_.HandleInput(client_));
+  EXPECT_EQ(num_handled * reply_size, client_->output.size());
+
+  // Overly-long lines get the client disconnected.
+  client_->output.clear();
+  client_->input.assign(128 * 1024, 'x');
+  EXPECT_FALSE(server_.HandleInput(client_));
+}
+
+TEST(ControlServerInitTest, Socket) {
+  char dir[] = "/tmp/control_server_test.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir) != NULL);
+  const string path = string(dir) + "/socket";
+  TestDelegate delegate;
+
+  // The socket is only accessible by our own user, and a second instance
+  // can't take it over while the first is listening.
+  {
+    ControlServer server(path, &delegate);
+    ASSERT_TRUE(server.Init());
+    struct stat st;
+    ASSERT_EQ(0, lstat(path.c_str(), &st));
+    EXPECT_TRUE(S_ISSOCK(st.st_mode));
+    EXPECT_EQ(0600, st.st_mode & 0777);
+
+    ControlServer other(path, &delegate);
+    EXPECT_FALSE(other.Init());
+    EXPECT_EQ(0, lstat(path.c_str(), &st));
+  }
+
+  // A socket that no one is listening on is replaced.
+  {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_GE(fd, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    ASSERT_EQ(0, bind(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                      sizeof(addr)));
+    close(fd);
+    ControlServer server(path, &delegate);
+    EXPECT_TRUE(server.Init());
+  }
+
+  // Files that aren't sockets are left alone.
+  FILE* file = fopen(path.c_str(), "w");
+  ASSERT_TRUE(file != NULL);
+  ASSERT_EQ(0, fclose(file));
+  {
+    ControlServer server(path, &delegate);
+    EXPECT_FALSE(server.Init());
+  }
+  EXPECT_EQ(0, unlink(path.c_str()));
+  EXPECT_EQ(0, rmdir(dir));
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -5,39 +5,115 @@
 #define __XSETTINGSD_DATA_READER_H__
 
 #include <cstdlib>  // for size_t
+#include <cstring>
 #include <stdint.h>
 #include <string>
+#include <string_view>
 
 #include "common.h"
 
 namespace xsettingsd {
 
-// Like DataWriter, but not.
-class DataReader {
+// Like DataWriter, but not.  'kReverseBytes' is true if the data's byte order
+// differs from the host's; it's fixed at compile time so that reading a
+// field never needs to check it.  Use ReadProperty() to pick the right
+// reader for an XSETTINGS property.
+template <bool kReverseBytes>
+class BasicDataReader {
  public:
-  DataReader(const char* buffer, size_t buf_len);
-
-  void set_reverse_bytes(bool reverse) { reverse_bytes_ = reverse; }
+  BasicDataReader(const char* buffer, size_t buf_len)
+      : buffer_(buffer),
+        buf_len_(buf_len),
+        bytes_read_(0) {
+  }
 
   size_t bytes_read() const { return bytes_read_; }
 
-  bool ReadBytes(std::string* out, size_t size);
-  bool ReadInt8(int8_t* out);
-  bool ReadInt16(int16_t* out);
-  bool ReadInt32(int32_t* out);
+  // Returns true if at least 'size' more bytes can be read.
+  bool HasBytes(size_t size) const {
+    return size <= buf_len_ - bytes_read_;
+  }
+
+  bool ReadBytes(std::string* out, size_t size) {
+    if (!HasBytes(size))
+      return false;
+    if (out)
+      out->assign(buffer_ + bytes_read_, size);
+    bytes_read_ += size;
+    return true;
+  }
+
+  // Like ReadBytes(), but points 'out' at the data within the buffer
+  // instead of copying it.
+  bool ReadView(std::string_view* out, size_t size) {
+    if (!HasBytes(size))
+      return false;
+    if (out)
+      *out = std::string_view(buffer_ + bytes_read_, size);
+    bytes_read_ += size;
+    return true;
+  }
+
+  bool ReadInt8(int8_t* out) { return ReadField(out); }
+  bool ReadInt16(int16_t* out) { return ReadField(out); }
+  bool ReadInt32(int32_t* out) { return ReadField(out); }
 
  private:
+  static int8_t Swap(int8_t num) { return num; }
+  static int16_t Swap(int16_t num) { return __builtin_bswap16(num); }
+  static int32_t Swap(int32_t num) { return __builtin_bswap32(num); }
+
+  template <class T>
+  bool ReadField(T* out) {
+    if (!HasBytes(sizeof(T)))
+      return false;
+    if (out) {
+      // memcpy() (rather than dereferencing a cast pointer) is safe for
+      // unaligned data and compiles to a single load.
+      T num;
+      memcpy(&num, buffer_ + bytes_read_, sizeof(T));
+      *out = kReverseBytes ? Swap(num) : num;
+    }
+    bytes_read_ += sizeof(T);
+    return true;
+  }
+
   const char* buffer_;  // not owned
 
   size_t buf_len_;
 
   size_t bytes_read_;
 
-  bool reverse_bytes_;
-
-  DISALLOW_COPY_AND_ASSIGN(DataReader);
+  DISALLOW_COPY_AND_ASSIGN(BasicDataReader);
 };
 
+// Reads data in the host's byte order.
+typedef BasicDataReader<false> DataReader;
+
+// Reads data in the opposite byte order.
+typedef BasicDataReader<true> ReversedDataReader;
+
+// Examines the byte-order byte at the start of the XSETTINGS property in
+// 'data' and calls 'func' with a pointer to a reader of the appropriate type
+// (positioned at the beginning of the data), returning its result.  Returns
+// false without calling 'func' if the byte is neither LSBFirst nor MSBFirst.
+// This is the only place where the byte order is checked at runtime.
+template <class Func>
+bool ReadProperty(const char* data, size_t size, Func func) {
+  if (size < 1)
+    return false;
+  // LSBFirst and MSBFirst from X.h.
+  const int8_t host_byte_order = IsLittleEndian() ? 0 : 1;
+  if (data[0] == host_byte_order) {
+    DataReader reader(data, size);
+    return func(&reader);
+  }
+  if (data[0] != 1 - host_byte_order)
+    return false;
+  ReversedDataReader reader(data, size);
+  return func(&reader);
+}
+
 }  // namespace xsettingsd
 
 #endif
@@ -0,0 +1,105 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "data_reader.h"
+#include "data_writer.h"
+
+using std::string;
+
+namespace xsettingsd {
+
+TEST(DataReaderTest, ByteOrder) {
+  char buffer[6];
+  DataWriter writer(buffer, sizeof(buffer));
+  ASSERT_TRUE(writer.WriteInt16(0x0102));
+  ASSERT_TRUE(writer.WriteInt32(0x03040506));
+  EXPECT_FALSE(writer.WriteInt8(0));
+
+  int16_t num16 = 0;
+  int32_t num32 = 0;
+  DataReader reader(buffer, sizeof(buffer));
+  EXPECT_TRUE(reader.ReadInt16(&num16));
+  EXPECT_EQ(0x0102, num16);
+  EXPECT_TRUE(reader.ReadInt32(&num32));
+  EXPECT_EQ(0x03040506, num32);
+  EXPECT_FALSE(reader.ReadInt8(NULL));
+
+  ReversedDataReader reversed_reader(buffer, sizeof(buffer));
+  EXPECT_TRUE(reversed_reader.ReadInt16(&num16));
+  EXPECT_EQ(0x0201, num16);
+  EXPECT_TRUE(reversed_reader.ReadInt32(&num32));
+  EXPECT_EQ(0x06050403, num32);
+
+  // Data written in the opposite byte order should round-trip.
+  ReversedDataWriter reversed_writer(buffer, sizeof(buffer));
+  ASSERT_TRUE(reversed_writer.WriteInt16(-2));
+  ASSERT_TRUE(reversed_writer.WriteInt32(-3));
+  ReversedDataReader reversed_reader2(buffer, sizeof(buffer));
+  EXPECT_TRUE(reversed_reader2.ReadInt16(&num16));
+  EXPECT_EQ(-2, num16);
+  EXPECT_TRUE(reversed_reader2.ReadInt32(&num32));
+  EXPECT_EQ(-3, num32);
+}
+
+TEST(DataReaderTest, ReadProperty) {
+  // Returns the first 32-bit field after the byte-order byte and padding.
+  auto read_field = [](const char* data, size_t size, int32_t* out) {
+    return ReadProperty(data, size, [out](auto* reader) {
+      return reader->ReadBytes(NULL, 4) && reader->ReadInt32(out);
+    });
+  };
+
+  char buffer[8];
+  DataWriter writer(buffer, sizeof(buffer));
+  ASSERT_TRUE(writer.WriteInt8(IsLittleEndian() ? 0 : 1));
+  ASSERT_TRUE(writer.WriteZeros(3));
+  ASSERT_TRUE(writer.WriteInt32(1234));
+  int32_t num = 0;
+  EXPECT_TRUE(read_field(buffer, sizeof(buffer), &num));
+  EXPECT_EQ(1234, num);
+
+  ReversedDataWriter reversed_writer(buffer, sizeof(buffer));
+  ASSERT_TRUE(reversed_writer.WriteInt8(IsLittleEndian() ? 1 : 0));
+  ASSERT_TRUE(reversed_writer.WriteZeros(3));
+  ASSERT_TRUE(reversed_writer.WriteInt32(5678));
+  EXPECT_TRUE(read_field(buffer, sizeof(buffer), &num));
+  EXPECT_EQ(5678, num);
+
+  EXPECT_FALSE(read_field(buffer, 0, &num));
+  EXPECT_FALSE(read_field(buffer, 6, &num));
+
+  // Byte-order bytes other than LSBFirst and MSBFirst are malformed.
+  buffer[0] = 2;
+  EXPECT_FALSE(read_field(buffer, sizeof(buffer), &num));
+  buffer[0] = 'l';
+  EXPECT_FALSE(read_field(buffer, sizeof(buffer), &num));
+}
+
+TEST(DataReaderTest, Bounds) {
+  const char buffer[] = "abcdef";
+  DataReader reader(buffer, 6);
+  string str;
+  EXPECT_TRUE(reader.ReadBytes(&str, 2));
+  EXPECT_EQ("ab", str);
+  std::string_view view;
+  EXPECT_TRUE(reader.ReadView(&view, 3));
+  EXPECT_EQ("cde", view);
+  EXPECT_EQ(5, reader.bytes_read());
+  EXPECT_FALSE(reader.ReadBytes(&str, 2));
+  EXPECT_FALSE(reader.ReadView(&view, static_cast<size_t>(-1)));
+  EXPECT_FALSE(reader.ReadInt16(NULL));
+  EXPECT_EQ(5, reader.bytes_read());
+  EXPECT_TRUE(reader.ReadInt8(NULL));
+  EXPECT_EQ(6, reader.bytes_read());
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -5,6 +5,7 @@
 #define __XSETTINGSD_DATA_WRITER_H__
 
 #include <cstdlib>  // for size_t
+#include <cstring>
 #include <stdint.h>
 
 #include "common.h"
@@ -12,28 +13,70 @@
 namespace xsettingsd {
 
 // Provides an interface for writing different types of data to a buffer.
-class DataWriter {
+// 'kReverseBytes' is true if the output should use the opposite of the
+// host's byte order.
+template <bool kReverseBytes>
+class BasicDataWriter {
  public:
-  DataWriter(char* buffer, size_t buf_len);
+  BasicDataWriter(char* buffer, size_t buf_len)
+      : buffer_(buffer),
+        buf_len_(buf_len),
+        bytes_written_(0) {
+  }
 
   size_t bytes_written() const { return bytes_written_; }
 
-  bool WriteBytes(const char* data, size_t bytes_to_write);
-  bool WriteInt8(int8_t num);
-  bool WriteInt16(int16_t num);
-  bool WriteInt32(int32_t num);
-  bool WriteZeros(size_t bytes_to_write);
+  bool WriteBytes(const char* data, size_t bytes_to_write) {
+    if (bytes_to_write > buf_len_ - bytes_written_)
+      return false;
+    memcpy(buffer_ + bytes_written_, data, bytes_to_write);
+    bytes_written_ += bytes_to_write;
+    return true;
+  }
+
+  bool WriteInt8(int8_t num) { return WriteField(num); }
+  bool WriteInt16(int16_t num) { return WriteField(num); }
+  bool WriteInt32(int32_t num) { return WriteField(num); }
+
+  bool WriteZeros(size_t bytes_to_write) {
+    if (bytes_to_write > buf_len_ - bytes_written_)
+      return false;
+    memset(buffer_ + bytes_written_, 0, bytes_to_write);
+    bytes_written_ += bytes_to_write;
+    return true;
+  }
 
  private:
+  static int8_t Swap(int8_t num) { return num; }
+  static int16_t Swap(int16_t num) { return __builtin_bswap16(num); }
+  static int32_t Swap(int32_t num) { return __builtin_bswap32(num); }
+
+  template <class T>
+  bool WriteField(T num) {
+    if (sizeof(T) > buf_len_ - bytes_written_)
+      return false;
+    if (kReverseBytes)
+      num = Swap(num);
+    memcpy(buffer_ + bytes_written_, &num, sizeof(T));
+    bytes_written_ += sizeof(T);
+    return true;
+  }
+
   char* buffer_;  // not owned
 
   size_t buf_len_;
 
   size_t bytes_written_;
 
-  DISALLOW_COPY_AND_ASSIGN(DataWriter);
+  DISALLOW_COPY_AND_ASSIGN(BasicDataWriter);
 };
 
+// Writes data in the host's byte order.
+typedef BasicDataWriter<false> DataWriter;
+
+// Writes data in the opposite byte order.
+typedef BasicDataWriter<true> ReversedDataWriter;
+
 }  // namespace xsettingsd
 
 #endif
@@ -1,225 +1,688 @@
 // Copyright 2009 Daniel Erat <dan@erat.org>
 // All rights reserved.
 
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <getopt.h>
+#include <map>
 #include <stdint.h>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 #include <X11/Xlib.h>
+#ifdef HAVE_XCB
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+#endif
 
 #include "common.h"
 #include "data_reader.h"
 #include "setting.h"
+#include "sha256.h"
 
-using std::min;
 using std::string;
 
 namespace xsettingsd {
 
-bool GetData(int screen, char* buffer, size_t buffer_size, size_t* data_size) {
-  assert(data_size);
-
-  Display* display = XOpenDisplay(NULL);
-  if (!display) {
-    fprintf(stderr, "Couldn't open display\n");
+static const char* kPropName = "_XSETTINGS_SETTINGS";
+
+// Number of 32-bit units to request per XGetWindowProperty() call.
+static const long kChunkLength = (2 << 15) / 4;
+
+// Atoms that we need, interned in a single round trip.
+struct Atoms {
+  Atom prop_atom;
+
+  // Selection atoms, indexed by screen.
+  std::vector<Atom> sel_atoms;
+};
+
+// Intern the atoms needed to read settings from 'num_screens' screens,
+// starting at 'first_screen'.
+bool InternAtoms(Display* display, int first_screen, int num_screens,
+                 Atoms* atoms_out) {
+  assert(atoms_out);
+
+  std::vector<string> names;
+  names.push_back(kPropName);
+  for (int i = 0; i < num_screens; ++i)
+    names.push_back(StringPrintf("_XSETTINGS_S%d", first_screen + i));
+
+  std::vector<char*> name_ptrs;
+  for (size_t i = 0; i < names.size(); ++i)
+    name_ptrs.push_back(const_cast<char*>(names[i].c_str()));
+  std::vector<Atom> atoms(names.size(), None);
+  if (!XInternAtoms(display, &name_ptrs[0], name_ptrs.size(), False,
+                    &atoms[0])) {
+    fprintf(stderr, "Couldn't intern atoms\n");
     return false;
   }
 
-  string sel_name = StringPrintf("_XSETTINGS_S%d", screen);
-  Atom sel_atom = XInternAtom(display, sel_name.c_str(), False);
+  atoms_out->prop_atom = atoms[0];
+  atoms_out->sel_atoms.assign(atoms.begin() + 1, atoms.end());
+  return true;
+}
+
+// Print an error saying that 'sel_atom' has no owner.
+static void ReportNoOwner(Display* display, Atom sel_atom) {
+  char* sel_name = XGetAtomName(display, sel_atom);
+  fprintf(stderr, "No current owner for %s selection\n", sel_name);
+  XFree(sel_name);
+}
+
+// Get the current owner of 'sel_atom', printing an error if there isn't
+// one.
+Window GetOwner(Display* display, Atom sel_atom) {
   Window win = XGetSelectionOwner(display, sel_atom);
-  if (win == None) {
-    fprintf(stderr, "No current owner for %s selection\n", sel_name.c_str());
+  if (win == None)
+    ReportNoOwner(display, sel_atom);
+  return win;
+}
+
+// Property data fetched from the X server.  When the whole property arrives
+// in a single reply, it's decoded in place from Xlib's (or XCB's) buffer;
+// otherwise the chunks are concatenated into a growable buffer.
+class PropertyData {
+ public:
+  PropertyData() : xlib_data_(NULL), xcb_reply_(NULL), data_(NULL), size_(0) {}
+  ~PropertyData() { Reset(); }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  void Reset() {
+    if (xlib_data_)
+      XFree(xlib_data_);
+    xlib_data_ = NULL;
+    free(xcb_reply_);
+    xcb_reply_ = NULL;
+    buffer_.clear();
+    data_ = NULL;
+    size_ = 0;
+  }
+
+  // Take ownership of a chunk of data returned by XGetWindowProperty().
+  void AddChunk(unsigned char* chunk, size_t size, bool last) {
+    if (size_ == 0 && last) {
+      xlib_data_ = chunk;
+      data_ = reinterpret_cast<const char*>(chunk);
+      size_ = size;
+      return;
+    }
+    buffer_.append(reinterpret_cast<const char*>(chunk), size);
+    XFree(chunk);
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+  }
+
+#ifdef HAVE_XCB
+  // Take ownership of a reply to xcb_get_property().
+  void AddReply(xcb_get_property_reply_t* reply, bool last) {
+    const char* value =
+        static_cast<const char*>(xcb_get_property_value(reply));
+    const size_t size = xcb_get_property_value_length(reply);
+    if (size_ == 0 && last) {
+      xcb_reply_ = reply;
+      data_ = value;
+      size_ = size;
+      return;
+    }
+    buffer_.append(value, size);
+    free(reply);
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+  }
+#endif
+
+ private:
+  // Data owned by Xlib, or NULL.
+  unsigned char* xlib_data_;
+
+  // Reply owned by XCB containing the data, or NULL.
+  void* xcb_reply_;
+
+  // Concatenated chunks if the property didn't fit in a single reply.
+  string buffer_;
+
+  const char* data_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(PropertyData);
+};
+
+// Read the settings property from 'win' into 'data_out', fetching it in
+// chunks so that there's no limit on its size.
+bool GetData(Display* display, Window win, Atom prop_atom,
+             PropertyData* data_out) {
+  assert(data_out);
+  data_out->Reset();
+
+  long offset = 0;
+  while (true) {
+    Atom type_ret = None;
+    int format_ret = 0;
+    unsigned long num_items_ret = 0;
+    unsigned long rem_bytes_ret = 0;
+    unsigned char* prop_ret = NULL;
+    int retval = XGetWindowProperty(display,
+                                    win,
+                                    prop_atom,
+                                    offset,           // offset (32-bit units)
+                                    kChunkLength,     // length (32-bit units)
+                                    False,            // delete
+                                    AnyPropertyType,  // type
+                                    &type_ret,        // actual type
+                                    &format_ret,      // actual format
+                                    &num_items_ret,   // actual num items
+                                    &rem_bytes_ret,   // remaining bytes
+                                    &prop_ret);       // property
+    if (retval != Success) {
+      fprintf(stderr, "XGetWindowProperty() returned %d\n", retval);
+      return false;
+    }
+    if (type_ret == None) {
+      fprintf(stderr, "Property %s doesn't exist on 0x%x\n",
+              kPropName, static_cast<unsigned int>(win));
+      return false;
+    }
+    if (format_ret != 8) {
+      fprintf(stderr, "Got unexpected format %d\n", format_ret);
+      XFree(prop_ret);
+      return false;
+    }
+
+    data_out->AddChunk(prop_ret, num_items_ret, rem_bytes_ret == 0);
+    if (rem_bytes_ret == 0)
+      break;
+    offset += num_items_ret / 4;
+  }
+
+  if (data_out->size() == 0) {
+    fprintf(stderr, "Property %s on 0x%x is empty\n",
+            kPropName, static_cast<unsigned int>(win));
     return false;
   }
+  return true;
+}
 
-  static const char* kPropName = "_XSETTINGS_SETTINGS";
-  Atom prop_atom = XInternAtom(display, kPropName, False);
-  Atom type_ret = None;
-  int format_ret = 0;
-  unsigned long num_items_ret = 0;
-  unsigned long rem_bytes_ret = 0;
-  unsigned char* prop_ret = NULL;
-  int retval = XGetWindowProperty(display,
-                                  win,
-                                  prop_atom,
-                                  0,                // offset
-                                  buffer_size / 4,  // length (32-bit multiples)
-                                  False,            // delete
-                                  AnyPropertyType,  // type
-                                  &type_ret,        // actual type
-                                  &format_ret,      // actual format
-                                  &num_items_ret,   // actual num items
-                                  &rem_bytes_ret,   // remaining bytes
-                                  &prop_ret);       // property
-  if (retval != Success) {
-    fprintf(stderr, "XGetWindowProperty() returned %d\n", retval);
+#ifdef HAVE_XCB
+// Check a reply (or 'error') to a request for the settings property on
+// 'win', and add its data to 'data_out'.  Returns false if the property
+// couldn't be read.  Otherwise, 'more_out' is set if there's more of the
+// property to fetch.
+static bool AddPropertyReply(Window win,
+                             xcb_get_property_reply_t* reply,
+                             xcb_generic_error_t* error,
+                             PropertyData* data_out,
+                             bool* more_out) {
+  assert(data_out);
+  assert(more_out);
+  if (!reply) {
+    fprintf(stderr, "Getting property from 0x%x failed with error %d\n",
+            static_cast<unsigned int>(win), error ? error->error_code : 0);
+    free(error);
     return false;
   }
-  if (num_items_ret == 0) {
+  if (reply->type == XCB_NONE) {
     fprintf(stderr, "Property %s doesn't exist on 0x%x\n",
             kPropName, static_cast<unsigned int>(win));
+    free(reply);
     return false;
   }
-  if (rem_bytes_ret > 0) {
-    fprintf(stderr, "Property %s on 0x%x is more than %zu bytes (%lu remain)\n",
-            kPropName, static_cast<unsigned int>(win), buffer_size,
-            rem_bytes_ret);
-    XFree(prop_ret);
+  if (reply->format != 8) {
+    fprintf(stderr, "Got unexpected format %d\n", reply->format);
+    free(reply);
     return false;
   }
-  if (format_ret != 8) {
-    fprintf(stderr, "Got unexpected format %d\n", format_ret);
-    XFree(prop_ret);
-    return false;
-  }
-
-  *data_size = min(buffer_size, static_cast<size_t>(num_items_ret));
-  memcpy(buffer, prop_ret, *data_size);
+  *more_out = reply->bytes_after > 0;
+  data_out->AddReply(reply, !*more_out);
   return true;
 }
+#endif
+
+// Read the settings property from the owner of each of 'atoms' selections
+// into the corresponding entry of 'data_out', leaving the entries of screens
+// whose properties couldn't be read empty.  With XCB, the selection-owner
+// requests for all of the screens are sent before any of their replies are
+// waited for, and then the property requests for all of the owners, so
+// reading every screen takes two round trips (plus one for each further
+// chunk of a large property) rather than two per screen.
+void GetAllData(Display* display,
+                const Atoms& atoms,
+                std::vector<PropertyData>* data_out) {
+  assert(data_out);
+  assert(data_out->size() == atoms.sel_atoms.size());
+  const size_t num_screens = atoms.sel_atoms.size();
+
+#ifdef HAVE_XCB
+  xcb_connection_t* conn = XGetXCBConnection(display);
+  std::vector<xcb_get_selection_owner_cookie_t> owner_cookies;
+  for (size_t i = 0; i < num_screens; ++i) {
+    owner_cookies.push_back(
+        xcb_get_selection_owner(conn, atoms.sel_atoms[i]));
+  }
 
-bool DumpSetting(DataReader* reader) {
-  int8_t type_byte = 0;
-  if (!reader->ReadInt8(&type_byte)) {
-    fprintf(stderr, "Unable to read setting type\n");
-    return false;
+  std::vector<Window> wins(num_screens, None);
+  std::vector<xcb_get_property_cookie_t> prop_cookies(num_screens);
+  for (size_t i = 0; i < num_screens; ++i) {
+    xcb_get_selection_owner_reply_t* reply =
+        xcb_get_selection_owner_reply(conn, owner_cookies[i], NULL);
+    if (reply) {
+      wins[i] = reply->owner;
+      free(reply);
+    }
+    if (wins[i] == None)
+      continue;
+    prop_cookies[i] = xcb_get_property(conn, 0, wins[i], atoms.prop_atom,
+                                       XCB_GET_PROPERTY_TYPE_ANY, 0,
+                                       kChunkLength);
   }
-  Setting::Type type = static_cast<Setting::Type>(type_byte);
 
-  if (type != Setting::TYPE_INTEGER &&
-      type != Setting::TYPE_STRING &&
-      type != Setting::TYPE_COLOR) {
-    fprintf(stderr, "Got setting with unhandled type %d\n", type);
-    return false;
+  for (size_t i = 0; i < num_screens; ++i) {
+    if (wins[i] == None) {
+      ReportNoOwner(display, atoms.sel_atoms[i]);
+      continue;
+    }
+    PropertyData* data = &(*data_out)[i];
+    data->Reset();
+    xcb_get_property_cookie_t cookie = prop_cookies[i];
+    bool ok = true, more = true;
+    while (ok && more) {
+      xcb_generic_error_t* error = NULL;
+      xcb_get_property_reply_t* reply =
+          xcb_get_property_reply(conn, cookie, &error);
+      ok = AddPropertyReply(wins[i], reply, error, data, &more);
+      if (ok && more) {
+        // Chunks other than the last are a whole number of 32-bit units.
+        cookie = xcb_get_property(conn, 0, wins[i], atoms.prop_atom,
+                                  XCB_GET_PROPERTY_TYPE_ANY, data->size() / 4,
+                                  kChunkLength);
+      }
+    }
+    if (!ok) {
+      data->Reset();
+    } else if (data->size() == 0) {
+      fprintf(stderr, "Property %s on 0x%x is empty\n",
+              kPropName, static_cast<unsigned int>(wins[i]));
+    }
+  }
+#else
+  for (size_t i = 0; i < num_screens; ++i) {
+    PropertyData* data = &(*data_out)[i];
+    Window win = GetOwner(display, atoms.sel_atoms[i]);
+    if (win == None || !GetData(display, win, atoms.prop_atom, data))
+      data->Reset();
   }
+#endif
+}
 
-  if (!reader->ReadBytes(NULL, 1)) {
-    fprintf(stderr, "Unable to read 1-byte setting padding\n");
+// Read the property's header.
+template <bool kReverseBytes>
+bool ReadHeader(BasicDataReader<kReverseBytes>* reader,
+                uint32_t* serial_out,
+                uint32_t* num_settings_out) {
+  assert(serial_out);
+  assert(num_settings_out);
+
+  // Skip the byte order (already handled by ReadProperty()) and 3 bytes of
+  // padding, and read the 4-byte serial.
+  if (!reader->ReadBytes(NULL, 4) ||
+      !reader->ReadInt32(reinterpret_cast<int32_t*>(serial_out))) {
+    fprintf(stderr, "Unable to read header\n");
     return false;
   }
 
-  uint16_t name_size = 0;
-  if (!reader->ReadInt16(reinterpret_cast<int16_t*>(&name_size))) {
-    fprintf(stderr, "Unable to read setting name size\n");
+  if (!reader->ReadInt32(reinterpret_cast<int32_t*>(num_settings_out))) {
+    fprintf(stderr, "Unable to read number of settings\n");
     return false;
   }
+  return true;
+}
 
-  string name;
-  if (!reader->ReadBytes(&name, name_size)) {
-    fprintf(stderr, "Unable to read %u-byte setting name\n", name_size);
+// Decode the next setting.  'view_out' points into the reader's buffer.
+template <bool kReverseBytes>
+bool ReadSetting(BasicDataReader<kReverseBytes>* reader,
+                 SettingView* view_out) {
+  size_t offset = reader->bytes_read();
+  if (!Setting::ReadView(reader, view_out)) {
+    fprintf(stderr, "Unable to read setting at offset %zu\n", offset);
     return false;
   }
+  return true;
+}
 
-  size_t name_padding = GetPadding(name_size, 4);
-  if (!reader->ReadBytes(NULL, name_padding)) {
-    fprintf(stderr, "Unable to read %zu-byte setting name padding\n",
-            name_padding);
+// Decode the property in 'data', saving its serial to 'serial_out' and
+// passing each setting to 'func'.  The views point into 'data'.
+template <class Func>
+bool ForEachSetting(const char* data,
+                    size_t size,
+                    uint32_t* serial_out,
+                    Func func) {
+  // ReadProperty() rejects these too, but silently.
+  if (size > 0 && data[0] != LSBFirst && data[0] != MSBFirst) {
+    fprintf(stderr, "Invalid byte order %d\n", data[0]);
     return false;
   }
+  return ReadProperty(data, size, [&](auto* reader) {
+    uint32_t num_settings = 0;
+    if (!ReadHeader(reader, serial_out, &num_settings))
+      return false;
+    for (uint32_t i = 0; i < num_settings; ++i) {
+      SettingView view;
+      if (!ReadSetting(reader, &view))
+        return false;
+      func(view);
+    }
+    return true;
+  });
+}
+
+// Append all of the settings from the property in 'data' to 'out' in the
+// config file format.
+bool FormatSettings(const char* data, size_t size, string* out) {
+  assert(out);
+  uint32_t serial = 0;
+  return ForEachSetting(data, size, &serial, [out](const SettingView& view) {
+    out->append(view.name);
+    out->push_back(' ');
+    view.AppendValue(out);
+    out->push_back('\n');
+  });
+}
 
-  if (!reader->ReadBytes(NULL, 4)) {
-    fprintf(stderr, "Unable to read setting serial number\n");
+bool DumpSettings(const char* data, size_t size) {
+  string output;
+  if (!FormatSettings(data, size, &output))
     return false;
+  fwrite(output.data(), 1, output.size(), stdout);
+  return true;
+}
+
+// State tracked for each screen in watch mode.
+struct WatchedScreen {
+  WatchedScreen() : screen(0), sel_atom(None), win(None) {}
+
+  int screen;
+  Atom sel_atom;
+
+  // Current owner of 'sel_atom', or None.
+  Window win;
+
+  // Most-recently-seen serials and values, keyed by setting name.
+  std::map<string, std::pair<uint32_t, string> > settings;
+};
+
+// Watching windows that other clients own means that they can be destroyed
+// at any time; don't exit if we get a BadWindow error.
+static int HandleXError(Display* display, XErrorEvent* event) {
+  if (event->error_code != BadWindow) {
+    char message[256];
+    XGetErrorText(display, event->error_code, message, sizeof(message));
+    fprintf(stderr, "Got X error: %s\n", message);
   }
+  return 0;
+}
 
-  if (type == Setting::TYPE_INTEGER) {
-    int32_t value = 0;
-    if (!reader->ReadInt32(&value)) {
-      fprintf(stderr, "Unable to read integer setting value\n");
-      return false;
-    }
-    printf("%s %d\n", name.c_str(), value);
+// Start watching the settings property on 'win' for 'screen'.
+static void WatchOwner(Display* display, WatchedScreen* screen, Window win) {
+  screen->win = win;
+  if (win != None)
+    XSelectInput(display, win, PropertyChangeMask | StructureNotifyMask);
+}
 
-  } else if (type == Setting::TYPE_STRING) {
-    uint32_t value_size = 0;
-    if (!reader->ReadInt32(reinterpret_cast<int32_t*>(&value_size))) {
-      fprintf(stderr, "Unable to read string setting value size\n");
-      return false;
-    }
+// Re-read 'screen's settings and print the ones whose serials changed
+// since the last time, along with a header line containing the time at
+// which 'reason' was received.
+static void PrintChanges(Display* display,
+                         Atom prop_atom,
+                         WatchedScreen* screen,
+                         double receive_time,
+                         const char* reason) {
+  std::map<string, std::pair<uint32_t, string> > settings;
+  uint32_t serial = 0;
+  PropertyData data;
+  if (screen->win != None &&
+      GetData(display, screen->win, prop_atom, &data)) {
+    bool valid = ForEachSetting(data.data(), data.size(), &serial,
+                                [&settings](const SettingView& view) {
+      std::pair<uint32_t, string>& setting = settings[string(view.name)];
+      setting.first = view.serial;
+      view.AppendValue(&setting.second);
+    });
+    if (!valid)
+      return;
+  }
 
-    string value;
-    if (!reader->ReadBytes(&value, value_size)) {
-      fprintf(stderr, "Unable to read %u-byte string setting value\n",
-              value_size);
-      return false;
+  printf("# %.6f screen %d serial %u (%s)\n",
+         receive_time, screen->screen, serial, reason);
+  for (std::map<string, std::pair<uint32_t, string> >::const_iterator it =
+           settings.begin(); it != settings.end(); ++it) {
+    std::map<string, std::pair<uint32_t, string> >::const_iterator prev =
+        screen->settings.find(it->first);
+    if (prev == screen->settings.end() ||
+        prev->second.first != it->second.first) {
+      printf("%s %s\n", it->first.c_str(), it->second.second.c_str());
     }
+  }
+  for (std::map<string, std::pair<uint32_t, string> >::const_iterator it =
+           screen->settings.begin(); it != screen->settings.end(); ++it) {
+    if (!settings.count(it->first))
+      printf("# removed %s\n", it->first.c_str());
+  }
+  fflush(stdout);
 
-    size_t value_padding = GetPadding(value_size, 4);
-    if (!reader->ReadBytes(NULL, value_padding)) {
-      fprintf(stderr, "Unable to read %zu-byte string setting value padding\n",
-              value_padding);
-      return false;
-    }
+  screen->settings.swap(settings);
+}
+
+// Print settings as they change on 'screens' until the connection to the
+// X server is lost.
+void WatchSettings(Display* display,
+                   Atom prop_atom,
+                   std::vector<WatchedScreen>* screens) {
+  assert(screens);
+
+  XSetErrorHandler(HandleXError);
+  Atom manager_atom = XInternAtom(display, "MANAGER", False);
+
+  // Listen for MANAGER messages on the root windows before looking up the
+  // current owners so that we won't miss a new manager.
+  for (size_t i = 0; i < screens->size(); ++i) {
+    WatchedScreen* screen = &(*screens)[i];
+    XSelectInput(display, RootWindow(display, screen->screen),
+                 StructureNotifyMask);
+    WatchOwner(display, screen, XGetSelectionOwner(display, screen->sel_atom));
+    PrintChanges(display, prop_atom, screen, GetMonotonicTime(), "initial");
+  }
 
-    string escaped_value;
-    for (size_t i = 0; i < value.size(); ++i) {
-      char ch = value.c_str()[i];
-      switch (ch) {
-        case '\n':
-          escaped_value.append("\\n");
-          break;
-        case '"':
-          escaped_value.append("\\\"");
-          break;
-        default:
-          escaped_value.push_back(ch);
+  while (true) {
+    XEvent event;
+    XNextEvent(display, &event);
+    double receive_time = GetMonotonicTime();
+
+    for (size_t i = 0; i < screens->size(); ++i) {
+      WatchedScreen* screen = &(*screens)[i];
+      if (event.type == PropertyNotify &&
+          event.xproperty.window == screen->win &&
+          event.xproperty.atom == prop_atom) {
+        PrintChanges(display, prop_atom, screen, receive_time,
+                     "property changed");
+      } else if (event.type == ClientMessage &&
+                 event.xclient.message_type == manager_atom &&
+                 static_cast<Atom>(event.xclient.data.l[1]) ==
+                     screen->sel_atom) {
+        WatchOwner(display, screen, event.xclient.data.l[2]);
+        PrintChanges(display, prop_atom, screen, receive_time,
+                     "new manager");
+      } else if (event.type == DestroyNotify &&
+                 event.xdestroywindow.window == screen->win) {
+        WatchOwner(display, screen, None);
+        PrintChanges(display, prop_atom, screen, receive_time,
+                     "manager exited");
       }
     }
-    printf("%s \"%s\"\n", name.c_str(), escaped_value.c_str());
-
-  } else if (type == Setting::TYPE_COLOR) {
-    uint16_t red = 0, blue = 0, green = 0, alpha = 0;
-    if (!reader->ReadInt16(reinterpret_cast<int16_t*>(&red)) ||
-        !reader->ReadInt16(reinterpret_cast<int16_t*>(&blue)) ||
-        !reader->ReadInt16(reinterpret_cast<int16_t*>(&green)) ||
-        !reader->ReadInt16(reinterpret_cast<int16_t*>(&alpha))) {
-      fprintf(stderr, "Unable to read color values\n");
-      return false;
-    }
-    // Note that unlike the spec, our config uses RGB-order, not RBG.
-    printf("%s (%u, %u, %u, %u)\n", name.c_str(), red, green, blue, alpha);
-
-  } else {
-    assert(false);
   }
+}
 
-  return true;
+// Result of reading the settings from one display in fleet mode.
+struct DisplayResult {
+  string display;
+
+  // Empty on success.
+  string error;
+
+  // Settings in the config file format and a hash of them that's used to
+  // label them in the report.
+  string config;
+  uint64_t hash;
+};
+
+// Returns the first eight bytes of the SHA-256 digest of 'data'.
+static uint64_t HashString(const string& data) {
+  const string digest = Sha256::Hash(data.data(), data.size());
+  uint64_t hash = 0;
+  for (size_t i = 0; i < sizeof(hash); ++i)
+    hash = (hash << 8) | static_cast<unsigned char>(digest[i]);
+  return hash;
 }
 
-bool DumpSettings(DataReader* reader) {
-  int byte_order = IsLittleEndian() ? LSBFirst : MSBFirst;
+// Report a lost connection to a display.  Xlib then calls the display's
+// exit handler, which exits unless it's HandleIOErrorExit().
+static int HandleIOError(Display* display) {
+  fprintf(stderr, "Lost connection to %s\n", DisplayString(display));
+  return 0;
+}
 
-  // Read 1-byte byte order.
-  int8_t prop_byte_order = 0;
-  if (!reader->ReadInt8(&prop_byte_order)) {
-    fprintf(stderr, "Couldn't read byte order\n");
-    return false;
+// Exit handler for fleet mode's displays: instead of exiting, set the bool
+// that 'data' points to and return.  Xlib fails all later requests on the
+// display, so only the thread that's reading it is affected.
+static void HandleIOErrorExit(Display* /* display */, void* data) {
+  *static_cast<bool*>(data) = true;
+}
+
+// Read the settings from 'screen' on 'result->display' into 'result'.
+static void ReadDisplay(int screen, DisplayResult* result) {
+  assert(result);
+
+  Display* display = XOpenDisplay(result->display.c_str());
+  if (!display) {
+    result->error = "Couldn't open display";
+    return;
+  }
+  bool lost_connection = false;
+  XSetIOErrorExitHandler(display, HandleIOErrorExit, &lost_connection);
+
+  Atoms atoms;
+  PropertyData data;
+  Window win = None;
+  if (!InternAtoms(display, screen, 1, &atoms)) {
+    result->error = "Couldn't intern atoms";
+  } else if ((win = GetOwner(display, atoms.sel_atoms[0])) == None) {
+    result->error = "No settings manager";
+  } else if (!GetData(display, win, atoms.prop_atom, &data)) {
+    result->error = "Couldn't read property";
+  } else if (!FormatSettings(data.data(), data.size(), &result->config)) {
+    result->error = "Couldn't decode property";
+  } else {
+    result->hash = HashString(result->config);
   }
-  if (prop_byte_order != byte_order) {
-    reader->set_reverse_bytes(true);
+  // The requests after the connection was lost failed too, so report the
+  // cause rather than whichever of them came first.
+  if (lost_connection) {
+    result->error = "Lost connection";
+    result->config.clear();
   }
 
-  // Read 3 bytes of padding and 4-byte serial.
-  if (!reader->ReadBytes(NULL, 7)) {
-    fprintf(stderr, "Unable to read header\n");
-    return false;
+  data.Reset();
+  XCloseDisplay(display);
+}
+
+// Read the settings from 'screen' on each display in 'results' using
+// 'num_jobs' threads, and print a report in which displays with identical
+// settings share a single copy of them.  Returns false if any display
+// couldn't be read.
+bool DumpFleet(int screen, int num_jobs, std::vector<DisplayResult>* results) {
+  assert(results);
+
+  // Each thread uses its own connections, but Xlib still needs to know
+  // that it's being used by multiple threads.
+  XInitThreads();
+  XSetErrorHandler(HandleXError);
+  XSetIOErrorHandler(HandleIOError);
+
+  std::atomic<size_t> next_index(0);
+  auto worker = [&]() {
+    size_t index;
+    while ((index = next_index++) < results->size())
+      ReadDisplay(screen, &(*results)[index]);
+  };
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_jobs; ++i)
+    threads.push_back(std::thread(worker));
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+
+  // Print a line for each display, followed by each distinct set of
+  // settings in the order in which it was first seen.  Settings are
+  // compared by their text rather than their hashes, so that a collision
+  // can't merge different settings.
+  bool success = true;
+  std::vector<const DisplayResult*> configs;
+  std::map<std::string_view, int> config_counts;
+  string output;
+  for (size_t i = 0; i < results->size(); ++i) {
+    const DisplayResult& result = (*results)[i];
+    if (!result.error.empty()) {
+      output += StringPrintf("display %s error %s\n",
+                             result.display.c_str(), result.error.c_str());
+      success = false;
+      continue;
+    }
+    output += StringPrintf("display %s %016llx\n", result.display.c_str(),
+                           static_cast<unsigned long long>(result.hash));
+    if (config_counts[result.config]++ == 0)
+      configs.push_back(&result);
+  }
+  for (size_t i = 0; i < configs.size(); ++i) {
+    output += StringPrintf("config %016llx %d\n",
+                           static_cast<unsigned long long>(configs[i]->hash),
+                           config_counts[configs[i]->config]);
+    output += configs[i]->config;
+    output += "end\n";
   }
+  fwrite(output.data(), 1, output.size(), stdout);
+  return success;
+}
 
-  uint32_t num_settings = 0;
-  if (!reader->ReadInt32(reinterpret_cast<int32_t*>(&num_settings))) {
-    fprintf(stderr, "Unable to read number of settings\n");
+// Read display names, one per line, from 'path' ("-" for stdin), appending
+// them to 'results'.
+bool ReadDisplayList(const char* path, std::vector<DisplayResult>* results) {
+  assert(results);
+
+  FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (!file) {
+    fprintf(stderr, "Couldn't open %s: %s\n", path, strerror(errno));
     return false;
   }
 
-  for (uint32_t i = 0; i < num_settings; ++i) {
-    if (!DumpSetting(reader))
-      return false;
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    size_t length = strcspn(line, "\r\n");
+    line[length] = '\0';
+    if (length == 0 || line[0] == '#')
+      continue;
+    DisplayResult result;
+    result.display = line;
+    result.hash = 0;
+    results->push_back(result);
   }
-
+  if (file != stdin)
+    fclose(file);
   return true;
 }
 
@@ -231,22 +694,46 @@ int main(int argc, char** argv) {
       "\n"
       "Dump current XSETTINGS values in xsettingd's format.\n"
       "\n"
-      "Options: -h, --help           print this help message\n"
-      "         -s, --screen=SCREEN  screen to use (default is 0)\n";
+      "Options: -a, --all-screens    dump settings from all screens\n"
+      "         -d, --displays=FILE  report on each display listed in FILE\n"
+      "         -h, --help           print this help message\n"
+      "         -j, --jobs=NUM       displays to read at once with -d\n"
+      "                              (default is 16)\n"
+      "         -s, --screen=SCREEN  screen to use (default is 0)\n"
+      "         -w, --watch          print settings as they change\n";
 
   int screen = 0;
+  bool all_screens = false;
+  bool watch = false;
+  const char* displays_path = NULL;
+  int num_jobs = 16;
 
   struct option options[] = {
+    { "all-screens", 0, NULL, 'a', },
+    { "displays", 1, NULL, 'd', },
     { "help", 0, NULL, 'h', },
+    { "jobs", 1, NULL, 'j', },
     { "screen", 1, NULL, 's', },
+    { "watch", 0, NULL, 'w', },
     { NULL, 0, NULL, 0 },
   };
 
   opterr = 0;
   while (true) {
-    int ch = getopt_long(argc, argv, "hs:", options, NULL);
+    int ch = getopt_long(argc, argv, "ad:hj:s:w", options, NULL);
     if (ch == -1) {
       break;
+    } else if (ch == 'a') {
+      all_screens = true;
+    } else if (ch == 'd') {
+      displays_path = optarg;
+    } else if (ch == 'j') {
+      char* endptr = NULL;
+      num_jobs = strtol(optarg, &endptr, 10);
+      if (optarg[0] == '\0' || endptr[0] != '\0' || num_jobs <= 0) {
+        fprintf(stderr, "Invalid number of jobs \"%s\"\n", optarg);
+        return 1;
+      }
     } else if (ch == 'h' || ch == '?') {
       fprintf(stderr, "%s", kUsage);
       return 1;
@@ -257,20 +744,62 @@ int main(int argc, char** argv) {
         fprintf(stderr, "Invalid screen \"%s\"\n", optarg);
         return 1;
       }
+    } else if (ch == 'w') {
+      watch = true;
     }
   }
 
-  static const size_t kBufferSize = 2 << 15;
-  char buffer[kBufferSize];
+  if (displays_path) {
+    if (all_screens || watch) {
+      fprintf(stderr, "-d can't be used with -a or -w\n");
+      return 1;
+    }
+    std::vector<xsettingsd::DisplayResult> results;
+    if (!xsettingsd::ReadDisplayList(displays_path, &results))
+      return 1;
+    if (num_jobs > static_cast<int>(results.size()))
+      num_jobs = results.size();
+    return xsettingsd::DumpFleet(screen, num_jobs, &results) ? 0 : 1;
+  }
+
+  Display* display = XOpenDisplay(NULL);
+  if (!display) {
+    fprintf(stderr, "Couldn't open display\n");
+    return 1;
+  }
 
-  size_t data_size = 0;
-  if (!xsettingsd::GetData(screen, buffer, kBufferSize, &data_size))
+  int num_screens = 1;
+  if (all_screens) {
+    screen = 0;
+    num_screens = ScreenCount(display);
+  }
+
+  xsettingsd::Atoms atoms;
+  if (!xsettingsd::InternAtoms(display, screen, num_screens, &atoms))
     return 1;
-  assert(data_size <= kBufferSize);
 
-  xsettingsd::DataReader reader(buffer, data_size);
-  if (!xsettingsd::DumpSettings(&reader))
+  if (watch) {
+    std::vector<xsettingsd::WatchedScreen> screens(num_screens);
+    for (int i = 0; i < num_screens; ++i) {
+      screens[i].screen = screen + i;
+      screens[i].sel_atom = atoms.sel_atoms[i];
+    }
+    xsettingsd::WatchSettings(display, atoms.prop_atom, &screens);
     return 1;
+  }
 
-  return 0;
+  int status = 0;
+  std::vector<xsettingsd::PropertyData> data(num_screens);
+  xsettingsd::GetAllData(display, atoms, &data);
+  for (int i = 0; i < num_screens; ++i) {
+    if (all_screens)
+      printf("%s# Screen %d\n", i > 0 ? "\n" : "", screen + i);
+    if (data[i].size() == 0 ||
+        !xsettingsd::DumpSettings(data[i].data(), data[i].size())) {
+      status = 1;
+    }
+  }
+
+  XCloseDisplay(display);
+  return status;
 }
@@ -0,0 +1,99 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include "file_writer.h"
+
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <pthread.h>
+
+#include "logging.h"
+
+using std::map;
+using std::string;
+
+namespace xsettingsd {
+
+FileWriter::FileWriter()
+    : thread_(NULL),
+      writing_(false),
+      stopping_(false) {
+}
+
+FileWriter::~FileWriter() {
+  if (thread_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cond_.notify_one();
+    thread_->join();
+    delete thread_;
+    thread_ = NULL;
+  }
+}
+
+bool FileWriter::Start() {
+  assert(!thread_);
+  // Block all signals in the worker thread so that they're delivered to the
+  // main thread (which relies on SIGHUP interrupting select()).
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  thread_ = new std::thread(&FileWriter::RunWorkerThread, this);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  return true;
+}
+
+bool FileWriter::Write(const string& path, const string& data) {
+  if (!thread_) {
+    if (!WriteFileAtomically(path, data)) {
+      LOG(ERROR, "Unable to write %s: %s", path.c_str(), strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_[path] = data;
+  }
+  cond_.notify_one();
+  return true;
+}
+
+void FileWriter::Flush() {
+  if (!thread_)
+    return;
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cond_.wait(lock, [&]() { return pending_.empty() && !writing_; });
+}
+
+void FileWriter::RunWorkerThread() {
+  while (true) {
+    string path, data;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      writing_ = false;
+      if (pending_.empty())
+        idle_cond_.notify_all();
+      cond_.wait(lock, [&]() { return stopping_ || !pending_.empty(); });
+      // Pending files are still written when stopping so that nothing is
+      // lost at exit.
+      if (pending_.empty())
+        return;
+      map<string, string>::iterator it = pending_.begin();
+      path = it->first;
+      data.swap(it->second);
+      pending_.erase(it);
+      writing_ = true;
+    }
+
+    if (!WriteFileAtomically(path, data))
+      LOG(ERROR, "Unable to write %s: %s", path.c_str(), strerror(errno));
+  }
+}
+
+}  // namespace xsettingsd
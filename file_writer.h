@@ -0,0 +1,70 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_FILE_WRITER_H__
+#define __XSETTINGSD_FILE_WRITER_H__
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "common.h"
+
+namespace xsettingsd {
+
+// FileWriter atomically replaces files (see WriteFileAtomically()), either
+// on the calling thread or on a worker thread so that a slow disk doesn't
+// keep the X event loop from running.  The worker only writes the newest
+// contents of each file: contents that are replaced before it gets to them
+// are dropped.
+class FileWriter {
+ public:
+  FileWriter();
+
+  // Writes any files that are still pending and stops the worker thread.
+  ~FileWriter();
+
+  // Start the worker thread.
+  bool Start();
+  bool started() const { return thread_ != NULL; }
+
+  // Replace the file at 'path' with 'data'.  Before Start(), the file is
+  // written on the calling thread and false is returned on failure.
+  // Afterward, the write is handed to the worker thread, which logs
+  // failures.
+  bool Write(const std::string& path, const std::string& data);
+
+  // Wait for the worker thread to finish writing all of the files that
+  // have been passed to Write().
+  void Flush();
+
+ private:
+  // Body of the worker thread.
+  void RunWorkerThread();
+
+  std::thread* thread_;
+
+  // Protects the members below.
+  std::mutex mutex_;
+
+  // Signaled when 'pending_' gets a new file or 'stopping_' is set, and
+  // when the worker becomes idle.
+  std::condition_variable cond_;
+  std::condition_variable idle_cond_;
+
+  // Contents of files that haven't been written yet, keyed by path.
+  std::map<std::string, std::string> pending_;
+
+  // Is the worker writing a file that was taken from 'pending_'?
+  bool writing_;
+
+  bool stopping_;
+
+  DISALLOW_COPY_AND_ASSIGN(FileWriter);
+};
+
+}  // namespace xsettingsd
+
+#endif
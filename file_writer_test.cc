@@ -0,0 +1,77 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "common.h"
+#include "file_writer.h"
+
+using std::string;
+
+namespace xsettingsd {
+
+class FileWriterTest : public testing::Test {
+ protected:
+  void SetUp() {
+    char dir[] = "/tmp/file_writer_test.XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+    path_ = dir_ + "/file";
+    other_path_ = dir_ + "/other";
+  }
+
+  void TearDown() {
+    unlink(path_.c_str());
+    unlink(other_path_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  // Returns the contents of the file at 'path', or "missing".
+  string Read(const string& path) {
+    string data;
+    return ReadFile(path, &data) ? data : "missing";
+  }
+
+  string dir_;
+  string path_;
+  string other_path_;
+};
+
+TEST_F(FileWriterTest, Write) {
+  FileWriter writer;
+
+  // Files are written synchronously until the worker is started.
+  EXPECT_TRUE(writer.Write(path_, "first"));
+  EXPECT_EQ("first", Read(path_));
+  EXPECT_FALSE(writer.Write(dir_ + "/missing/file", "data"));
+
+  // Afterward, only the newest contents of each file need to be written.
+  ASSERT_TRUE(writer.Start());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(writer.Write(path_, StringPrintf("path %d", i)));
+    EXPECT_TRUE(writer.Write(other_path_, StringPrintf("other %d", i)));
+  }
+  writer.Flush();
+  EXPECT_EQ("path 99", Read(path_));
+  EXPECT_EQ("other 99", Read(other_path_));
+}
+
+TEST_F(FileWriterTest, WritePendingFilesOnDestruction) {
+  {
+    FileWriter writer;
+    ASSERT_TRUE(writer.Start());
+    EXPECT_TRUE(writer.Write(path_, "data"));
+  }
+  EXPECT_EQ("data", Read(path_));
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,275 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include "logging.h"
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <thread>
+#include <unistd.h>
+
+namespace xsettingsd {
+
+namespace {
+
+// Number of messages that can be queued.  Must be a power of two.
+const size_t kNumSlots = 256;
+
+// Maximum length of a formatted message, including the trailing newline.
+const size_t kMaxMessageLength = 512;
+
+struct Slot {
+  // Used to hand the slot back and forth between writers and the reader:
+  // it's equal to the slot's position when the slot is free and to the
+  // position plus one when it contains a message.
+  std::atomic<size_t> sequence;
+  size_t length;
+  char text[kMaxMessageLength];
+};
+
+// Bounded multi-producer, single-consumer queue, based on Dmitry Vyukov's
+// bounded MPMC queue.
+class LogQueue {
+ public:
+  LogQueue() : enqueue_pos_(0), dequeue_pos_(0), num_dropped_(0) {
+    for (size_t i = 0; i < kNumSlots; ++i)
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  uint64_t num_dropped() const {
+    return num_dropped_.load(std::memory_order_relaxed);
+  }
+
+  // Claim a slot for writing, returning NULL (and counting the message as
+  // dropped) if the queue is full.  The caller fills the slot and then
+  // passes it to Commit().
+  Slot* Claim(size_t* pos_out) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot* slot = &slots_[pos & (kNumSlots - 1)];
+      size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          *pos_out = pos;
+          return slot;
+        }
+      } else if (diff < 0) {
+        num_dropped_.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void Commit(Slot* slot, size_t pos) {
+    slot->sequence.store(pos + 1, std::memory_order_release);
+  }
+
+  // Append the next message to 'out', returning false if the queue is
+  // empty.  Must only be called by the reader.
+  bool Pop(std::string* out) {
+    Slot* slot = &slots_[dequeue_pos_ & (kNumSlots - 1)];
+    if (slot->sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+      return false;
+    out->append(slot->text, slot->length);
+    slot->sequence.store(dequeue_pos_ + kNumSlots, std::memory_order_release);
+    dequeue_pos_++;
+    return true;
+  }
+
+ private:
+  Slot slots_[kNumSlots];
+  std::atomic<size_t> enqueue_pos_;
+  size_t dequeue_pos_;  // only used by the reader
+  std::atomic<uint64_t> num_dropped_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogQueue);
+};
+
+LogQueue* g_queue = NULL;
+std::thread* g_thread = NULL;
+std::atomic<bool> g_running(false);
+std::atomic<bool> g_stopping(false);
+std::atomic<LogSeverity> g_min_severity(LOG_SEVERITY_INFO);
+
+// Pipe used to wake the writer thread.  'g_wake_pending' is set while a
+// byte is (or is about to be) in the pipe so that bursts of messages only
+// write a single byte.
+int g_wake_fds[2] = { -1, -1 };
+std::atomic<bool> g_wake_pending(false);
+
+// Write all of 'data' to stderr.
+void WriteToStderr(const char* data, size_t size) {
+  size_t offset = 0;
+  while (offset < size) {
+    ssize_t bytes_written = write(STDERR_FILENO, data + offset, size - offset);
+    if (bytes_written < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    offset += bytes_written;
+  }
+}
+
+void RunWriterThread() {
+  uint64_t num_reported_dropped = 0;
+  std::string output;
+  while (true) {
+    // Clear the flag before draining so that messages that are queued after
+    // we've looked at the queue will wake us again.
+    g_wake_pending.store(false, std::memory_order_seq_cst);
+    output.clear();
+    while (g_queue->Pop(&output)) {}
+
+    uint64_t num_dropped = g_queue->num_dropped();
+    if (num_dropped != num_reported_dropped) {
+      output += StringPrintf("%s: Dropped %llu log message%s\n", kProgName,
+          static_cast<unsigned long long>(num_dropped - num_reported_dropped),
+          num_dropped - num_reported_dropped == 1 ? "" : "s");
+      num_reported_dropped = num_dropped;
+    }
+    if (!output.empty())
+      WriteToStderr(output.data(), output.size());
+
+    if (g_stopping.load())
+      return;
+
+    char buffer[64];
+    if (read(g_wake_fds[0], buffer, sizeof(buffer)) < 0 && errno != EINTR)
+      return;
+  }
+}
+
+void WakeWriterThread() {
+  if (!g_wake_pending.exchange(true)) {
+    char ch = 0;
+    // The pipe is non-blocking; if it's somehow full, the writer is
+    // already going to wake up.
+    if (write(g_wake_fds[1], &ch, 1) < 0) {}
+  }
+}
+
+}  // namespace
+
+bool StartLogThread() {
+  assert(!g_thread);
+  if (pipe2(g_wake_fds, O_CLOEXEC) != 0 ||
+      fcntl(g_wake_fds[1], F_SETFL, O_NONBLOCK) != 0) {
+    fprintf(stderr, "%s: Unable to create logging pipe: %s\n",
+            kProgName, strerror(errno));
+    return false;
+  }
+  if (!g_queue)
+    g_queue = new LogQueue;
+  g_stopping.store(false);
+
+  // Block all signals in the writer thread so that they're delivered to
+  // the main thread (which relies on SIGHUP interrupting select()).
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  g_thread = new std::thread(RunWriterThread);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+  g_running.store(true);
+  return true;
+}
+
+void StopLogThread() {
+  if (!g_thread)
+    return;
+  g_running.store(false);
+  g_stopping.store(true);
+  g_wake_pending.store(false);
+  WakeWriterThread();
+  g_thread->join();
+  delete g_thread;
+  g_thread = NULL;
+  close(g_wake_fds[0]);
+  close(g_wake_fds[1]);
+  g_wake_fds[0] = g_wake_fds[1] = -1;
+}
+
+void SetMinLogSeverity(LogSeverity severity) {
+  g_min_severity.store(severity);
+}
+
+void LogMessage(LogSeverity severity, const char* format, ...) {
+  if (severity < g_min_severity.load(std::memory_order_relaxed))
+    return;
+
+  Slot* slot = NULL;
+  size_t pos = 0;
+  char local_buffer[kMaxMessageLength];
+  char* buffer = local_buffer;
+  if (g_running.load(std::memory_order_acquire)) {
+    slot = g_queue->Claim(&pos);
+    if (!slot)
+      return;
+    buffer = slot->text;
+  }
+
+  // Leave room for the newline.
+  int prefix_length = snprintf(buffer, kMaxMessageLength - 1, "%s: ",
+                               kProgName);
+  va_list argp;
+  va_start(argp, format);
+  int length = vsnprintf(buffer + prefix_length,
+                         kMaxMessageLength - 1 - prefix_length, format, argp);
+  va_end(argp);
+  size_t total_length = prefix_length + (length > 0 ? length : 0);
+  if (total_length > kMaxMessageLength - 2)
+    total_length = kMaxMessageLength - 2;
+  buffer[total_length++] = '\n';
+
+  if (slot) {
+    slot->length = total_length;
+    g_queue->Commit(slot, pos);
+    WakeWriterThread();
+  } else {
+    WriteToStderr(buffer, total_length);
+  }
+}
+
+uint64_t GetNumDroppedLogMessages() {
+  return g_queue ? g_queue->num_dropped() : 0;
+}
+
+LogRateLimiter::LogRateLimiter(int max_messages, double interval)
+    : max_messages_(max_messages),
+      interval_(interval),
+      interval_start_(-interval),
+      num_logged_(0),
+      num_suppressed_(0) {
+}
+
+bool LogRateLimiter::Allow(int* suppressed_out) {
+  assert(suppressed_out);
+  double now = GetMonotonicTime();
+  if (now - interval_start_ >= interval_) {
+    interval_start_ = now;
+    num_logged_ = 0;
+  }
+  if (num_logged_ >= max_messages_) {
+    num_suppressed_++;
+    return false;
+  }
+  num_logged_++;
+  *suppressed_out = num_suppressed_;
+  num_suppressed_ = 0;
+  return true;
+}
+
+}  // namespace xsettingsd
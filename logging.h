@@ -0,0 +1,88 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_LOGGING_H__
+#define __XSETTINGSD_LOGGING_H__
+
+#include <stdint.h>
+
+#include "common.h"
+
+namespace xsettingsd {
+
+enum LogSeverity {
+  LOG_SEVERITY_DEBUG = 0,
+  LOG_SEVERITY_INFO,
+  LOG_SEVERITY_WARNING,
+  LOG_SEVERITY_ERROR,
+};
+
+// Start a background thread that writes log messages to stderr.  Until
+// this is called (and after StopLogThread()), messages are written
+// synchronously.  While the thread is running, LogMessage() never blocks:
+// messages are copied into a fixed-size lock-free ring buffer, and
+// messages that don't fit are dropped and counted.
+bool StartLogThread();
+
+// Write any queued messages and stop the thread.  Other threads must not
+// log concurrently.
+void StopLogThread();
+
+// Messages less severe than 'severity' are discarded.  The default is
+// LOG_SEVERITY_INFO.
+void SetMinLogSeverity(LogSeverity severity);
+
+// Log a printf-style message, prefixed by kProgName.  A trailing newline is
+// added.  Long messages are truncated.
+void LogMessage(LogSeverity severity, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Returns the number of messages that have been dropped because the ring
+// buffer was full.
+uint64_t GetNumDroppedLogMessages();
+
+// Limits a call site to 'max_messages' messages per 'interval' seconds.
+// Not thread-safe; each instance should only be used by a single thread.
+class LogRateLimiter {
+ public:
+  LogRateLimiter(int max_messages, double interval);
+
+  // Returns true if a message should be logged now.  If so, the number of
+  // messages that were suppressed since the last one is saved to
+  // 'suppressed_out'.
+  bool Allow(int* suppressed_out);
+
+ private:
+  int max_messages_;
+  double interval_;
+
+  // Start of the current interval and the number of messages logged and
+  // suppressed in it.
+  double interval_start_;
+  int num_logged_;
+  int num_suppressed_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogRateLimiter);
+};
+
+}  // namespace xsettingsd
+
+// Log a message, e.g. LOG(ERROR, "Couldn't open %s", path).
+#define LOG(severity, ...) \
+  ::xsettingsd::LogMessage(::xsettingsd::LOG_SEVERITY_##severity, __VA_ARGS__)
+
+// Like LOG(), but limited to 10 messages per 10 seconds from each call site,
+// for messages that can be triggered by other clients.
+#define LOG_RATE_LIMITED(severity, ...)                                    \
+  do {                                                                     \
+    static ::xsettingsd::LogRateLimiter log_rate_limiter_(10, 10.0);       \
+    int log_suppressed_ = 0;                                               \
+    if (log_rate_limiter_.Allow(&log_suppressed_)) {                       \
+      if (log_suppressed_)                                                 \
+        LOG(severity, "Suppressed %d similar message%s", log_suppressed_,  \
+            log_suppressed_ == 1 ? "" : "s");                              \
+      LOG(severity, __VA_ARGS__);                                          \
+    }                                                                      \
+  } while (0)
+
+#endif
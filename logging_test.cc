@@ -0,0 +1,115 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "common.h"
+#include "logging.h"
+
+using std::string;
+
+namespace xsettingsd {
+
+// Redirects stderr to a temporary file while in scope.
+class ScopedStderrCapture {
+ public:
+  ScopedStderrCapture() : file_(tmpfile()), saved_fd_(dup(STDERR_FILENO)) {
+    fflush(stderr);
+    dup2(fileno(file_), STDERR_FILENO);
+  }
+  ~ScopedStderrCapture() {
+    Restore();
+    fclose(file_);
+  }
+
+  // Restore stderr and return everything that was written to it.
+  string Finish() {
+    Restore();
+    string output;
+    char buffer[4096];
+    rewind(file_);
+    size_t bytes_read = 0;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file_)) > 0)
+      output.append(buffer, bytes_read);
+    return output;
+  }
+
+ private:
+  void Restore() {
+    if (saved_fd_ >= 0) {
+      dup2(saved_fd_, STDERR_FILENO);
+      close(saved_fd_);
+      saved_fd_ = -1;
+    }
+  }
+
+  FILE* file_;
+  int saved_fd_;
+};
+
+TEST(LoggingTest, Synchronous) {
+  ScopedStderrCapture capture;
+  LOG(INFO, "Got %d", 5);
+  LOG(DEBUG, "Hidden");
+  SetMinLogSeverity(LOG_SEVERITY_DEBUG);
+  LOG(DEBUG, "Shown");
+  SetMinLogSeverity(LOG_SEVERITY_INFO);
+  EXPECT_EQ(StringPrintf("%s: Got 5\n%s: Shown\n", kProgName, kProgName),
+            capture.Finish());
+}
+
+TEST(LoggingTest, Thread) {
+  ScopedStderrCapture capture;
+  ASSERT_TRUE(StartLogThread());
+  string expected;
+  for (int i = 0; i < 100; ++i) {
+    LOG(INFO, "Message %d", i);
+    expected += StringPrintf("%s: Message %d\n", kProgName, i);
+  }
+  StopLogThread();
+  EXPECT_EQ(0, GetNumDroppedLogMessages());
+  EXPECT_EQ(expected, capture.Finish());
+
+  // Long messages should be truncated.
+  ScopedStderrCapture long_capture;
+  LOG(ERROR, "%s", string(4096, 'x').c_str());
+  string output = long_capture.Finish();
+  EXPECT_GT(output.size(), 100);
+  EXPECT_LT(output.size(), 1024);
+  EXPECT_EQ('\n', output[output.size() - 1]);
+}
+
+TEST(LoggingTest, RateLimiter) {
+  LogRateLimiter limiter(2, 1000.0);
+  int suppressed = -1;
+  EXPECT_TRUE(limiter.Allow(&suppressed));
+  EXPECT_EQ(0, suppressed);
+  EXPECT_TRUE(limiter.Allow(&suppressed));
+  EXPECT_FALSE(limiter.Allow(&suppressed));
+  EXPECT_FALSE(limiter.Allow(&suppressed));
+
+  // Once the interval has passed, the number of suppressed messages should
+  // be reported.
+  LogRateLimiter fast_limiter(1, 0.0);
+  EXPECT_TRUE(fast_limiter.Allow(&suppressed));
+  EXPECT_TRUE(fast_limiter.Allow(&suppressed));
+  EXPECT_EQ(0, suppressed);
+
+  ScopedStderrCapture capture;
+  for (int i = 0; i < 15; ++i)
+    LOG_RATE_LIMITED(INFO, "Repeated");
+  string output = capture.Finish();
+  EXPECT_EQ(10, std::count(output.begin(), output.end(), '\n'));
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
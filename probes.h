@@ -0,0 +1,48 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_PROBES_H__
+#define __XSETTINGSD_PROBES_H__
+
+// USDT (user-level statically-defined tracing) probes for tools such as
+// bpftrace, perf, and SystemTap, e.g.:
+//
+//   bpftrace -e 'usdt:./xsettingsd:xsettingsd:config_load_end
+//                { printf("serial %d: %d bytes\n", arg0, arg2); }'
+//
+// The probes are compiled in when <sys/sdt.h> (from SystemTap) is found at
+// build time and HAVE_SYS_SDT_H is defined.  Each one is a single no-op
+// instruction until a tracer attaches to it.  Without the header, the
+// macros expand to nothing and their arguments aren't evaluated.
+//
+// Probes and their arguments:
+//
+//   config_load_start(const char* path)
+//   config_load_end(uint32_t serial, size_t num_settings, size_t bytes)
+//   config_load_failed(const char* path)
+//   setting_parsed(const char* name, uint32_t serial)
+//   serialize_start(uint32_t serial, size_t num_settings)
+//   serialize_end(uint32_t serial, size_t bytes)
+//   set_property_start(Window win, uint32_t serial, size_t bytes)
+//   set_property_end(Window win, uint32_t serial, size_t bytes)
+//   selection_acquired(int screen, Window win)
+//   selection_lost(Window win)
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define XSETTINGSD_PROBE1(name, a) DTRACE_PROBE1(xsettingsd, name, a)
+#define XSETTINGSD_PROBE2(name, a, b) DTRACE_PROBE2(xsettingsd, name, a, b)
+#define XSETTINGSD_PROBE3(name, a, b, c) \
+  DTRACE_PROBE3(xsettingsd, name, a, b, c)
+
+#else
+
+#define XSETTINGSD_PROBE1(name, a) do {} while (0)
+#define XSETTINGSD_PROBE2(name, a, b) do {} while (0)
+#define XSETTINGSD_PROBE3(name, a, b, c) do {} while (0)
+
+#endif  // HAVE_SYS_SDT_H
+
+#endif
@@ -3,18 +3,53 @@
 
 #include "setting.h"
 
+#include <cstdio>
+
+#include "data_reader.h"
 #include "data_writer.h"
 
 using std::string;
 
 namespace xsettingsd {
 
+// Append 'value' to 'out' as a double-quoted string that ConfigParser can
+// read.
+static void AppendQuotedString(std::string_view value, string* out) {
+  out->push_back('"');
+  for (size_t i = 0; i < value.size(); ++i) {
+    char ch = value[i];
+    switch (ch) {
+      case '\n':
+        out->append("\\n");
+        break;
+      case '\t':
+        out->append("\\t");
+        break;
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      default:
+        out->push_back(ch);
+    }
+  }
+  out->push_back('"');
+}
+
 bool Setting::operator==(const Setting& other) const {
   if (other.type_ != type_)
     return false;
   return EqualsImpl(other);
 }
 
+Setting* Setting::Clone() const {
+  Setting* setting = CloneImpl();
+  setting->serial_ = serial_;
+  return setting;
+}
+
 bool Setting::Write(const string& name, DataWriter* writer) const {
   if (!writer->WriteInt8(type_))                       return false;
   if (!writer->WriteZeros(1))                          return false;
@@ -26,6 +61,77 @@ bool Setting::Write(const string& name, DataWriter* writer) const {
   return WriteBody(writer);
 }
 
+// static
+template <bool kReverseBytes>
+Setting* Setting::Read(BasicDataReader<kReverseBytes>* reader,
+                       string* name_out) {
+  SettingView view;
+  if (!ReadView(reader, &view))
+    return NULL;
+  if (name_out)
+    name_out->assign(view.name);
+  return FromView(view, NULL);
+}
+
+// static
+Setting* Setting::FromView(const SettingView& view,
+                           const std::shared_ptr<const void>& storage) {
+  Setting* setting = NULL;
+  switch (view.type) {
+    case TYPE_INTEGER:
+      setting = new IntegerSetting(view.int_value);
+      break;
+    case TYPE_STRING:
+      if (storage)
+        setting = new StringSetting(view.string_value, storage);
+      else
+        setting = new StringSetting(string(view.string_value));
+      break;
+    case TYPE_COLOR:
+      setting = new ColorSetting(view.red, view.green, view.blue, view.alpha);
+      break;
+  }
+  setting->serial_ = view.serial;
+  return setting;
+}
+
+// static
+template <bool kReverseBytes>
+bool Setting::ReadView(BasicDataReader<kReverseBytes>* reader,
+                       SettingView* view_out) {
+  int8_t type = 0;
+  uint16_t name_size = 0;
+  if (!reader->ReadInt8(&type))                                    return false;
+  if (!reader->ReadBytes(NULL, 1))                                 return false;
+  if (!reader->ReadInt16(reinterpret_cast<int16_t*>(&name_size)))  return false;
+  if (!reader->ReadView(&view_out->name, name_size))               return false;
+  if (!reader->ReadBytes(NULL, GetPadding(name_size, 4)))          return false;
+  if (!reader->ReadInt32(reinterpret_cast<int32_t*>(&view_out->serial)))
+    return false;
+
+  view_out->type = static_cast<Type>(type);
+  if (type == TYPE_INTEGER) {
+    return reader->ReadInt32(&view_out->int_value);
+  } else if (type == TYPE_STRING) {
+    uint32_t value_size = 0;
+    return reader->ReadInt32(reinterpret_cast<int32_t*>(&value_size)) &&
+           reader->ReadView(&view_out->string_value, value_size) &&
+           reader->ReadBytes(NULL, GetPadding(value_size, 4));
+  } else if (type == TYPE_COLOR) {
+    // Note that XSETTINGS uses RBG-order, not RGB.
+    return reader->ReadInt16(reinterpret_cast<int16_t*>(&view_out->red)) &&
+           reader->ReadInt16(reinterpret_cast<int16_t*>(&view_out->blue)) &&
+           reader->ReadInt16(reinterpret_cast<int16_t*>(&view_out->green)) &&
+           reader->ReadInt16(reinterpret_cast<int16_t*>(&view_out->alpha));
+  }
+  return false;
+}
+
+template Setting* Setting::Read(DataReader*, string*);
+template Setting* Setting::Read(ReversedDataReader*, string*);
+template bool Setting::ReadView(DataReader*, SettingView*);
+template bool Setting::ReadView(ReversedDataReader*, SettingView*);
+
 void Setting::UpdateSerial(const Setting* prev, uint32_t serial) {
   if (prev && operator==(*prev))
     serial_ = prev->serial_;
@@ -37,6 +143,14 @@ bool IntegerSetting::WriteBody(DataWriter* writer) const {
   return writer->WriteInt32(value_);
 }
 
+string IntegerSetting::FormatValue() const {
+  return StringPrintf("%d", value_);
+}
+
+Setting* IntegerSetting::CloneImpl() const {
+  return new IntegerSetting(value_);
+}
+
 bool IntegerSetting::EqualsImpl(const Setting& other) const {
   const IntegerSetting* cast_other =
       dynamic_cast<const IntegerSetting*>(&other);
@@ -52,6 +166,18 @@ bool StringSetting::WriteBody(DataWriter* writer) const {
   return true;
 }
 
+string StringSetting::FormatValue() const {
+  string formatted;
+  AppendQuotedString(value_, &formatted);
+  return formatted;
+}
+
+Setting* StringSetting::CloneImpl() const {
+  if (storage_)
+    return new StringSetting(value_, storage_);
+  return new StringSetting(owned_value_);
+}
+
 bool StringSetting::EqualsImpl(const Setting& other) const {
   const StringSetting* cast_other = dynamic_cast<const StringSetting*>(&other);
   if (!cast_other)
@@ -68,6 +194,14 @@ bool ColorSetting::WriteBody(DataWriter* writer) const {
   return true;
 }
 
+string ColorSetting::FormatValue() const {
+  return StringPrintf("(%u, %u, %u, %u)", red_, green_, blue_, alpha_);
+}
+
+Setting* ColorSetting::CloneImpl() const {
+  return new ColorSetting(red_, green_, blue_, alpha_);
+}
+
 bool ColorSetting::EqualsImpl(const Setting& other) const {
   const ColorSetting* cast_other = dynamic_cast<const ColorSetting*>(&other);
   if (!cast_other)
@@ -78,6 +212,24 @@ bool ColorSetting::EqualsImpl(const Setting& other) const {
           cast_other->alpha_ == alpha_);
 }
 
+void SettingView::AppendValue(string* out) const {
+  char buffer[64];
+  switch (type) {
+    case Setting::TYPE_INTEGER:
+      snprintf(buffer, sizeof(buffer), "%d", int_value);
+      out->append(buffer);
+      break;
+    case Setting::TYPE_STRING:
+      AppendQuotedString(string_value, out);
+      break;
+    case Setting::TYPE_COLOR:
+      snprintf(buffer, sizeof(buffer), "(%u, %u, %u, %u)",
+               red, green, blue, alpha);
+      out->append(buffer);
+      break;
+  }
+}
+
 SettingsMap::~SettingsMap() {
   for (Map::iterator it = map_.begin(); it != map_.end(); ++it) {
     delete it->second;
@@ -92,4 +244,18 @@ const Setting* SettingsMap::GetSetting(const std::string& name) const {
   return it->second;
 }
 
+ProfileMap::~ProfileMap() {
+  for (Map::iterator it = map_.begin(); it != map_.end(); ++it) {
+    delete it->second;
+  }
+  map_.clear();
+}
+
+const SettingsMap* ProfileMap::GetProfile(const std::string& name) const {
+  Map::const_iterator it = map_.find(name);
+  if (it == map_.end())
+    return NULL;
+  return it->second;
+}
+
 }  // namespace xsettingsd
@@ -5,8 +5,10 @@
 #define __XSETTINGSD_SETTING_H__
 
 #include <map>
+#include <memory>
 #include <stdint.h>
 #include <string>
+#include <string_view>
 
 #ifdef __TESTING
 #include <gtest/gtest_prod.h>
@@ -16,7 +18,10 @@
 
 namespace xsettingsd {
 
-class DataWriter;
+template <bool kReverseBytes> class BasicDataReader;
+template <bool kReverseBytes> class BasicDataWriter;
+typedef BasicDataWriter<false> DataWriter;
+struct SettingView;
 
 // Base class for settings.
 class Setting {
@@ -33,6 +38,7 @@ class Setting {
   }
   virtual ~Setting() {}
 
+  Type type() const { return type_; }
   uint32_t serial() const { return serial_; }
 
   bool operator==(const Setting& other) const;
@@ -41,15 +47,44 @@ class Setting {
   // described in the XSETTINGS spec.
   bool Write(const std::string& name, DataWriter* writer) const;
 
+  // Read a setting in the format written by Write(), saving its name to
+  // 'name_out'.  Returns a newly-allocated setting (which the caller is
+  // responsible for deleting) or NULL if the data is malformed.
+  template <bool kReverseBytes>
+  static Setting* Read(BasicDataReader<kReverseBytes>* reader,
+                       std::string* name_out);
+
+  // Like Read(), but decodes the setting into 'view_out' without copying
+  // its name or value out of the reader's buffer.
+  template <bool kReverseBytes>
+  static bool ReadView(BasicDataReader<kReverseBytes>* reader,
+                       SettingView* view_out);
+
+  // Create a setting from 'view', as decoded by ReadView().  String values
+  // are copied unless 'storage' is non-NULL, in which case they must point
+  // into it and are referred to directly.  Returns a newly-allocated
+  // setting.
+  static Setting* FromView(const SettingView& view,
+                           const std::shared_ptr<const void>& storage);
+
   // Update this setting's serial number based on the previous version of
   // the setting.  (If the setting changed, we use 'serial'; otherwise we
   // use the same serial as 'prev'.)
   void UpdateSerial(const Setting* prev, uint32_t serial);
 
+  // Format this setting's value using the config file syntax.
+  virtual std::string FormatValue() const = 0;
+
+  // Returns a newly-allocated copy of this setting, including its serial.
+  Setting* Clone() const;
+
  private:
   // Write type-specific data.
   virtual bool WriteBody(DataWriter* writer) const = 0;
 
+  // Create a new setting of the same type with the same value.
+  virtual Setting* CloneImpl() const = 0;
+
   // Cast 'other' to this setting's type and compare it.
   virtual bool EqualsImpl(const Setting& other) const = 0;
 
@@ -70,6 +105,8 @@ class IntegerSetting : public Setting {
 
   int32_t value() const { return value_; }
 
+  std::string FormatValue() const;
+
  private:
 #ifdef __TESTING
   friend class IntegerSettingTest;
@@ -77,6 +114,7 @@ class IntegerSetting : public Setting {
 #endif
 
   bool WriteBody(DataWriter* writer) const;
+  Setting* CloneImpl() const;
   bool EqualsImpl(const Setting& other) const;
 
   int32_t value_;
@@ -88,16 +126,36 @@ class StringSetting : public Setting {
  public:
   explicit StringSetting(const std::string& value)
       : Setting(TYPE_STRING),
+        owned_value_(value),
+        value_(owned_value_) {
+  }
+
+  // Refer to 'value' (which must point into 'storage') instead of copying
+  // it.  'storage' is kept alive for as long as the setting is.
+  StringSetting(std::string_view value,
+                const std::shared_ptr<const void>& storage)
+      : Setting(TYPE_STRING),
+        storage_(storage),
         value_(value) {
   }
 
-  const std::string& value() const { return value_; }
+  std::string_view value() const { return value_; }
+
+  std::string FormatValue() const;
 
  private:
   bool WriteBody(DataWriter* writer) const;
+  Setting* CloneImpl() const;
   bool EqualsImpl(const Setting& other) const;
 
-  std::string value_;
+  // The value, if it was copied.
+  std::string owned_value_;
+
+  // Buffer containing the value, if it wasn't copied.
+  std::shared_ptr<const void> storage_;
+
+  // Points into either 'owned_value_' or 'storage_'.
+  std::string_view value_;
 
   DISALLOW_COPY_AND_ASSIGN(StringSetting);
 };
@@ -120,8 +178,11 @@ class ColorSetting : public Setting {
   uint16_t blue() const { return blue_; }
   uint16_t alpha() const { return alpha_; }
 
+  std::string FormatValue() const;
+
  private:
   bool WriteBody(DataWriter* writer) const;
+  Setting* CloneImpl() const;
   bool EqualsImpl(const Setting& other) const;
 
   uint16_t red_;
@@ -132,6 +193,32 @@ class ColorSetting : public Setting {
   DISALLOW_COPY_AND_ASSIGN(ColorSetting);
 };
 
+// A setting as it appears in a serialized property.  The name and string
+// value point into the buffer that the setting was read from.
+struct SettingView {
+  SettingView()
+      : type(Setting::TYPE_INTEGER),
+        serial(0),
+        int_value(0),
+        red(0),
+        green(0),
+        blue(0),
+        alpha(0) {
+  }
+
+  // Append the value to 'out' using the config file syntax.
+  void AppendValue(std::string* out) const;
+
+  Setting::Type type;
+  std::string_view name;
+  uint32_t serial;
+
+  // Only the fields corresponding to 'type' are set.
+  int32_t int_value;
+  std::string_view string_value;
+  uint16_t red, green, blue, alpha;
+};
+
 // A simple wrapper around a string-to-Setting map.
 // Handles deleting the Setting objects in its d'tor.
 class SettingsMap {
@@ -154,6 +241,28 @@ class SettingsMap {
   DISALLOW_COPY_AND_ASSIGN(SettingsMap);
 };
 
+// A map from profile names to the settings in each profile.
+// Handles deleting the SettingsMap objects in its d'tor.
+class ProfileMap {
+ public:
+  ProfileMap() {}
+  ~ProfileMap();
+
+  typedef std::map<std::string, SettingsMap*> Map;
+  const Map& map() const { return map_; }
+  Map* mutable_map() { return &map_; }
+
+  void swap(ProfileMap* other) { map_.swap(other->map_); }
+
+  // Get a pointer to a profile's settings or NULL if it doesn't exist.
+  const SettingsMap* GetProfile(const std::string& name) const;
+
+ private:
+  Map map_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProfileMap);
+};
+
 }  // namespace xsettingsd
 
 #endif
@@ -6,6 +6,8 @@
 
 #include <gtest/gtest.h>
 
+#include "allocation_counter.h"
+#include "data_reader.h"
 #include "data_writer.h"
 #include "setting.h"
 
@@ -114,6 +116,144 @@ TEST(ColorSettingTest, Write) {
   EXPECT_PRED_FORMAT3(BytesAreEqual, expected, buffer, sizeof(expected));
 }
 
+TEST(SettingTest, Read) {
+  static const int kBufSize = 1024;
+  char buffer[kBufSize];
+
+  DataWriter writer(buffer, kBufSize);
+  IntegerSetting int_setting(-5);
+  int_setting.UpdateSerial(NULL, 3);
+  ASSERT_TRUE(int_setting.Write("int", &writer));
+  StringSetting string_setting("testing");
+  string_setting.UpdateSerial(NULL, 4);
+  ASSERT_TRUE(string_setting.Write("Net/String", &writer));
+  ColorSetting color_setting(32768, 65535, 0, 255);
+  color_setting.UpdateSerial(NULL, 5);
+  ASSERT_TRUE(color_setting.Write("color", &writer));
+
+  DataReader reader(buffer, writer.bytes_written());
+  string name;
+  Setting* setting = Setting::Read(&reader, &name);
+  ASSERT_TRUE(setting != NULL);
+  EXPECT_EQ("int", name);
+  EXPECT_TRUE(*setting == int_setting);
+  EXPECT_EQ(3, setting->serial());
+  delete setting;
+
+  setting = Setting::Read(&reader, &name);
+  ASSERT_TRUE(setting != NULL);
+  EXPECT_EQ("Net/String", name);
+  EXPECT_TRUE(*setting == string_setting);
+  EXPECT_EQ(4, setting->serial());
+  delete setting;
+
+  setting = Setting::Read(&reader, &name);
+  ASSERT_TRUE(setting != NULL);
+  EXPECT_EQ("color", name);
+  EXPECT_TRUE(*setting == color_setting);
+  EXPECT_EQ(5, setting->serial());
+  delete setting;
+
+  EXPECT_EQ(writer.bytes_written(), reader.bytes_read());
+  EXPECT_TRUE(Setting::Read(&reader, &name) == NULL);
+
+  // Truncated data should be rejected.
+  DataReader truncated_reader(buffer, 10);
+  EXPECT_TRUE(Setting::Read(&truncated_reader, &name) == NULL);
+}
+
+TEST(SettingTest, ReadView) {
+  static const int kBufSize = 1024;
+  char buffer[kBufSize];
+
+  DataWriter writer(buffer, kBufSize);
+  IntegerSetting int_setting(-5);
+  int_setting.UpdateSerial(NULL, 3);
+  ASSERT_TRUE(int_setting.Write("int", &writer));
+  StringSetting string_setting("a \"quoted\"\nstring");
+  string_setting.UpdateSerial(NULL, 4);
+  ASSERT_TRUE(string_setting.Write("Net/String", &writer));
+  ColorSetting color_setting(32768, 65535, 0, 255);
+  color_setting.UpdateSerial(NULL, 5);
+  ASSERT_TRUE(color_setting.Write("color", &writer));
+
+  // Views should point directly into the buffer and format their values
+  // the same way as the corresponding settings.
+  DataReader reader(buffer, writer.bytes_written());
+  SettingView view;
+  string value;
+  ASSERT_TRUE(Setting::ReadView(&reader, &view));
+  EXPECT_EQ("int", view.name);
+  EXPECT_EQ(Setting::TYPE_INTEGER, view.type);
+  EXPECT_EQ(3, view.serial);
+  EXPECT_EQ(-5, view.int_value);
+  view.AppendValue(&value);
+  EXPECT_EQ(int_setting.FormatValue(), value);
+
+  ASSERT_TRUE(Setting::ReadView(&reader, &view));
+  EXPECT_EQ("Net/String", view.name);
+  EXPECT_TRUE(view.name.data() >= buffer &&
+              view.name.data() < buffer + writer.bytes_written());
+  EXPECT_EQ(Setting::TYPE_STRING, view.type);
+  EXPECT_EQ(4, view.serial);
+  EXPECT_EQ("a \"quoted\"\nstring", view.string_value);
+  value.clear();
+  view.AppendValue(&value);
+  EXPECT_EQ(string_setting.FormatValue(), value);
+
+  ASSERT_TRUE(Setting::ReadView(&reader, &view));
+  EXPECT_EQ("color", view.name);
+  EXPECT_EQ(Setting::TYPE_COLOR, view.type);
+  EXPECT_EQ(5, view.serial);
+  value.clear();
+  view.AppendValue(&value);
+  EXPECT_EQ(color_setting.FormatValue(), value);
+
+  EXPECT_EQ(writer.bytes_written(), reader.bytes_read());
+  EXPECT_FALSE(Setting::ReadView(&reader, &view));
+}
+
+TEST(SettingTest, SerializationAllocations) {
+  SettingsMap settings;
+  for (int i = 0; i < 100; ++i) {
+    string name = StringPrintf("Setting/%d", i);
+    Setting* setting = NULL;
+    if (i % 3 == 0)
+      setting = new IntegerSetting(i);
+    else if (i % 3 == 1)
+      setting = new StringSetting(name + " value");
+    else
+      setting = new ColorSetting(i, i, i, i);
+    setting->UpdateSerial(NULL, 1);
+    (*settings.mutable_map())[name] = setting;
+  }
+
+  static const int kBufSize = 8192;
+  char buffer[kBufSize];
+
+  // Writing settings into a property and reading them back out as views
+  // shouldn't touch the heap at all.
+  ScopedAllocationCounter counter;
+  DataWriter writer(buffer, kBufSize);
+  for (SettingsMap::Map::const_iterator it = settings.map().begin();
+       it != settings.map().end(); ++it) {
+    ASSERT_TRUE(it->second->Write(it->first, &writer));
+  }
+  DataReader reader(buffer, writer.bytes_written());
+  SettingView view;
+  size_t num_views = 0;
+  while (Setting::ReadView(&reader, &view))
+    num_views++;
+  EXPECT_EQ(settings.map().size(), num_views);
+
+  // Neither should carrying serials over from the previous generation.
+  for (SettingsMap::Map::iterator it = settings.mutable_map()->begin();
+       it != settings.mutable_map()->end(); ++it) {
+    it->second->UpdateSerial(it->second, 2);
+  }
+  EXPECT_EQ(0, counter.count());
+}
+
 TEST(SettingTest, Serials) {
   // Create a setting and give it a serial of 3.
   IntegerSetting setting(4);
@@ -0,0 +1,108 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include "settings_cache.h"
+
+#include "data_reader.h"
+
+using std::string_view;
+
+namespace xsettingsd {
+
+SettingsCache::SettingsCache(Observer* observer)
+    : observer_(observer),
+      serial_(0),
+      generation_(0),
+      num_decoded_(0),
+      num_skipped_(0) {
+}
+
+SettingsCache::~SettingsCache() {
+  for (EntryMap::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+    delete it->second->setting;
+    delete it->second;
+  }
+}
+
+const Setting* SettingsCache::GetSetting(string_view name) const {
+  EntryMap::const_iterator it = entries_.find(name);
+  return (it != entries_.end()) ? it->second->setting : NULL;
+}
+
+bool SettingsCache::Update(const char* data, size_t size) {
+  // Find all of the records before touching the cache so that malformed
+  // data leaves it alone.
+  uint32_t serial = 0;
+  views_.clear();
+  const bool read_ok = ReadProperty(data, size, [&](auto* reader) {
+    int32_t num_settings = 0;
+    if (!reader->ReadBytes(NULL, 4) ||
+        !reader->ReadInt32(reinterpret_cast<int32_t*>(&serial)) ||
+        !reader->ReadInt32(&num_settings) ||
+        num_settings < 0) {
+      return false;
+    }
+    for (int32_t i = 0; i < num_settings; ++i) {
+      views_.push_back(SettingView());
+      if (!Setting::ReadView(reader, &views_.back()))
+        return false;
+    }
+    return true;
+  });
+  if (!read_ok)
+    return false;
+
+  serial_ = serial;
+  generation_++;
+  changed_.clear();
+  for (size_t i = 0; i < views_.size(); ++i) {
+    const SettingView& view = views_[i];
+    EntryMap::iterator it = entries_.find(view.name);
+    Entry* entry = NULL;
+    if (it == entries_.end()) {
+      entry = new Entry;
+      entry->name.assign(view.name);
+      entry->setting = Setting::FromView(view, NULL);
+      entries_.insert(std::make_pair(string_view(entry->name), entry));
+    } else {
+      entry = it->second;
+      if (entry->setting->serial() == view.serial &&
+          entry->setting->type() == view.type) {
+        entry->generation = generation_;
+        num_skipped_++;
+        continue;
+      }
+      delete entry->setting;
+      entry->setting = Setting::FromView(view, NULL);
+    }
+    entry->generation = generation_;
+    num_decoded_++;
+    changed_.push_back(entry);
+  }
+
+  // Anything that wasn't in the property has been removed.
+  removed_.clear();
+  for (EntryMap::iterator it = entries_.begin(); it != entries_.end(); ) {
+    if (it->second->generation != generation_) {
+      removed_.push_back(it->second);
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  if (observer_) {
+    for (size_t i = 0; i < changed_.size(); ++i)
+      observer_->OnSettingChanged(changed_[i]->name, changed_[i]->setting);
+    for (size_t i = 0; i < removed_.size(); ++i)
+      observer_->OnSettingChanged(removed_[i]->name, NULL);
+  }
+  for (size_t i = 0; i < removed_.size(); ++i) {
+    delete removed_[i]->setting;
+    delete removed_[i];
+  }
+  removed_.clear();
+  return true;
+}
+
+}  // namespace xsettingsd
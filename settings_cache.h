@@ -0,0 +1,96 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_SETTINGS_CACHE_H__
+#define __XSETTINGSD_SETTINGS_CACHE_H__
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+#include "setting.h"
+
+namespace xsettingsd {
+
+// SettingsCache is the client side of the XSETTINGS protocol: it holds the
+// settings decoded from the most recent copy of the _XSETTINGS_SETTINGS
+// property that it was given.  It doesn't talk to the X server itself, so
+// it can be dropped into any client's event loop.
+//
+// Each setting's record carries the serial of the publish that last changed
+// it, so records whose serial matches the cached setting's are skipped
+// without being decoded.  Only the settings that actually changed are
+// reported to the observer.
+class SettingsCache {
+ public:
+  class Observer {
+   public:
+    virtual ~Observer() {}
+
+    // Called after Update() for each setting that was added or changed,
+    // and with a NULL setting for each one that was removed.  The cache
+    // has already been updated, and 'setting' is owned by it.
+    virtual void OnSettingChanged(const std::string& name,
+                                  const Setting* setting) = 0;
+  };
+
+  // 'observer' may be NULL and is not owned.
+  explicit SettingsCache(Observer* observer);
+  ~SettingsCache();
+
+  // Serial from the header of the last property passed to Update().
+  uint32_t serial() const { return serial_; }
+
+  // Number of settings in the cache.
+  size_t size() const { return entries_.size(); }
+
+  // Number of records that Update() has decoded and skipped.
+  uint64_t num_decoded() const { return num_decoded_; }
+  uint64_t num_skipped() const { return num_skipped_; }
+
+  // Get a setting, or NULL if it isn't set.  Runs in constant time.
+  const Setting* GetSetting(std::string_view name) const;
+
+  // Update the cache from the contents of the settings property.  If the
+  // data is malformed, false is returned and the cache is left unchanged.
+  bool Update(const char* data, size_t size);
+
+ private:
+  struct Entry {
+    std::string name;
+    Setting* setting;  // owned
+
+    // Value of 'generation_' when the setting was last seen.
+    uint64_t generation;
+  };
+
+  // Entries are keyed by views of their own names.
+  typedef std::unordered_map<std::string_view, Entry*> EntryMap;
+
+  Observer* observer_;  // not owned
+
+  EntryMap entries_;
+
+  uint32_t serial_;
+
+  // Incremented by each call to Update().
+  uint64_t generation_;
+
+  uint64_t num_decoded_;
+  uint64_t num_skipped_;
+
+  // Scratch space reused by Update(): the records in the property, and the
+  // entries that changed or were removed.
+  std::vector<SettingView> views_;
+  std::vector<const Entry*> changed_;
+  std::vector<Entry*> removed_;
+
+  DISALLOW_COPY_AND_ASSIGN(SettingsCache);
+};
+
+}  // namespace xsettingsd
+
+#endif
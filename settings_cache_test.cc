@@ -0,0 +1,134 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <map>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "data_writer.h"
+#include "setting.h"
+#include "settings_cache.h"
+
+using std::map;
+using std::string;
+
+namespace xsettingsd {
+
+// Records the changes that it's told about, in the config file syntax.
+class TestObserver : public SettingsCache::Observer {
+ public:
+  void OnSettingChanged(const string& name, const Setting* setting) {
+    changes_[name] = setting ? setting->FormatValue() : "removed";
+  }
+
+  // Get the changes reported since the last call as "NAME=VALUE" pairs.
+  string TakeChanges() {
+    string output;
+    for (map<string, string>::const_iterator it = changes_.begin();
+         it != changes_.end(); ++it) {
+      output += (output.empty() ? "" : " ") + it->first + "=" + it->second;
+    }
+    changes_.clear();
+    return output;
+  }
+
+ private:
+  map<string, string> changes_;
+};
+
+// Serialize 'settings' into a property with serial 'serial'.
+static string BuildProperty(uint32_t serial, const SettingsMap& settings) {
+  char buffer[1024];
+  DataWriter writer(buffer, sizeof(buffer));
+  EXPECT_TRUE(writer.WriteInt8(IsLittleEndian() ? 0 : 1));
+  EXPECT_TRUE(writer.WriteZeros(3));
+  EXPECT_TRUE(writer.WriteInt32(serial));
+  EXPECT_TRUE(writer.WriteInt32(settings.map().size()));
+  for (SettingsMap::Map::const_iterator it = settings.map().begin();
+       it != settings.map().end(); ++it) {
+    EXPECT_TRUE(it->second->Write(it->first, &writer));
+  }
+  return string(buffer, writer.bytes_written());
+}
+
+// Add a setting with serial 'serial' to 'settings'.
+static void AddSetting(SettingsMap* settings,
+                       const string& name,
+                       Setting* setting,
+                       uint32_t serial) {
+  setting->UpdateSerial(NULL, serial);
+  Setting*& existing = (*settings->mutable_map())[name];
+  delete existing;
+  existing = setting;
+}
+
+TEST(SettingsCacheTest, Update) {
+  TestObserver observer;
+  SettingsCache cache(&observer);
+  SettingsMap settings;
+  AddSetting(&settings, "Net/ThemeName", new StringSetting("Adwaita"), 1);
+  AddSetting(&settings, "Xft/DPI", new IntegerSetting(98304), 1);
+  AddSetting(&settings, "Gtk/ColorBg", new ColorSetting(1, 2, 3, 4), 1);
+  string property = BuildProperty(1, settings);
+  ASSERT_TRUE(cache.Update(property.data(), property.size()));
+  EXPECT_EQ(1U, cache.serial());
+  EXPECT_EQ(3U, cache.size());
+  EXPECT_EQ(3U, cache.num_decoded());
+  EXPECT_EQ("Gtk/ColorBg=(1, 2, 3, 4) Net/ThemeName=\"Adwaita\" "
+            "Xft/DPI=98304", observer.TakeChanges());
+  ASSERT_TRUE(cache.GetSetting("Net/ThemeName") != NULL);
+  EXPECT_EQ("\"Adwaita\"", cache.GetSetting("Net/ThemeName")->FormatValue());
+  EXPECT_TRUE(cache.GetSetting("Net/IconThemeName") == NULL);
+
+  // Only records with new serials are decoded and reported.
+  AddSetting(&settings, "Xft/DPI", new IntegerSetting(196608), 2);
+  AddSetting(&settings, "Xft/Hinting", new IntegerSetting(1), 2);
+  delete (*settings.mutable_map())["Gtk/ColorBg"];
+  settings.mutable_map()->erase("Gtk/ColorBg");
+  property = BuildProperty(2, settings);
+  ASSERT_TRUE(cache.Update(property.data(), property.size()));
+  EXPECT_EQ(2U, cache.serial());
+  EXPECT_EQ(3U, cache.size());
+  EXPECT_EQ(5U, cache.num_decoded());
+  EXPECT_EQ(1U, cache.num_skipped());
+  EXPECT_EQ("Gtk/ColorBg=removed Xft/DPI=196608 Xft/Hinting=1",
+            observer.TakeChanges());
+  EXPECT_EQ("196608", cache.GetSetting("Xft/DPI")->FormatValue());
+  EXPECT_TRUE(cache.GetSetting("Gtk/ColorBg") == NULL);
+
+  // Republishing the same settings doesn't report anything.
+  property = BuildProperty(3, settings);
+  ASSERT_TRUE(cache.Update(property.data(), property.size()));
+  EXPECT_EQ(3U, cache.serial());
+  EXPECT_EQ(5U, cache.num_decoded());
+  EXPECT_EQ(4U, cache.num_skipped());
+  EXPECT_EQ("", observer.TakeChanges());
+}
+
+TEST(SettingsCacheTest, Malformed) {
+  TestObserver observer;
+  SettingsCache cache(&observer);
+  SettingsMap settings;
+  AddSetting(&settings, "Net/ThemeName", new StringSetting("Adwaita"), 1);
+  const string property = BuildProperty(1, settings);
+  ASSERT_TRUE(cache.Update(property.data(), property.size()));
+  observer.TakeChanges();
+
+  // Truncated data leaves the cache alone.
+  AddSetting(&settings, "Net/ThemeName", new StringSetting("Adwaita-dark"),
+             2);
+  const string truncated = BuildProperty(2, settings);
+  EXPECT_FALSE(cache.Update(truncated.data(), truncated.size() - 1));
+  EXPECT_FALSE(cache.Update(truncated.data(), 0));
+  EXPECT_EQ(1U, cache.serial());
+  EXPECT_EQ("\"Adwaita\"", cache.GetSetting("Net/ThemeName")->FormatValue());
+  EXPECT_EQ("", observer.TakeChanges());
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -5,18 +5,30 @@
 
 #include <cassert>
 #include <cerrno>
+#include <csignal>
 #include <cstdio>
 #include <cstring>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <X11/Xatom.h>
 #include <X11/Xutil.h>
+#ifdef HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
 
+#include "config_loader.h"
 #include "config_parser.h"
+#include "data_reader.h"
 #include "data_writer.h"
+#include "logging.h"
+#include "probes.h"
 #include "setting.h"
+#include "sha256.h"
+#include "snapshot.h"
+#include "stats.h"
 
 using std::make_pair;
 using std::map;
@@ -29,14 +41,106 @@ namespace xsettingsd {
 // Arbitrarily big number.
 static const int kMaxPropertySize = (2 << 15);
 
+// Offset of the serial in the property's header, following the byte-order
+// byte and three bytes of padding.
+static const size_t kPropertySerialOffset = 4;
+
+// Size of the property's header: the byte order, padding, serial, and
+// number of settings.
+static const size_t kPropertyHeaderSize = 12;
+
+// How long to wait after a screen change for others to arrive before
+// recomputing the derived settings.  RandR sends a burst of events when
+// outputs are reconfigured.
+static const double kScreenChangeDelaySec = 0.05;
+
+// How long to wait after the stats change before writing them to the stats
+// file, so that bursts of changes only write it once.
+static const double kStatsWriteDelaySec = 1.0;
+
+// Resolution that isn't scaled, and the resolution at and above which
+// windows are scaled by an integer factor.
+static const int kBaseDpi = 96;
+static const int kHiDpiThreshold = 2 * kBaseDpi;
+
+// Set by HandleSignal() and checked by RunEventLoop().
+static volatile sig_atomic_t g_reload_requested = 0;
+static volatile sig_atomic_t g_profile_switch_requested = 0;
+static volatile sig_atomic_t g_rollback_requested = 0;
+
+static void HandleSignal(int signum) {
+  if (signum == SIGHUP)
+    g_reload_requested = 1;
+  else if (signum == SIGUSR1)
+    g_profile_switch_requested = 1;
+  else if (signum == SIGUSR2)
+    g_rollback_requested = 1;
+}
+
+const size_t SettingsManager::kDefaultHistorySize = 8;
+
+// Decode a property in the format written by SettingsManager::WriteProperty()
+// into 'settings_out' and 'serial_out'.
+static bool DecodeProperty(const string& data,
+                           SettingsMap* settings_out,
+                           uint32_t* serial_out) {
+  assert(settings_out);
+  assert(serial_out);
+  return ReadProperty(data.data(), data.size(), [&](auto* reader) {
+    int32_t serial = 0, num_settings = 0;
+    if (!reader->ReadBytes(NULL, 4) ||
+        !reader->ReadInt32(&serial) ||
+        !reader->ReadInt32(&num_settings) ||
+        num_settings < 0) {
+      return false;
+    }
+    for (int32_t i = 0; i < num_settings; ++i) {
+      string name;
+      Setting* setting = Setting::Read(reader, &name);
+      if (!setting)
+        return false;
+      if (!settings_out->mutable_map()->insert(
+              make_pair(name, setting)).second) {
+        delete setting;
+        return false;
+      }
+    }
+    *serial_out = serial;
+    return true;
+  });
+}
+
 SettingsManager::SettingsManager(const string& config_filename)
-    : config_filename_(config_filename),
+    : loader_(config_filename),
+      active_profile_(kDefaultProfileName),
       serial_(0),
+      last_serial_(0),
       display_(NULL),
-      prop_atom_(None) {
+      prop_atom_(None),
+      publish_digest_(false),
+      digest_atom_(None),
+      screen_(0),
+      randr_event_base_(-1),
+      screen_change_deadline_(0),
+      publish_delay_(0),
+      min_publish_interval_(0),
+      last_publish_time_(0),
+      publish_deadline_(0),
+      history_size_(kDefaultHistorySize),
+      control_server_(NULL),
+      snapshot_writer_(NULL),
+      stats_deadline_(0) {
 }
 
 SettingsManager::~SettingsManager() {
+  WriteStatsIfDue(stats_deadline_);
+  for (size_t i = 0; i < history_.size(); ++i)
+    delete history_[i];
+  history_.clear();
+  delete control_server_;
+  control_server_ = NULL;
+  delete snapshot_writer_;
+  snapshot_writer_ = NULL;
   if (display_) {
     if (!windows_.empty())
       DestroyWindows();
@@ -45,20 +149,207 @@ SettingsManager::~SettingsManager() {
   }
 }
 
+// static
+void SettingsManager::InstallSignalHandlers() {
+  signal(SIGHUP, HandleSignal);
+  signal(SIGUSR1, HandleSignal);
+  signal(SIGUSR2, HandleSignal);
+}
+
+void SettingsManager::SetDefaultsFilename(const string& path) {
+  assert(!loaded_config_);
+  loader_.set_defaults_filename(path);
+}
+
+bool SettingsManager::InitState(const string& path) {
+  assert(settings_.map().empty());
+  state_path_ = path;
+
+  string data;
+  if (!ReadFile(path, &data)) {
+    if (errno == ENOENT)
+      return true;
+    LOG(ERROR, "Unable to read %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  // The settings that we published last time become the previous version of
+  // the default profile, so that unchanged settings keep their serials.
+  SettingsMap settings;
+  uint32_t serial = 0;
+  if (!DecodeProperty(data, &settings, &serial)) {
+    LOG(WARNING, "Ignoring malformed state file %s", path.c_str());
+    return true;
+  }
+  settings_.swap(&settings);
+  serial_ = serial;
+  LOG(INFO, "Restored %zu setting%s with serial %u from %s",
+      settings_.map().size(), (settings_.map().size() == 1) ? "" : "s",
+      serial_, path.c_str());
+  return true;
+}
+
 bool SettingsManager::LoadConfig() {
-  ConfigParser parser(new ConfigParser::FileCharStream(config_filename_));
-  SettingsMap new_settings;
-  if (!parser.Parse(&new_settings, &settings_, serial_ + 1)) {
-    fprintf(stderr, "%s: Unable to parse %s: %s\n",
-            kProgName, config_filename_.c_str(), parser.FormatError().c_str());
+  XSETTINGSD_PROBE1(config_load_start, loader_.config_filename().c_str());
+  return ApplyConfig(loader_.Load(loaded_defaults_, loaded_config_));
+}
+
+bool SettingsManager::ApplyConfig(ConfigGeneration* gen) {
+  assert(gen);
+  std::unique_ptr<ConfigGeneration> gen_deleter(gen);
+  stats_.AddTiming(Stats::STAGE_READ, gen->read_time);
+  if (gen->defaults_parsed || gen->config_parsed)
+    stats_.AddTiming(Stats::STAGE_PARSE, gen->parse_time);
+  if (!gen->ok) {
+    stats_.Increment(Stats::COUNTER_RELOAD_FAILURES, 1);
+    XSETTINGSD_PROBE1(config_load_failed, loader_.config_filename().c_str());
     return false;
   }
-  serial_++;
-  fprintf(stderr, "%s: Loaded %zu setting%s from %s\n",
-          kProgName, new_settings.map().size(),
-          (new_settings.map().size() == 1) ? "" : "s",
-          config_filename_.c_str());
-  settings_.swap(&new_settings);
+  stats_.Increment(Stats::COUNTER_RELOADS, 1);
+
+  // If neither file changed and nothing has been changed at runtime since
+  // they were loaded, merging them again would just produce the same
+  // settings.
+  if (!gen->defaults_parsed && !gen->config_parsed &&
+      runtime_layer_.map().empty()) {
+    stats_.Increment(Stats::COUNTER_RELOADS_SKIPPED, 1);
+    LOG(DEBUG, "%s is unchanged", loader_.config_filename().c_str());
+    XSETTINGSD_PROBE3(config_load_end, serial_, settings_.map().size(),
+                      loaded_config_->size());
+    return true;
+  }
+
+  // Collect the names of the settings that may have changed, and swap in the
+  // new layers.  Runtime changes only last until the next reload.
+  NameSet names;
+  {
+    Stats::ScopedTimer timer(&stats_, Stats::STAGE_DIFF);
+    if (gen->defaults_parsed) {
+      AddChangedNames(default_layer_, gen->defaults, &names);
+      default_layer_.swap(&gen->defaults);
+      loaded_defaults_ = gen->defaults_text;
+    }
+    if (gen->config_parsed) {
+      const SettingsMap empty;
+      for (ProfileMap::Map::const_iterator it = config_layer_.map().begin();
+           it != config_layer_.map().end(); ++it) {
+        const SettingsMap* settings = gen->config.GetProfile(it->first);
+        AddChangedNames(*it->second, settings ? *settings : empty, &names);
+      }
+      for (ProfileMap::Map::const_iterator it = gen->config.map().begin();
+           it != gen->config.map().end(); ++it) {
+        if (!config_layer_.GetProfile(it->first))
+          AddChangedNames(empty, *it->second, &names);
+      }
+      config_layer_.swap(&gen->config);
+      loaded_config_ = gen->config_text;
+    }
+    for (SettingsMap::Map::const_iterator it = runtime_layer_.map().begin();
+         it != runtime_layer_.map().end(); ++it) {
+      names.insert(it->first);
+    }
+    SettingsMap().swap(&runtime_layer_);
+  }
+
+  // If the active profile is gone, fall back to the default one.  Its
+  // settings are diffed against the old profile's in full below.
+  SettingsMap prev_settings;
+  bool switched = false;
+  if (!config_layer_.GetProfile(active_profile_)) {
+    LOG(WARNING, "Profile \"%s\" is gone; switching to \"%s\"",
+        active_profile_.c_str(), kDefaultProfileName);
+    prev_settings.swap(&settings_);
+    active_profile_ = kDefaultProfileName;
+    ProfileMap::Map::iterator it =
+        profiles_.mutable_map()->find(active_profile_);
+    if (it != profiles_.mutable_map()->end())
+      settings_.swap(it->second);
+    switched = true;
+  }
+
+  // Drop the merged settings of profiles that no longer exist.
+  for (ProfileMap::Map::iterator it = profiles_.mutable_map()->begin();
+       it != profiles_.mutable_map()->end(); ) {
+    if (config_layer_.GetProfile(it->first)) {
+      ++it;
+      continue;
+    }
+    properties_.erase(it->first);
+    delete it->second;
+    profiles_.mutable_map()->erase(it++);
+  }
+
+  // Merge the changed settings into each profile, starting with the default
+  // one so that the others can share its serials.  Each profile's own values
+  // get a serial of their own, so that switching profiles changes the
+  // serials of exactly the settings whose values differ.  Profiles that are
+  // new need all of their settings merged.
+  ControlServer::ChangeMap changes;
+  SettingsMap replaced;
+  vector<string> profile_names;
+  profile_names.push_back(kDefaultProfileName);
+  for (ProfileMap::Map::const_iterator it = config_layer_.map().begin();
+       it != config_layer_.map().end(); ++it) {
+    if (it->first != kDefaultProfileName)
+      profile_names.push_back(it->first);
+  }
+  const uint32_t first_serial = NextSerial();
+  const uint32_t last_serial = first_serial + profile_names.size() - 1;
+  bool merged_any = false;
+  for (size_t i = 0; i < profile_names.size(); ++i) {
+    const string& name = profile_names[i];
+    const bool is_active = (name == active_profile_);
+    const bool is_new = !profiles_.GetProfile(name);
+    if (is_new)
+      profiles_.mutable_map()->insert(make_pair(name, new SettingsMap));
+    SettingsMap* merged = GetMutableProfileSettings(name);
+
+    NameSet all_names;
+    if (is_new) {
+      // Keep whatever InitState() restored in 'settings_' so that unchanged
+      // settings keep their serials, but merge every name it contains so
+      // that stale ones are removed.
+      const SettingsMap* layers[] = {
+        &default_layer_, &derived_layer_, config_layer_.GetProfile(name),
+        merged,
+      };
+      for (size_t j = 0; j < sizeof(layers) / sizeof(layers[0]); ++j) {
+        for (SettingsMap::Map::const_iterator it = layers[j]->map().begin();
+             it != layers[j]->map().end(); ++it) {
+          all_names.insert(it->first);
+        }
+      }
+    }
+    const bool track = is_active && !switched;
+    if (MergeSettings(name, is_new ? all_names : names, first_serial + i,
+                      merged, track ? &changes : NULL,
+                      track ? &replaced : NULL) > 0 || is_new) {
+      properties_[name].clear();
+      merged_any = true;
+    }
+  }
+  // Inactive profiles' settings may have been given serials even if nothing
+  // is published now, so those serials mustn't be handed out again.
+  if (merged_any)
+    last_serial_ = last_serial;
+  SerializeProfiles();
+
+  if (switched) {
+    Stats::ScopedTimer timer(&stats_, Stats::STAGE_DIFF);
+    GetChanges(prev_settings, &changes);
+  }
+  if (changes.empty()) {
+    // Nothing changed, so there's no need to publish a new serial.
+    stats_.Increment(Stats::COUNTER_RELOADS_SKIPPED, 1);
+  } else {
+    serial_ = last_serial;
+  }
+  XSETTINGSD_PROBE3(config_load_end, serial_, settings_.map().size(),
+                    loaded_config_->size());
+  if (changes.empty())
+    return true;
+  CountChanges(switched ? prev_settings : replaced, changes);
+  QueueNotifications(changes);
   return true;
 }
 
@@ -66,44 +357,161 @@ bool SettingsManager::InitX11(int screen, bool replace_existing_manager) {
   assert(!display_);
   display_ = XOpenDisplay(NULL);
   if (!display_) {
-    fprintf(stderr, "%s: Unable to open connection to X server\n", kProgName);
+    LOG(ERROR, "Unable to open connection to X server");
     return false;
   }
 
   prop_atom_ = XInternAtom(display_, "_XSETTINGS_SETTINGS", False);
-
-  char data[kMaxPropertySize];
-  DataWriter writer(data, kMaxPropertySize);
-  if (!WriteProperty(&writer))
-    return false;
+  if (publish_digest_)
+    digest_atom_ = XInternAtom(display_, "_XSETTINGS_DIGEST", False);
 
   int min_screen = 0;
   int max_screen = ScreenCount(display_) - 1;
   if (screen >= 0)
     min_screen = max_screen = screen;
+  screen_ = min_screen;
 
+  vector<Time> timestamps;
   for (screen = min_screen; screen <= max_screen; ++screen) {
     Window win = None;
     Time timestamp = 0;
     if (!CreateWindow(screen, &win, &timestamp)) {
-      fprintf(stderr, "%s: Unable to create window on screen %d\n",
-              kProgName, screen);
+      LOG(ERROR, "Unable to create window on screen %d", screen);
       return false;
     }
-    fprintf(stderr, "%s: Created window 0x%x on screen %d with timestamp %lu\n",
-            kProgName, static_cast<unsigned int>(win), screen, timestamp);
+    LOG(INFO, "Created window 0x%x on screen %d with timestamp %lu",
+        static_cast<unsigned int>(win), screen, timestamp);
+    windows_.push_back(win);
+    timestamps.push_back(timestamp);
+  }
 
-    SetPropertyOnWindow(win, data, writer.bytes_written());
+  // The property needs to be present before we take the selections.
+  if (!UpdateProperties())
+    return false;
 
-    if (!ManageScreen(screen, win, timestamp, replace_existing_manager))
+  for (size_t i = 0; i < windows_.size(); ++i) {
+    if (!ManageScreen(min_screen + i, windows_[i], timestamps[i],
+                      replace_existing_manager))
       return false;
-
-    windows_.push_back(win);
   }
 
   return true;
 }
 
+void SettingsManager::EnableDigest() {
+  assert(!display_);
+  publish_digest_ = true;
+}
+
+bool SettingsManager::InitRandR() {
+  assert(display_);
+#ifdef HAVE_XRANDR
+  int error_base = 0;
+  if (!XRRQueryExtension(display_, &randr_event_base_, &error_base)) {
+    LOG(ERROR, "X server doesn't support RandR");
+    randr_event_base_ = -1;
+    return false;
+  }
+  XRRSelectInput(display_, RootWindow(display_, screen_),
+                 RRScreenChangeNotifyMask);
+  UpdateScreenSize(DisplayWidth(display_, screen_),
+                   DisplayWidthMM(display_, screen_));
+  return true;
+#else
+  LOG(ERROR, "Built without RandR support");
+  return false;
+#endif
+}
+
+void SettingsManager::UpdateScreenSize(int width, int width_mm) {
+  SettingsMap derived;
+  if (width > 0 && width_mm > 0) {
+    const int dpi = static_cast<int>(width * 25.4 / width_mm + 0.5);
+    const int scale = (dpi >= kHiDpiThreshold) ? dpi / kBaseDpi : 1;
+    SettingsMap::Map* map = derived.mutable_map();
+    (*map)["Xft/DPI"] = new IntegerSetting(dpi * 1024);
+    (*map)["Gdk/WindowScalingFactor"] = new IntegerSetting(scale);
+    (*map)["Gdk/UnscaledDPI"] = new IntegerSetting(dpi * 1024 / scale);
+    LOG(INFO, "Screen is %d pixels and %d mm wide; using %d DPI and %dx "
+        "scaling", width, width_mm, dpi, scale);
+  } else {
+    LOG(WARNING, "Screen's physical size is unknown; not deriving DPI");
+  }
+
+  NameSet names;
+  AddChangedNames(derived_layer_, derived, &names);
+  if (names.empty())
+    return;
+  derived_layer_.swap(&derived);
+
+  const uint32_t serial = NextSerial();
+  ControlServer::ChangeMap changes;
+  SettingsMap replaced;
+  MergeSettings(active_profile_, names, serial, &settings_, &changes,
+                &replaced);
+  for (ProfileMap::Map::iterator it = profiles_.mutable_map()->begin();
+       it != profiles_.mutable_map()->end(); ++it) {
+    if (it->first != active_profile_ &&
+        MergeSettings(it->first, names, serial, it->second, NULL, NULL) > 0) {
+      properties_[it->first].clear();
+      last_serial_ = serial;
+    }
+  }
+  if (changes.empty())
+    return;
+
+  // Only the derived settings' records need to be re-encoded.
+  string& property = properties_[active_profile_];
+  if (!PatchProperty(changes, &property))
+    property.clear();
+  serial_ = serial;
+  SchedulePublish();
+
+  CountChanges(replaced, changes);
+  QueueNotifications(changes);
+  WriteStats();
+}
+
+bool SettingsManager::InitControlServer(const string& socket_path) {
+  assert(!control_server_);
+  control_server_ = new ControlServer(socket_path, this);
+  return control_server_->Init();
+}
+
+bool SettingsManager::InitConfigLoader() {
+  assert(loaded_config_);
+  return loader_.Start();
+}
+
+bool SettingsManager::InitFileWriter() {
+  return file_writer_.Start();
+}
+
+bool SettingsManager::InitStats(const string& path) {
+  assert(stats_path_.empty());
+  stats_path_ = path;
+  return stats_.WriteToFile(stats_path_);
+}
+
+void SettingsManager::SetHistorySize(size_t size) {
+  history_size_ = size;
+  while (history_.size() > history_size_) {
+    delete history_.front();
+    history_.pop_front();
+  }
+}
+
+void SettingsManager::SetPublishSchedule(double delay, double min_interval) {
+  publish_delay_ = delay;
+  min_publish_interval_ = min_interval;
+}
+
+bool SettingsManager::InitSnapshot(const string& path) {
+  assert(!snapshot_writer_);
+  snapshot_writer_ = new SnapshotWriter(path);
+  return snapshot_writer_->Init();
+}
+
 void SettingsManager::RunEventLoop() {
   int x11_fd = XConnectionNumber(display_);
   // TODO: Need to also use XAddConnectionWatch()?
@@ -111,7 +519,8 @@ void SettingsManager::RunEventLoop() {
   while (true) {
     // Rather than blocking in XNextEvent(), we just read all the available
     // events here.  We block in select() instead, so that we'll get EINTR
-    // if a SIGHUP came in to ask us to reload the config.
+    // if a SIGHUP or SIGUSR1 came in to ask us to reload the config or
+    // switch profiles.
     while (XPending(display_)) {
       XEvent event;
       XNextEvent(display_, &event);
@@ -123,47 +532,579 @@ void SettingsManager::RunEventLoop() {
           break;
         case SelectionClear: {
           // If someone else took the selection, that's our sign to leave.
-          fprintf(stderr, "%s: 0x%x took a selection from us; exiting\n",
-                  kProgName,
-                  static_cast<unsigned int>(event.xselectionclear.window));
+          LOG(INFO, "0x%x took a selection from us; exiting",
+              static_cast<unsigned int>(event.xselectionclear.window));
+          XSETTINGSD_PROBE1(selection_lost, event.xselectionclear.window);
           DestroyWindows();
           return;
         }
         default:
-          fprintf(stderr, "%s: Ignoring event of type %d\n",
-                  kProgName, event.type);
+#ifdef HAVE_XRANDR
+          if (randr_event_base_ >= 0 &&
+              event.type == randr_event_base_ + RRScreenChangeNotify) {
+            // This updates the screen size that Xlib reports.
+            XRRUpdateConfiguration(&event);
+            screen_change_deadline_ =
+                GetMonotonicTime() + kScreenChangeDelaySec;
+            break;
+          }
+#endif
+          LOG_RATE_LIMITED(DEBUG, "Ignoring event of type %d", event.type);
       }
     }
 
-    // TODO: There's a small race condition here, in that SIGHUP can come
+    // TODO: There's a small race condition here, in that a signal can come
     // in while we're outside of the select() call, but it's probably not
     // worth trying to work around.
 
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(x11_fd, &fds);
-    if (select(x11_fd + 1, &fds, NULL, NULL, NULL) == -1) {
+    fd_set read_fds, write_fds;
+    FD_ZERO(&read_fds);
+    FD_ZERO(&write_fds);
+    FD_SET(x11_fd, &read_fds);
+    int max_fd = x11_fd;
+    if (control_server_)
+      control_server_->AddFds(&read_fds, &write_fds, &max_fd);
+    if (loader_.started()) {
+      FD_SET(loader_.wake_fd(), &read_fds);
+      max_fd = max(max_fd, loader_.wake_fd());
+    }
+
+    // Wake up once a burst of screen changes has settled, a scheduled
+    // publish is due, or the stats need to be written.
+    double deadline = 0;
+    const double deadlines[] = {
+      screen_change_deadline_, publish_deadline_, stats_deadline_,
+    };
+    for (size_t i = 0; i < sizeof(deadlines) / sizeof(deadlines[0]); ++i) {
+      if (deadlines[i] > 0 && (deadline == 0 || deadlines[i] < deadline))
+        deadline = deadlines[i];
+    }
+    struct timeval timeout;
+    struct timeval* timeout_ptr = NULL;
+    if (deadline > 0) {
+      const double delay = max(deadline - GetMonotonicTime(), 0.0);
+      timeout.tv_sec = static_cast<time_t>(delay);
+      timeout.tv_usec = static_cast<suseconds_t>(
+          (delay - timeout.tv_sec) * 1000000);
+      timeout_ptr = &timeout;
+    }
+
+    const int num_fds =
+        select(max_fd + 1, &read_fds, &write_fds, NULL, timeout_ptr);
+    if (num_fds == -1) {
       if (errno != EINTR) {
-        fprintf(stderr, "%s: select() failed: %s\n",
-                kProgName, strerror(errno));
+        LOG(ERROR, "select() failed: %s", strerror(errno));
         return;
       }
 
-      fprintf(stderr, "%s: Reloading configuration\n", kProgName);
-      if (!LoadConfig())
-        continue;
+      if (g_reload_requested) {
+        g_reload_requested = 0;
+        LOG(INFO, "Reloading configuration");
+        ReloadConfig();
+      }
+      if (g_profile_switch_requested) {
+        g_profile_switch_requested = 0;
+        SwitchToNextProfile();
+      }
+      if (g_rollback_requested) {
+        g_rollback_requested = 0;
+        string error;
+        if (!RollBack(1, &error))
+          LOG(ERROR, "Unable to roll back: %s", error.c_str());
+      }
+      continue;
+    }
+
+    if (screen_change_deadline_ > 0 &&
+        GetMonotonicTime() >= screen_change_deadline_) {
+      screen_change_deadline_ = 0;
+      UpdateScreenSize(DisplayWidth(display_, screen_),
+                       DisplayWidthMM(display_, screen_));
+    }
+    if (num_fds > 0 && loader_.started() &&
+        FD_ISSET(loader_.wake_fd(), &read_fds)) {
+      HandleLoadedConfig();
+    }
+    if (num_fds > 0 && control_server_)
+      control_server_->HandleFds(read_fds, write_fds);
+    const double now = GetMonotonicTime();
+    PublishIfDue(now);
+    WriteStatsIfDue(now);
+  }
+}
+
+bool SettingsManager::ApplyChanges(SettingsMap* changes, string* error_out) {
+  return ApplyRuntimeChanges(changes, NULL, error_out);
+}
 
-      char data[kMaxPropertySize];
-      DataWriter writer(data, kMaxPropertySize);
-      if (!WriteProperty(&writer))
-        continue;
+bool SettingsManager::ApplyRuntimeChanges(SettingsMap* changes,
+                                          const string* property,
+                                          string* error_out) {
+  assert(changes);
+  assert(error_out);
 
-      for (vector<Window>::const_iterator it = windows_.begin();
-           it != windows_.end(); ++it) {
-        SetPropertyOnWindow(*it, data, writer.bytes_written());
+  // Take ownership of the new settings.
+  SettingsMap new_settings;
+  new_settings.swap(changes);
+
+  // Build the new runtime layer, keeping the old one in case we need to
+  // roll back.
+  SettingsMap runtime_layer;
+  SettingsMap::Map* runtime_map = runtime_layer.mutable_map();
+  for (SettingsMap::Map::const_iterator it = runtime_layer_.map().begin();
+       it != runtime_layer_.map().end(); ++it) {
+    runtime_map->insert(
+        make_pair(it->first, it->second ? it->second->Clone() : NULL));
+  }
+  NameSet names;
+  for (SettingsMap::Map::iterator it = new_settings.mutable_map()->begin();
+       it != new_settings.mutable_map()->end(); ++it) {
+    names.insert(it->first);
+    Setting*& setting = (*runtime_map)[it->first];
+    delete setting;
+    setting = it->second;
+    it->second = NULL;
+  }
+  runtime_layer_.swap(&runtime_layer);
+
+  // Merge the changed settings into 'settings_', saving the previous
+  // versions (or NULL for settings that didn't exist) to 'replaced' so that
+  // we can roll back if the new property can't be written.
+  const uint32_t prev_serial = serial_;
+  const uint32_t serial = NextSerial();
+  ControlServer::ChangeMap notifications;
+  SettingsMap replaced;
+  MergeSettings(active_profile_, names, serial, &settings_, &notifications,
+                &replaced);
+
+  if (!notifications.empty()) {
+    string& active_property = properties_[active_profile_];
+    if (property) {
+      active_property = *property;
+      if (!StampSerials(settings_, &active_property))
+        active_property.clear();
+    } else if (!PatchProperty(notifications, &active_property)) {
+      active_property.clear();
+    }
+    serial_ = serial;
+    if (!SchedulePublish()) {
+      SettingsMap::Map* current = settings_.mutable_map();
+      for (SettingsMap::Map::iterator it = replaced.mutable_map()->begin();
+           it != replaced.mutable_map()->end(); ++it) {
+        SettingsMap::Map::iterator existing = current->find(it->first);
+        if (existing != current->end()) {
+          delete existing->second;
+          current->erase(existing);
+        }
+        if (it->second)
+          current->insert(make_pair(it->first, it->second));
+        it->second = NULL;
       }
+      runtime_layer_.swap(&runtime_layer);
+      properties_[active_profile_].clear();
+      serial_ = prev_serial;
+      *error_out = "Unable to write settings property";
+      WriteStats();
+      return false;
     }
   }
+
+  // Runtime changes apply to every profile.  The others' properties are
+  // regenerated when they're switched to.  Their settings may get the new
+  // serial even if the active profile's didn't change.
+  for (ProfileMap::Map::iterator it = profiles_.mutable_map()->begin();
+       it != profiles_.mutable_map()->end(); ++it) {
+    if (it->first != active_profile_ &&
+        MergeSettings(it->first, names, serial, it->second, NULL, NULL) > 0) {
+      properties_[it->first].clear();
+      last_serial_ = serial;
+    }
+  }
+
+  if (notifications.empty())
+    return true;
+
+  CountChanges(replaced, notifications);
+  QueueNotifications(notifications);
+
+  LOG(INFO, "Applied %zu runtime change%s", notifications.size(),
+      (notifications.size() == 1) ? "" : "s");
+  WriteStats();
+  return true;
+}
+
+const Setting* SettingsManager::GetCurrentSetting(const string& name) {
+  return settings_.GetSetting(name);
+}
+
+bool SettingsManager::SwitchProfile(const string& name, string* error_out) {
+  assert(error_out);
+
+  ProfileMap::Map::iterator it = profiles_.mutable_map()->find(name);
+  if (it == profiles_.mutable_map()->end()) {
+    *error_out = StringPrintf("No profile named \"%s\"", name.c_str());
+    return false;
+  }
+  if (name == active_profile_)
+    return true;
+
+  // Move the active profile's settings back to its entry in 'profiles_' and
+  // the new profile's settings into 'settings_'.  Its property was
+  // serialized when the config was loaded, so publishing it just needs a
+  // new serial.
+  SettingsMap* prev_settings =
+      profiles_.mutable_map()->find(active_profile_)->second;
+  prev_settings->swap(&settings_);
+  settings_.swap(it->second);
+  const string prev_profile = active_profile_;
+  const uint32_t prev_serial = serial_;
+  active_profile_ = name;
+  serial_ = NextSerial();
+
+  if (!SchedulePublish()) {
+    it->second->swap(&settings_);
+    settings_.swap(prev_settings);
+    active_profile_ = prev_profile;
+    serial_ = prev_serial;
+    *error_out = "Unable to write settings property";
+    WriteStats();
+    return false;
+  }
+
+  stats_.Increment(Stats::COUNTER_PROFILE_SWITCHES, 1);
+  // Diffing the profiles is only worthwhile if someone might be listening.
+  if (control_server_) {
+    ControlServer::ChangeMap changes;
+    GetChanges(*prev_settings, &changes);
+    QueueNotifications(changes);
+  }
+  LOG(INFO, "Switched to profile \"%s\"", name.c_str());
+  WriteStats();
+  return true;
+}
+
+bool SettingsManager::RollBack(int generations, string* error_out) {
+  assert(error_out);
+
+  // The last generation in the history is the one that's published now,
+  // unless changes are waiting for a coalesced publish.  Those haven't been
+  // recorded yet, and rolling back discards them.
+  const bool pending = publish_deadline_ > 0;
+  const size_t num_earlier =
+      (history_.empty() || pending) ? history_.size() : history_.size() - 1;
+  if (generations <= 0 || static_cast<size_t>(generations) > num_earlier) {
+    *error_out = StringPrintf("Only %zu earlier generation%s available",
+                              num_earlier,
+                              (num_earlier == 1) ? " is" : "s are");
+    return false;
+  }
+
+  // The history works like an undo stack: the generation that we're rolling
+  // back to and the ones after it are removed, and the republished settings
+  // are recorded as a new generation.  Rolling back again goes further back
+  // instead of undoing the rollback.
+  const size_t index = num_earlier - generations;
+  std::deque<Generation*> removed(history_.begin() + index, history_.end());
+  history_.erase(history_.begin() + index, history_.end());
+  Generation* gen = removed.front();
+
+  // The generation's settings are applied as runtime changes, so that they
+  // take effect in every profile until the next reload.
+  SettingsMap changes;
+  SettingsMap::Map* change_map = changes.mutable_map();
+  for (SettingsMap::Map::const_iterator it = settings_.map().begin();
+       it != settings_.map().end(); ++it) {
+    if (!gen->settings.GetSetting(it->first))
+      change_map->insert(make_pair(it->first, static_cast<Setting*>(NULL)));
+  }
+  for (SettingsMap::Map::const_iterator it = gen->settings.map().begin();
+       it != gen->settings.map().end(); ++it) {
+    const Setting* current = settings_.GetSetting(it->first);
+    if (!current || !(*current == *it->second))
+      change_map->insert(make_pair(it->first, it->second->Clone()));
+  }
+  // If nothing changes, nothing is published, so the generation stays.
+  const bool unchanged = change_map->empty() && !pending;
+
+  LOG(INFO, "Rolling back %zu setting%s to the generation published with "
+      "serial %u from profile \"%s\"", change_map->size(),
+      (change_map->size() == 1) ? "" : "s", gen->serial, gen->profile.c_str());
+  const string property = gen->property;
+  if (!ApplyRuntimeChanges(&changes, &property, error_out)) {
+    history_.insert(history_.end(), removed.begin(), removed.end());
+    return false;
+  }
+  if (unchanged) {
+    history_.push_back(gen);
+    removed.pop_front();
+  }
+  for (size_t i = 0; i < removed.size(); ++i)
+    delete removed[i];
+  stats_.Increment(Stats::COUNTER_ROLLBACKS, 1);
+  WriteStats();
+  return true;
+}
+
+string SettingsManager::FormatStats() {
+  stats_.Set(Stats::COUNTER_LOG_MESSAGES_DROPPED, GetNumDroppedLogMessages());
+  return stats_.FormatSummary();
+}
+
+void SettingsManager::ReloadConfig() {
+  if (loader_.started()) {
+    // The result is applied by HandleLoadedConfig() once it's ready.
+    XSETTINGSD_PROBE1(config_load_start, loader_.config_filename().c_str());
+    loader_.RequestLoad(loaded_defaults_, loaded_config_);
+    return;
+  }
+  {
+    Stats::ScopedTimer timer(&stats_, Stats::STAGE_RELOAD);
+    uint32_t prev_serial = serial_;
+    if (LoadConfig() && serial_ != prev_serial)
+      SchedulePublish();
+  }
+  WriteStats();
+}
+
+void SettingsManager::HandleLoadedConfig() {
+  ConfigGeneration* gen = loader_.TakeGeneration();
+  if (!gen)
+    return;
+
+  // Files that the worker found unchanged were compared against the texts
+  // that were current when the load was requested.  If an earlier
+  // generation has replaced those since, the comparison is meaningless.
+  if ((!gen->defaults_parsed && gen->defaults_text != loaded_defaults_) ||
+      (!gen->config_parsed && gen->config_text != loaded_config_)) {
+    LOG(DEBUG, "Loaded config is stale; loading it again");
+    delete gen;
+    loader_.RequestLoad(loaded_defaults_, loaded_config_);
+    return;
+  }
+
+  {
+    Stats::ScopedTimer timer(&stats_, Stats::STAGE_RELOAD);
+    uint32_t prev_serial = serial_;
+    if (ApplyConfig(gen) && serial_ != prev_serial)
+      SchedulePublish();
+  }
+  WriteStats();
+}
+
+void SettingsManager::SwitchToNextProfile() {
+  if (profiles_.map().size() < 2) {
+    LOG(INFO, "No other profiles to switch to");
+    return;
+  }
+  ProfileMap::Map::const_iterator it =
+      profiles_.map().upper_bound(active_profile_);
+  if (it == profiles_.map().end())
+    it = profiles_.map().begin();
+
+  string error;
+  if (!SwitchProfile(it->first, &error)) {
+    LOG(ERROR, "Unable to switch to profile \"%s\": %s", it->first.c_str(),
+        error.c_str());
+  }
+}
+
+const SettingsMap* SettingsManager::GetProfileSettings(
+    const string& name) const {
+  if (name == active_profile_)
+    return &settings_;
+  return profiles_.GetProfile(name);
+}
+
+uint32_t SettingsManager::NextSerial() const {
+  return max(serial_, last_serial_) + 1;
+}
+
+SettingsMap* SettingsManager::GetMutableProfileSettings(const string& name) {
+  if (name == active_profile_)
+    return &settings_;
+  ProfileMap::Map::iterator it = profiles_.mutable_map()->find(name);
+  return (it != profiles_.mutable_map()->end()) ? it->second : NULL;
+}
+
+const Setting* SettingsManager::GetLayeredSetting(const string& profile,
+                                                  const string& name) const {
+  SettingsMap::Map::const_iterator it = runtime_layer_.map().find(name);
+  if (it != runtime_layer_.map().end())
+    return it->second;
+  const SettingsMap* config = config_layer_.GetProfile(profile);
+  const Setting* setting = config ? config->GetSetting(name) : NULL;
+  if (setting)
+    return setting;
+  setting = derived_layer_.GetSetting(name);
+  return setting ? setting : default_layer_.GetSetting(name);
+}
+
+size_t SettingsManager::MergeSettings(const string& profile,
+                                      const NameSet& names,
+                                      uint32_t serial,
+                                      SettingsMap* merged,
+                                      ControlServer::ChangeMap* changes_out,
+                                      SettingsMap* replaced_out) {
+  assert(merged);
+  const SettingsMap* default_settings =
+      (profile != kDefaultProfileName) ?
+      GetProfileSettings(kDefaultProfileName) : NULL;
+
+  SettingsMap::Map* map = merged->mutable_map();
+  size_t num_changed = 0;
+  for (NameSet::const_iterator it = names.begin(); it != names.end(); ++it) {
+    const Setting* source = GetLayeredSetting(profile, *it);
+    SettingsMap::Map::iterator existing = map->find(*it);
+    Setting* prev = (existing != map->end()) ? existing->second : NULL;
+    if (source ? (prev && *prev == *source) : !prev)
+      continue;  // unchanged
+
+    Setting* setting = NULL;
+    if (source) {
+      setting = source->Clone();
+      const Setting* reference =
+          default_settings ? default_settings->GetSetting(*it) : NULL;
+      setting->UpdateSerial(
+          (reference && *reference == *setting) ? reference : NULL, serial);
+    }
+
+    if (replaced_out)
+      replaced_out->mutable_map()->insert(make_pair(*it, prev));
+    else
+      delete prev;
+    if (!setting)
+      map->erase(existing);
+    else if (prev)
+      existing->second = setting;
+    else
+      map->insert(make_pair(*it, setting));
+
+    if (changes_out)
+      (*changes_out)[*it] = setting;
+    num_changed++;
+  }
+  return num_changed;
+}
+
+// static
+bool SettingsManager::PatchProperty(const ControlServer::ChangeMap& changes,
+                                    string* property) {
+  assert(property);
+  DataReader reader(property->data(), property->size());
+  if (!reader.ReadBytes(NULL, kPropertyHeaderSize))
+    return false;
+
+  size_t num_patched = 0;
+  while (num_patched < changes.size() && reader.HasBytes(1)) {
+    const size_t offset = reader.bytes_read();
+    SettingView view;
+    if (!Setting::ReadView(&reader, &view))
+      return false;
+    ControlServer::ChangeMap::const_iterator it =
+        changes.find(string(view.name));
+    if (it == changes.end())
+      continue;
+    if (!it->second)
+      return false;
+
+    const size_t size = reader.bytes_read() - offset;
+    DataWriter writer(&(*property)[offset], size);
+    if (!it->second->Write(it->first, &writer) ||
+        writer.bytes_written() != size) {
+      return false;
+    }
+    num_patched++;
+  }
+  return num_patched == changes.size();
+}
+
+// static
+bool SettingsManager::StampSerials(const SettingsMap& settings,
+                                   string* property) {
+  assert(property);
+  DataReader reader(property->data(), property->size());
+  if (!reader.ReadBytes(NULL, kPropertyHeaderSize))
+    return false;
+
+  SettingsMap::Map::const_iterator it = settings.map().begin();
+  while (reader.HasBytes(1)) {
+    const size_t offset = reader.bytes_read();
+    SettingView view;
+    if (!Setting::ReadView(&reader, &view) ||
+        it == settings.map().end() || view.name != it->first) {
+      return false;
+    }
+    // The serial follows the type, a byte of padding, the name's length,
+    // and the name, padded to four bytes.
+    const size_t serial_offset = offset + 4 + ((view.name.size() + 3) & ~3);
+    const uint32_t serial = it->second->serial();
+    memcpy(&(*property)[serial_offset], &serial, sizeof(serial));
+    ++it;
+  }
+  return it == settings.map().end();
+}
+
+void SettingsManager::RecordGeneration(const string& property) {
+  if (history_size_ == 0)
+    return;
+  Generation* gen = NULL;
+  if (history_.size() >= history_size_) {
+    // Reuse the oldest generation's buffers.
+    gen = history_.front();
+    history_.pop_front();
+    SettingsMap().swap(&gen->settings);
+  } else {
+    gen = new Generation;
+  }
+  gen->serial = serial_;
+  gen->profile = active_profile_;
+  SettingsMap::Map* map = gen->settings.mutable_map();
+  for (SettingsMap::Map::const_iterator it = settings_.map().begin();
+       it != settings_.map().end(); ++it) {
+    map->insert(make_pair(it->first, it->second->Clone()));
+  }
+  gen->property = property;
+  history_.push_back(gen);
+}
+
+// static
+void SettingsManager::AddChangedNames(const SettingsMap& a,
+                                      const SettingsMap& b,
+                                      NameSet* names_out) {
+  assert(names_out);
+  for (SettingsMap::Map::const_iterator it = a.map().begin();
+       it != a.map().end(); ++it) {
+    const Setting* other = b.GetSetting(it->first);
+    if (!other || !(*other == *it->second))
+      names_out->insert(it->first);
+  }
+  for (SettingsMap::Map::const_iterator it = b.map().begin();
+       it != b.map().end(); ++it) {
+    if (!a.GetSetting(it->first))
+      names_out->insert(it->first);
+  }
+}
+
+void SettingsManager::QueueNotifications(
+    const ControlServer::ChangeMap& changes) {
+  for (ControlServer::ChangeMap::const_iterator it = changes.begin();
+       it != changes.end(); ++it) {
+    notify_names_.insert(it->first);
+  }
+}
+
+void SettingsManager::WriteStats() {
+  if (stats_path_.empty() || stats_deadline_ > 0)
+    return;
+  stats_deadline_ = GetMonotonicTime() + kStatsWriteDelaySec;
+}
+
+void SettingsManager::WriteStatsIfDue(double now) {
+  if (stats_deadline_ == 0 || now < stats_deadline_)
+    return;
+  stats_deadline_ = 0;
+  stats_.Set(Stats::COUNTER_LOG_MESSAGES_DROPPED, GetNumDroppedLogMessages());
+  file_writer_.Write(stats_path_, stats_.FormatPrometheus());
 }
 
 void SettingsManager::DestroyWindows() {
@@ -247,25 +1188,189 @@ bool SettingsManager::CreateWindow(int screen,
   return true;
 }
 
-bool SettingsManager::WriteProperty(DataWriter* writer) {
+bool SettingsManager::WriteProperty(const SettingsMap& settings,
+                                    DataWriter* writer) {
   assert(writer);
 
   int byte_order = IsLittleEndian() ? LSBFirst : MSBFirst;
   if (!writer->WriteInt8(byte_order))              return false;
   if (!writer->WriteZeros(3))                      return false;
   if (!writer->WriteInt32(serial_))                return false;
-  if (!writer->WriteInt32(settings_.map().size())) return false;
+  if (!writer->WriteInt32(settings.map().size()))  return false;
 
-  for (SettingsMap::Map::const_iterator it = settings_.map().begin();
-       it != settings_.map().end(); ++it) {
+  for (SettingsMap::Map::const_iterator it = settings.map().begin();
+       it != settings.map().end(); ++it) {
     if (!it->second->Write(it->first, writer))
       return false;
   }
   return true;
 }
 
+void SettingsManager::GetChanges(const SettingsMap& prev_settings,
+                                 ControlServer::ChangeMap* changes_out) const {
+  assert(changes_out);
+
+  // Serials can't be used to find changed settings here: a profile's
+  // settings carry the serials that were assigned when the config was
+  // loaded, so compare values instead.
+  for (SettingsMap::Map::const_iterator it = settings_.map().begin();
+       it != settings_.map().end(); ++it) {
+    const Setting* prev = prev_settings.GetSetting(it->first);
+    if (!prev || !(*prev == *it->second))
+      (*changes_out)[it->first] = it->second;
+  }
+  for (SettingsMap::Map::const_iterator it = prev_settings.map().begin();
+       it != prev_settings.map().end(); ++it) {
+    if (!settings_.GetSetting(it->first))
+      (*changes_out)[it->first] = NULL;
+  }
+}
+
+void SettingsManager::CountChanges(
+    const SettingsMap& prev_settings,
+    const ControlServer::ChangeMap& changes) {
+  for (ControlServer::ChangeMap::const_iterator it = changes.begin();
+       it != changes.end(); ++it) {
+    if (!it->second)
+      stats_.Increment(Stats::COUNTER_SETTINGS_REMOVED, 1);
+    else if (prev_settings.GetSetting(it->first))
+      stats_.Increment(Stats::COUNTER_SETTINGS_CHANGED, 1);
+    else
+      stats_.Increment(Stats::COUNTER_SETTINGS_ADDED, 1);
+  }
+}
+
+bool SettingsManager::SerializeSettings(const SettingsMap& settings,
+                                        string* property_out) {
+  assert(property_out);
+  char data[kMaxPropertySize];
+  DataWriter writer(data, kMaxPropertySize);
+  bool write_ok = false;
+  XSETTINGSD_PROBE2(serialize_start, serial_, settings.map().size());
+  {
+    Stats::ScopedTimer timer(&stats_, Stats::STAGE_SERIALIZE);
+    write_ok = WriteProperty(settings, &writer);
+  }
+  XSETTINGSD_PROBE2(serialize_end, serial_, writer.bytes_written());
+  if (!write_ok) {
+    property_out->clear();
+    return false;
+  }
+  property_out->assign(data, writer.bytes_written());
+  return true;
+}
+
+void SettingsManager::SerializeProfiles() {
+  for (ProfileMap::Map::const_iterator it = profiles_.map().begin();
+       it != profiles_.map().end(); ++it) {
+    if (!properties_[it->first].empty())
+      continue;
+    // Failures are reported if the profile is published.
+    SerializeSettings(*GetProfileSettings(it->first), &properties_[it->first]);
+  }
+}
+
+bool SettingsManager::UpdateProperties() {
+  string& property = properties_[active_profile_];
+  if (property.empty() && !SerializeSettings(settings_, &property)) {
+    LOG(ERROR, "Unable to write settings property");
+    stats_.Increment(Stats::COUNTER_PUBLISH_FAILURES, 1);
+    return false;
+  }
+
+  // The property may have been serialized back when the config was loaded,
+  // so stamp the current serial into its header.
+  const uint32_t serial = serial_;
+  memcpy(&property[kPropertySerialOffset], &serial, sizeof(serial));
+  const char* data = property.data();
+  const size_t size = property.size();
+
+  // The serial changes with every publish, so it's left out of the digest.
+  // That way, the digest only changes when the settings do.
+  string digest;
+  if (publish_digest_) {
+    Sha256 sha;
+    sha.Update(data, kPropertySerialOffset);
+    sha.Update(data + kPropertySerialOffset + sizeof(serial),
+               size - kPropertySerialOffset - sizeof(serial));
+    digest.resize(Sha256::kDigestSize);
+    sha.Finish(reinterpret_cast<uint8_t*>(&digest[0]));
+  }
+
+  if (!windows_.empty()) {
+    Stats::ScopedTimer timer(&stats_, Stats::STAGE_SET_PROPERTY);
+    for (vector<Window>::const_iterator it = windows_.begin();
+         it != windows_.end(); ++it) {
+      SetPropertyOnWindow(*it, data, size, digest);
+    }
+    // Flush once for all of the windows, so that the time spent sending
+    // the properties is attributed to this stage.
+    XFlush(display_);
+  }
+  stats_.Increment(Stats::COUNTER_PUBLISHES, 1);
+  stats_.Increment(Stats::COUNTER_BYTES_PUBLISHED, size);
+  last_publish_time_ = GetMonotonicTime();
+  publish_deadline_ = 0;
+  RecordGeneration(property);
+
+  // Now that clients can see the changes, tell subscribers about them.  The
+  // settings may have changed again since the notifications were queued,
+  // so their current values are sent.
+  if (control_server_ && !notify_names_.empty()) {
+    ControlServer::ChangeMap changes;
+    for (NameSet::const_iterator it = notify_names_.begin();
+         it != notify_names_.end(); ++it) {
+      changes[*it] = settings_.GetSetting(*it);
+    }
+    control_server_->NotifySubscribers(changes);
+  }
+  notify_names_.clear();
+
+  if (snapshot_writer_ &&
+      !snapshot_writer_->Publish(data, size)) {
+    LOG(ERROR, "Unable to update snapshot %s",
+        snapshot_writer_->path().c_str());
+  }
+  // Failures are logged by the writer.
+  if (!state_path_.empty())
+    file_writer_.Write(state_path_, property);
+  return true;
+}
+
+bool SettingsManager::SchedulePublish() {
+  // Serialize now so that callers can still roll back if it fails.
+  string& property = properties_[active_profile_];
+  if (property.empty() && !SerializeSettings(settings_, &property)) {
+    LOG(ERROR, "Unable to write settings property");
+    stats_.Increment(Stats::COUNTER_PUBLISH_FAILURES, 1);
+    return false;
+  }
+
+  if (publish_deadline_ > 0) {
+    // The pending publish will pick up this change too.
+    stats_.Increment(Stats::COUNTER_PUBLISHES_COALESCED, 1);
+    return true;
+  }
+  const double now = GetMonotonicTime();
+  const double deadline = max(now + publish_delay_,
+                              last_publish_time_ + min_publish_interval_);
+  if (deadline <= now)
+    return UpdateProperties();
+  publish_deadline_ = deadline;
+  return true;
+}
+
+void SettingsManager::PublishIfDue(double now) {
+  if (publish_deadline_ == 0 || now < publish_deadline_)
+    return;
+  // Failures are counted and logged, and the next change will try again.
+  publish_deadline_ = 0;
+  UpdateProperties();
+}
+
 void SettingsManager::SetPropertyOnWindow(
-    Window win, const char* data, size_t size) {
+    Window win, const char* data, size_t size, const string& digest) {
+  XSETTINGSD_PROBE3(set_property_start, win, serial_, size);
   XChangeProperty(display_,
                   win,
                   prop_atom_,  // property
@@ -274,6 +1379,13 @@ void SettingsManager::SetPropertyOnWindow(
                   PropModeReplace,
                   reinterpret_cast<const unsigned char*>(data),
                   size);
+  if (!digest.empty()) {
+    XChangeProperty(display_, win, digest_atom_, digest_atom_, 8,
+                    PropModeReplace,
+                    reinterpret_cast<const unsigned char*>(digest.data()),
+                    digest.size());
+  }
+  XSETTINGSD_PROBE3(set_property_end, win, serial_, size);
 }
 
 bool SettingsManager::ManageScreen(int screen,
@@ -291,13 +1403,11 @@ bool SettingsManager::ManageScreen(int screen,
 
   XGrabServer(display_);
   Window prev_win = XGetSelectionOwner(display_, sel_atom);
-  fprintf(stderr, "%s: Selection %s is owned by 0x%x\n",
-          kProgName, sel_atom_name.c_str(),
-          static_cast<unsigned int>(prev_win));
+  LOG(INFO, "Selection %s is owned by 0x%x", sel_atom_name.c_str(),
+      static_cast<unsigned int>(prev_win));
   if (prev_win != None && !replace_existing_manager) {
-    fprintf(stderr, "%s: Someone else already owns the %s selection "
-            "and we weren't asked to replace them\n",
-            kProgName, sel_atom_name.c_str());
+    LOG(ERROR, "Someone else already owns the %s selection "
+        "and we weren't asked to replace them", sel_atom_name.c_str());
     XUngrabServer(display_);
     return false;
   }
@@ -305,8 +1415,8 @@ bool SettingsManager::ManageScreen(int screen,
   if (prev_win)
     XSelectInput(display_, prev_win, StructureNotifyMask);
   XSetSelectionOwner(display_, sel_atom, win, CurrentTime);
-  fprintf(stderr, "%s: Took ownership of selection %s\n",
-          kProgName, sel_atom_name.c_str());
+  LOG(INFO, "Took ownership of selection %s", sel_atom_name.c_str());
+  XSETTINGSD_PROBE2(selection_acquired, screen, win);
   XUngrabServer(display_);
 
   if (prev_win) {
@@ -321,8 +1431,8 @@ bool SettingsManager::ManageScreen(int screen,
 
   // Make sure that no one else took the selection while we were waiting.
   if (XGetSelectionOwner(display_, sel_atom) != win) {
-    fprintf(stderr, "%s: Someone else took ownership of the %s selection\n",
-            kProgName, sel_atom_name.c_str());
+    LOG(ERROR, "Someone else took ownership of the %s selection",
+        sel_atom_name.c_str());
     return false;
   }
 
@@ -4,78 +4,399 @@
 #ifndef __XSETTINGSD_SETTINGS_MANAGER_H__
 #define __XSETTINGSD_SETTINGS_MANAGER_H__
 
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
 #include <stdint.h>
 #include <string>
 #include <vector>
 
 #include <X11/Xlib.h>
 
+#ifdef __TESTING
+#include <gtest/gtest_prod.h>
+#endif
+
 #include "common.h"
+#include "config_loader.h"
+#include "control_server.h"
+#include "file_writer.h"
 #include "setting.h"
+#include "stats.h"
 
 namespace xsettingsd {
 
-class DataWriter;
+class SnapshotWriter;
 
 // SettingsManager is the central class responsible for loading and parsing
 // configs (via ConfigParser), storing them (in the form of Setting
 // objects), and setting them as properties on X11 windows.
-class SettingsManager {
+class SettingsManager : public ControlServer::Delegate {
  public:
   SettingsManager(const std::string& config_filename);
   ~SettingsManager();
 
-  // Load settings from 'config_filename_', updating 'settings_' and
-  // 'serial_' if successful.  If the load was unsuccessful, false is
-  // returned and an error is printed to stderr.
+  // Install handlers for the signals that RunEventLoop() responds to:
+  // SIGHUP reloads the config, SIGUSR1 switches to the next profile, and
+  // SIGUSR2 rolls back to the previously-published settings.
+  static void InstallSignalHandlers();
+
+  // Load default settings from 'path' before the config file.  Settings in
+  // the config file (and runtime changes) take precedence over them.  Must
+  // be called before LoadConfig().
+  void SetDefaultsFilename(const std::string& path);
+
+  // Save each published property to 'path' and restore the settings and
+  // serial that were last saved there, so that settings that haven't
+  // changed across a restart keep their serials.  Must be called before
+  // LoadConfig().  A missing or malformed file isn't an error.
+  bool InitState(const std::string& path);
+
+  // Load settings from the defaults file (if set) and the config file on
+  // the calling thread and discard runtime changes, updating 'settings_'
+  // and 'serial_' if successful.  Only the settings that appear in a file
+  // that changed (or that were changed at runtime) are merged again, and
+  // each of the config's profiles is serialized up front so that switching
+  // to it later is cheap.  If the load was unsuccessful, false is returned
+  // and an error is printed to stderr.
   bool LoadConfig();
 
+  // Reload the config on a worker thread from now on, so that the event
+  // loop keeps handling X events while a large config is parsed.  Must be
+  // called after LoadConfig().
+  bool InitConfigLoader();
+
+  // Write the state and stats files on a worker thread from now on, so
+  // that a slow disk doesn't hold up publishes.  Must be called after
+  // InitState() and InitStats().
+  bool InitFileWriter();
+
   // Connect to the X server, create windows, updates their properties, and
   // take the selections.  A negative screen value will attempt to take the
   // manager selection on all screens.  Returns false if someone else
   // already has a selection unless 'replace_existing_manager' is set.
   bool InitX11(int screen, bool replace_existing_manager);
 
+  // Also publish a _XSETTINGS_DIGEST property on each window: the SHA-256
+  // digest of the settings property, skipping its header's serial, so that
+  // clients and monitoring can check whether the settings changed without
+  // fetching them.  Must be called before InitX11().
+  void EnableDigest();
+
+  // Derive Xft/DPI, Gdk/WindowScalingFactor, and Gdk/UnscaledDPI from the
+  // size of the first managed screen, and update them whenever RandR
+  // reports that it changed.  Values set in the config file take precedence
+  // over the derived ones.  Must be called after InitX11().  Returns false
+  // if RandR isn't available.
+  bool InitRandR();
+
+  // Recompute the settings derived from the screen's size for a screen
+  // 'width' pixels and 'width_mm' millimeters wide, publishing them if they
+  // changed.
+  void UpdateScreenSize(int width, int width_mm);
+
+  // Start listening for control connections on a Unix socket at
+  // 'socket_path'.  Must be called before RunEventLoop().
+  bool InitControlServer(const std::string& socket_path);
+
+  // Publish each generation of settings to a memory-mapped file at 'path'
+  // for readers that don't want to talk to the X server.  Must be called
+  // before InitX11().
+  bool InitSnapshot(const std::string& path);
+
+  // Write stats in Prometheus's text format to 'path' now and shortly
+  // after each reload or runtime change.
+  bool InitStats(const std::string& path);
+
+  // Keep the last 'size' published generations of settings so that they
+  // can be rolled back to.  Defaults to kDefaultHistorySize.
+  void SetHistorySize(size_t size);
+
+  // Hold each publish for 'delay' seconds so that changes arriving in the
+  // meantime go out with it, and leave at least 'min_interval' seconds
+  // between publishes.  Every publish wakes every XSETTINGS client on the
+  // display.  Both are 0 by default, so changes are published immediately.
+  void SetPublishSchedule(double delay, double min_interval);
+
   // Wait for events from the X server, destroying our windows and exiting
   // if we see someone else take a selection.
   void RunEventLoop();
 
+  // ControlServer::Delegate implementation:
+  virtual bool ApplyChanges(SettingsMap* changes, std::string* error_out);
+  virtual const Setting* GetCurrentSetting(const std::string& name);
+  virtual std::string FormatStats();
+  virtual bool SwitchProfile(const std::string& name, std::string* error_out);
+  virtual bool RollBack(int generations, std::string* error_out);
+
+  // Default number of generations passed to SetHistorySize().
+  static const size_t kDefaultHistorySize;
+
  private:
+#ifdef __TESTING
+  FRIEND_TEST(SettingsManagerTest, CoalescePublishes);
+  FRIEND_TEST(SettingsManagerTest, ProfileSerialsAreNotReused);
+  FRIEND_TEST(SettingsManagerTest, RollBack);
+  FRIEND_TEST(SettingsManagerTest, RollBackRepeatedly);
+#endif
+
+  typedef std::set<std::string> NameSet;
+
+  // A published generation of settings.
+  struct Generation {
+    uint32_t serial;
+    std::string profile;
+
+    // The active profile's merged settings, and the property that they
+    // were published as.
+    SettingsMap settings;
+    std::string property;
+  };
+
+  // Like ApplyChanges().  If 'property' is non-NULL, it's a property that
+  // was previously published with the settings that will result from
+  // 'changes', and it's republished with updated serials instead of
+  // patching or reserializing the current property.
+  bool ApplyRuntimeChanges(SettingsMap* changes,
+                           const std::string* property,
+                           std::string* error_out);
+
+  // Reload the config in response to SIGHUP, publishing it if anything
+  // changed.  If the worker thread is running, this just asks it to load
+  // the config.
+  void ReloadConfig();
+
+  // Apply and publish the generation that the worker thread loaded, if
+  // any.
+  void HandleLoadedConfig();
+
+  // Merge the files in 'gen' (as returned by ConfigLoader) into the
+  // settings, taking ownership of it.  Returns false if it failed to load.
+  bool ApplyConfig(ConfigGeneration* gen);
+
+  // Write 'stats_' to 'stats_path_' (if it's set) after a short delay, so
+  // that a burst of changes only writes the file once.
+  void WriteStats();
+
+  // Write the stats if WriteStats() asked for them to be written by 'now'.
+  void WriteStatsIfDue(double now);
+
+  // Switch to the profile following the active one in alphabetical order
+  // (wrapping around) in response to SIGUSR1.
+  void SwitchToNextProfile();
+
+  // Get the settings for the named profile, or NULL if it doesn't exist.
+  const SettingsMap* GetProfileSettings(const std::string& name) const;
+
+  // Get the setting named 'name' in the named profile from the
+  // highest-precedence layer that has it, or NULL if it's unset.
+  const Setting* GetLayeredSetting(const std::string& profile,
+                                   const std::string& name) const;
+
+  // Recompute the settings listed in 'names' in 'merged', the merged
+  // settings for the named profile.  Settings whose values change get
+  // serial 'serial', unless they match the default profile's value, in
+  // which case they share its serial.  If non-NULL, 'changes_out' receives
+  // the new versions of changed settings (NULL for removed ones) and
+  // 'replaced_out' takes ownership of their old versions (NULL for added
+  // ones); otherwise the old versions are deleted.  Returns the number of
+  // settings that changed.
+  size_t MergeSettings(const std::string& profile,
+                       const NameSet& names,
+                       uint32_t serial,
+                       SettingsMap* merged,
+                       ControlServer::ChangeMap* changes_out,
+                       SettingsMap* replaced_out);
+
+  // Add the names of settings that differ between 'a' and 'b' to
+  // 'names_out'.
+  static void AddChangedNames(const SettingsMap& a,
+                              const SettingsMap& b,
+                              NameSet* names_out);
+
+  // Rewrite the records for the settings in 'changes' (as returned by
+  // MergeSettings()) in place in 'property', which was serialized by
+  // SerializeSettings().  Returns false, possibly leaving 'property'
+  // partially rewritten, if a setting was added or removed or its record
+  // changed size.
+  static bool PatchProperty(const ControlServer::ChangeMap& changes,
+                            std::string* property);
+
+  // Rewrite the serial in each record of 'property' with the serial of the
+  // corresponding setting in 'settings', which must contain exactly the
+  // settings in the property, in the same order.  Returns false on
+  // mismatch.
+  static bool StampSerials(const SettingsMap& settings,
+                           std::string* property);
+
+  // Save the just-published property to 'history_', dropping the oldest
+  // generation if the history is full.
+  void RecordGeneration(const std::string& property);
+
+  // Get a serial that hasn't been given to a publish or to any setting.
+  uint32_t NextSerial() const;
+
+  // Get the merged settings for the named profile, or NULL if it doesn't
+  // exist.
+  SettingsMap* GetMutableProfileSettings(const std::string& name);
+
   // Destroy all windows in 'windows_'.
   void DestroyWindows();
 
   // Create and initialize a window.
   bool CreateWindow(int screen, Window* win_out, Time* timestamp_out);
 
-  // Write the currently-loaded property to the passed-in buffer.
-  bool WriteProperty(DataWriter* writer);
+  // Write 'settings' as a property to the passed-in buffer.
+  bool WriteProperty(const SettingsMap& settings, DataWriter* writer);
+
+  // Serialize 'settings' into 'property_out'.  Returns false (leaving
+  // 'property_out' empty) if the property is too large.
+  bool SerializeSettings(const SettingsMap& settings,
+                         std::string* property_out);
+
+  // Regenerate the empty entries in 'properties_' from 'profiles_'.
+  void SerializeProfiles();
+
+  // Update the settings property on the passed-in window, along with the
+  // digest property if 'digest' is non-empty.
+  void SetPropertyOnWindow(Window win, const char* data, size_t size,
+                           const std::string& digest);
 
-  // Update the settings property on the passed-in window.
-  void SetPropertyOnWindow(Window win, const char* data, size_t size);
+  // Write the currently-loaded settings to the property on all of our
+  // windows.
+  bool UpdateProperties();
+
+  // Serialize the active profile's property if needed and publish it
+  // according to the schedule set by SetPublishSchedule(): immediately, or
+  // at 'publish_deadline_' along with any other changes made before then.
+  // Returns false if the property couldn't be serialized.
+  bool SchedulePublish();
+
+  // Publish the property if a publish was scheduled for 'now' or earlier.
+  void PublishIfDue(double now);
+
+  // Find the settings in 'settings_' that changed in the current serial and
+  // the ones that were present in 'prev_settings' but have since been
+  // removed, and add them to 'changes_out'.
+  void GetChanges(const SettingsMap& prev_settings,
+                  ControlServer::ChangeMap* changes_out) const;
+
+  // Update 'stats_' to count the settings in 'changes' (as returned by
+  // GetChanges()) as added, changed, or removed relative to
+  // 'prev_settings'.
+  void CountChanges(const SettingsMap& prev_settings,
+                    const ControlServer::ChangeMap& changes);
+
+  // Remember that the settings in 'changes' changed, so that control socket
+  // subscribers are notified once the property containing the changes is
+  // published (see UpdateProperties()).
+  void QueueNotifications(const ControlServer::ChangeMap& changes);
 
   // Manage XSETTINGS for a particular screen.
   bool ManageScreen(
       int screen, Window win, Time timestamp, bool replace_existing_manager);
 
-  // File from which we load settings.
-  std::string config_filename_;
+  // Reads and parses the defaults file (optional) and the config file.
+  ConfigLoader loader_;
+
+  // Contents of the files that the layers below were last loaded from.
+  // Used to avoid reparsing unchanged files.
+  std::shared_ptr<const std::string> loaded_defaults_;
+  std::shared_ptr<const std::string> loaded_config_;
 
-  // Currently-loaded settings.
+  // Layers that settings are merged from, in increasing order of
+  // precedence: the defaults file, settings derived from the screen's size,
+  // the config file (with complete settings for each of its profiles), and
+  // runtime changes.  All but the config file apply to every profile.  A
+  // NULL runtime setting hides the setting from lower layers.
+  SettingsMap default_layer_;
+  SettingsMap derived_layer_;
+  ProfileMap config_layer_;
+  SettingsMap runtime_layer_;
+
+  // Merged settings for the active profile.
   SettingsMap settings_;
 
-  // Current serial number.
+  // Merged settings for each profile in the config, keyed by name.  The
+  // active profile's entry is empty; its settings are in 'settings_'.
+  ProfileMap profiles_;
+  std::string active_profile_;
+
+  // Serialized properties for each profile, keyed by name.  An empty
+  // property needs to be regenerated before it's published.
+  std::map<std::string, std::string> properties_;
+
+  // Serial of the current (or pending) publish.
   uint32_t serial_;
 
+  // Highest serial given to any profile's settings.  Inactive profiles'
+  // settings can be given serials above 'serial_' without being published.
+  uint32_t last_serial_;
+
   // Connection to the X server.
   Display* display_;
 
   // Atom representing "_XSETTINGS_SETTINGS".
   Atom prop_atom_;
 
+  // Whether EnableDigest() was called, and the atom representing
+  // "_XSETTINGS_DIGEST".
+  bool publish_digest_;
+  Atom digest_atom_;
+
+  // First screen that we manage.
+  int screen_;
+
+  // RandR's first event code, or -1 if we aren't tracking screen changes.
+  int randr_event_base_;
+
+  // Monotonic time at which the derived settings should be recomputed after
+  // a burst of screen changes, or 0 if none are pending.
+  double screen_change_deadline_;
+
+  // Publish schedule set by SetPublishSchedule(), in seconds.
+  double publish_delay_;
+  double min_publish_interval_;
+
+  // Monotonic time of the last publish, and the time at which changes that
+  // haven't been published yet will be, or 0 if there aren't any.
+  double last_publish_time_;
+  double publish_deadline_;
+
+  // Recently-published generations, oldest first, and the maximum number
+  // to keep.
+  std::deque<Generation*> history_;
+  size_t history_size_;
+
   // Windows that we've created to hold settings properties (one per
   // screen).
   std::vector<Window> windows_;
 
+  // Serves runtime changes over a Unix socket, or NULL if disabled.
+  ControlServer* control_server_;
+
+  // Names of changed settings that subscribers haven't been notified about
+  // yet because the property containing the changes hasn't been published.
+  NameSet notify_names_;
+
+  // Mirrors the property into a shared file, or NULL if disabled.
+  SnapshotWriter* snapshot_writer_;
+
+  // File that the last-published property is saved to, if any.
+  std::string state_path_;
+
+  // Writes the state and stats files.
+  FileWriter file_writer_;
+
+  // Counters and timings, and the file that they're written to (if any).
+  Stats stats_;
+  std::string stats_path_;
+
+  // Monotonic time at which the stats should be written, or 0 if they
+  // haven't changed since they last were.
+  double stats_deadline_;
+
   DISALLOW_COPY_AND_ASSIGN(SettingsManager);
 };
 
@@ -0,0 +1,522 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "allocation_counter.h"
+#include "config_parser.h"
+#include "setting.h"
+#include "settings_manager.h"
+
+using std::string;
+
+namespace xsettingsd {
+
+class SettingsManagerTest : public testing::Test {
+ protected:
+  void SetUp() {
+    char dir[] = "/tmp/settings_manager_test.XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+    path_ = dir_ + "/xsettingsd.conf";
+    defaults_path_ = dir_ + "/defaults.conf";
+  }
+
+  void TearDown() {
+    unlink(path_.c_str());
+    unlink(defaults_path_.c_str());
+    unlink(state_path().c_str());
+    rmdir(dir_.c_str());
+  }
+
+  string state_path() const { return dir_ + "/state"; }
+
+  // Replace the config file's contents with 'data'.
+  void WriteConfig(const string& data) { WriteFile(path_, data); }
+
+  // Replace the contents of the file at 'path' with 'data'.
+  void WriteFile(const string& path, const string& data) {
+    FILE* file = fopen(path.c_str(), "w");
+    ASSERT_TRUE(file != NULL);
+    ASSERT_EQ(data.size(), fwrite(data.data(), 1, data.size(), file));
+    ASSERT_EQ(0, fclose(file));
+  }
+
+  string dir_;
+  string path_;
+  string defaults_path_;
+};
+
+TEST_F(SettingsManagerTest, SkipUnchangedConfig) {
+  string config;
+  for (int i = 0; i < 100; ++i)
+    config += StringPrintf("Net/Setting%d \"value %d\"\n", i, i);
+  WriteConfig(config);
+
+  SettingsManager manager(path_);
+  ASSERT_TRUE(manager.LoadConfig());
+  EXPECT_NE(string::npos, manager.FormatStats().find(" reloads_skipped=0 "));
+
+  // Reloading an unchanged file shouldn't reparse it.  Its contents are
+  // read into a reused buffer, so the reload should barely touch the heap.
+  {
+    ScopedAllocationCounter counter;
+    ASSERT_TRUE(manager.LoadConfig());
+    EXPECT_LE(counter.count(), 2);
+  }
+  EXPECT_NE(string::npos, manager.FormatStats().find(" reloads_skipped=1 "));
+
+  // A runtime change means that the file needs to be parsed again to revert
+  // it.
+  SettingsMap changes;
+  (*changes.mutable_map())["Net/Setting0"] = new IntegerSetting(5);
+  string error;
+  ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  ASSERT_EQ(Setting::TYPE_INTEGER,
+            manager.GetCurrentSetting("Net/Setting0")->type());
+  ASSERT_TRUE(manager.LoadConfig());
+  ASSERT_EQ(Setting::TYPE_STRING,
+            manager.GetCurrentSetting("Net/Setting0")->type());
+
+  // Changing the file should also be noticed.
+  WriteConfig(config + "Net/Setting100 3\n");
+  ASSERT_TRUE(manager.LoadConfig());
+  EXPECT_TRUE(manager.GetCurrentSetting("Net/Setting100") != NULL);
+}
+
+TEST_F(SettingsManagerTest, Profiles) {
+  WriteConfig("Net/ThemeName \"Light\"\n"
+              "Xft/DPI 98304\n"
+              "[night]\n"
+              "Net/ThemeName \"Dark\"\n"
+              "[presentation]\n"
+              "Xft/DPI 147456\n"
+              "Net/ThemeName \"Light\"\n");
+  SettingsManager manager(path_);
+  ASSERT_TRUE(manager.LoadConfig());
+  const Setting* theme = manager.GetCurrentSetting("Net/ThemeName");
+  ASSERT_TRUE(theme != NULL);
+  EXPECT_EQ("\"Light\"", theme->FormatValue());
+  const uint32_t light_serial = theme->serial();
+
+  string error;
+  ASSERT_TRUE(manager.SwitchProfile("night", &error)) << error;
+  theme = manager.GetCurrentSetting("Net/ThemeName");
+  EXPECT_EQ("\"Dark\"", theme->FormatValue());
+  EXPECT_NE(light_serial, theme->serial());
+  EXPECT_EQ("98304", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+
+  // Settings that a profile sets to the default value keep the default
+  // serial.
+  ASSERT_TRUE(manager.SwitchProfile("presentation", &error)) << error;
+  EXPECT_EQ(light_serial,
+            manager.GetCurrentSetting("Net/ThemeName")->serial());
+  EXPECT_EQ("147456", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  EXPECT_NE(string::npos, manager.FormatStats().find(" profile_switches=2 "));
+
+  EXPECT_FALSE(manager.SwitchProfile("bogus", &error));
+  EXPECT_EQ("No profile named \"bogus\"", error);
+
+  // Reloading keeps the active profile, and runtime changes to it are
+  // reverted.
+  SettingsMap changes;
+  (*changes.mutable_map())["Xft/DPI"] = new IntegerSetting(5);
+  ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  EXPECT_EQ("5", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  ASSERT_TRUE(manager.LoadConfig());
+  EXPECT_EQ("147456", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+
+  // If the active profile disappears, we fall back to the default one.
+  WriteConfig("Net/ThemeName \"Light\"\n[night]\nNet/ThemeName \"Dark\"\n");
+  ASSERT_TRUE(manager.LoadConfig());
+  EXPECT_TRUE(manager.GetCurrentSetting("Xft/DPI") == NULL);
+  ASSERT_TRUE(manager.SwitchProfile(kDefaultProfileName, &error)) << error;
+  ASSERT_TRUE(manager.SwitchProfile("night", &error)) << error;
+  EXPECT_EQ("\"Dark\"",
+            manager.GetCurrentSetting("Net/ThemeName")->FormatValue());
+}
+
+TEST_F(SettingsManagerTest, ProfileSerialsAreNotReused) {
+  WriteConfig("Net/ThemeName \"Light\"\n[night]\nNet/ThemeName \"Dark\"\n");
+  SettingsManager manager(path_);
+  ASSERT_TRUE(manager.LoadConfig());
+
+  // Editing only an inactive profile doesn't publish anything, but the
+  // serial that its setting gets mustn't be handed out again.
+  WriteConfig("Net/ThemeName \"Light\"\n[night]\nNet/ThemeName \"Black\"\n");
+  ASSERT_TRUE(manager.LoadConfig());
+  string error;
+  ASSERT_TRUE(manager.SwitchProfile("night", &error)) << error;
+  const Setting* theme = manager.GetCurrentSetting("Net/ThemeName");
+  EXPECT_EQ("\"Black\"", theme->FormatValue());
+  const uint32_t night_serial = theme->serial();
+
+  SettingsMap changes;
+  (*changes.mutable_map())["Net/ThemeName"] = new StringSetting("Gray");
+  ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  EXPECT_LT(night_serial,
+            manager.GetCurrentSetting("Net/ThemeName")->serial());
+
+  // Neither may the serial that a runtime change gives an inactive profile's
+  // settings when the active profile's don't change.
+  ASSERT_TRUE(manager.LoadConfig());
+  (*changes.mutable_map())["Net/ThemeName"] = new StringSetting("Black");
+  ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  theme = manager.profiles_.GetProfile(kDefaultProfileName)->GetSetting(
+      "Net/ThemeName");
+  EXPECT_EQ("\"Black\"", theme->FormatValue());
+  EXPECT_LT(theme->serial(), manager.NextSerial());
+
+  // The same goes for screen changes that only affect inactive profiles.
+  WriteConfig("[night]\n"
+              "Xft/DPI 147456\n"
+              "Gdk/WindowScalingFactor 1\n"
+              "Gdk/UnscaledDPI 147456\n");
+  ASSERT_TRUE(manager.LoadConfig());
+  manager.UpdateScreenSize(1920, 508);
+  const Setting* dpi = manager.profiles_.GetProfile(kDefaultProfileName)->
+      GetSetting("Xft/DPI");
+  EXPECT_EQ("98304", dpi->FormatValue());
+  EXPECT_LT(dpi->serial(), manager.NextSerial());
+}
+
+TEST_F(SettingsManagerTest, Layers) {
+  WriteFile(defaults_path_, "Net/ThemeName \"Adwaita\"\nXft/DPI 98304\n"
+                            "Xft/Hinting 1\n");
+  WriteConfig("Xft/DPI 147456\n[night]\nNet/ThemeName \"Adwaita-dark\"\n");
+  SettingsManager manager(path_);
+  manager.SetDefaultsFilename(defaults_path_);
+  ASSERT_TRUE(manager.LoadConfig());
+  EXPECT_EQ("\"Adwaita\"",
+            manager.GetCurrentSetting("Net/ThemeName")->FormatValue());
+  EXPECT_EQ("147456", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  const uint32_t theme_serial =
+      manager.GetCurrentSetting("Net/ThemeName")->serial();
+  const uint32_t dpi_serial = manager.GetCurrentSetting("Xft/DPI")->serial();
+
+  // Changing the defaults only touches the settings that changed, and
+  // settings that the config file overrides are unaffected.
+  WriteFile(defaults_path_, "Net/ThemeName \"Adwaita\"\nXft/DPI 49152\n"
+                            "Xft/Hinting 0\n");
+  ASSERT_TRUE(manager.LoadConfig());
+  EXPECT_EQ("0", manager.GetCurrentSetting("Xft/Hinting")->FormatValue());
+  EXPECT_LT(theme_serial, manager.GetCurrentSetting("Xft/Hinting")->serial());
+  EXPECT_EQ(theme_serial,
+            manager.GetCurrentSetting("Net/ThemeName")->serial());
+  EXPECT_EQ(dpi_serial, manager.GetCurrentSetting("Xft/DPI")->serial());
+  EXPECT_NE(string::npos, manager.FormatStats().find(" settings_changed=1 "));
+
+  // Runtime changes override both files in every profile, and removing a
+  // setting at runtime hides it.
+  SettingsMap changes;
+  (*changes.mutable_map())["Xft/DPI"] = new IntegerSetting(5);
+  (*changes.mutable_map())["Xft/Hinting"] = NULL;
+  string error;
+  ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  EXPECT_EQ("5", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  EXPECT_TRUE(manager.GetCurrentSetting("Xft/Hinting") == NULL);
+  ASSERT_TRUE(manager.SwitchProfile("night", &error)) << error;
+  EXPECT_EQ("\"Adwaita-dark\"",
+            manager.GetCurrentSetting("Net/ThemeName")->FormatValue());
+  EXPECT_EQ("5", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  EXPECT_TRUE(manager.GetCurrentSetting("Xft/Hinting") == NULL);
+
+  // Reloading drops the runtime layer.
+  ASSERT_TRUE(manager.LoadConfig());
+  EXPECT_EQ("147456", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  EXPECT_EQ("0", manager.GetCurrentSetting("Xft/Hinting")->FormatValue());
+}
+
+TEST_F(SettingsManagerTest, ScreenSize) {
+  WriteConfig("Net/ThemeName \"Adwaita\"\n"
+              "[night]\nNet/ThemeName \"Adwaita-dark\"\n");
+  SettingsManager manager(path_);
+  ASSERT_TRUE(manager.InitState(state_path()));
+  ASSERT_TRUE(manager.LoadConfig());
+  const uint32_t theme_serial =
+      manager.GetCurrentSetting("Net/ThemeName")->serial();
+
+  // A 4K screen that's half a meter wide is about 192 DPI, so it should be
+  // scaled by 2.
+  manager.UpdateScreenSize(3840, 508);
+  EXPECT_EQ(StringPrintf("%d", 192 * 1024),
+            manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  const char kScaleName[] = "Gdk/WindowScalingFactor";
+  EXPECT_EQ("2", manager.GetCurrentSetting(kScaleName)->FormatValue());
+  EXPECT_EQ(StringPrintf("%d", 96 * 1024),
+            manager.GetCurrentSetting("Gdk/UnscaledDPI")->FormatValue());
+  EXPECT_EQ(theme_serial,
+            manager.GetCurrentSetting("Net/ThemeName")->serial());
+  const uint32_t dpi_serial = manager.GetCurrentSetting("Xft/DPI")->serial();
+  EXPECT_LT(theme_serial, dpi_serial);
+
+  // Only settings whose values change get new serials, and a screen change
+  // that doesn't affect them doesn't publish anything.
+  manager.UpdateScreenSize(1920, 508);
+  EXPECT_EQ("1", manager.GetCurrentSetting(kScaleName)->FormatValue());
+  EXPECT_EQ(dpi_serial, manager.GetCurrentSetting("Gdk/UnscaledDPI")->serial());
+
+  // The changed records are rewritten in the published property.
+  {
+    SettingsManager restored(path_);
+    ASSERT_TRUE(restored.InitState(state_path()));
+    const Setting* scale = restored.GetCurrentSetting(kScaleName);
+    ASSERT_TRUE(scale != NULL);
+    EXPECT_EQ("1", scale->FormatValue());
+    EXPECT_EQ(manager.GetCurrentSetting(kScaleName)->serial(),
+              scale->serial());
+    EXPECT_EQ(StringPrintf("%d", 96 * 1024),
+              restored.GetCurrentSetting("Xft/DPI")->FormatValue());
+  }
+  const string stats = manager.FormatStats();
+  manager.UpdateScreenSize(1920, 508);
+  EXPECT_EQ(stats, manager.FormatStats());
+
+  // The derived settings apply to every profile and survive reloads, but
+  // values set in the config file take precedence over them.
+  string error;
+  ASSERT_TRUE(manager.SwitchProfile("night", &error)) << error;
+  EXPECT_EQ(StringPrintf("%d", 96 * 1024),
+            manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  WriteConfig("Net/ThemeName \"Adwaita\"\nXft/DPI 147456\n"
+              "[night]\nNet/ThemeName \"Adwaita-dark\"\n");
+  ASSERT_TRUE(manager.LoadConfig());
+  EXPECT_EQ("147456", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  EXPECT_EQ("1", manager.GetCurrentSetting(kScaleName)->FormatValue());
+  manager.UpdateScreenSize(3840, 508);
+  EXPECT_EQ("147456", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  EXPECT_EQ("2", manager.GetCurrentSetting(kScaleName)->FormatValue());
+
+  // If the screen's physical size is unknown, the config's values are used.
+  manager.UpdateScreenSize(1920, 0);
+  EXPECT_EQ("147456", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  EXPECT_TRUE(manager.GetCurrentSetting(kScaleName) == NULL);
+}
+
+TEST_F(SettingsManagerTest, RestoreSerials) {
+  WriteConfig("Net/ThemeName \"Adwaita\"\nXft/DPI 98304\nXft/Hinting 1\n");
+  uint32_t theme_serial = 0;
+  {
+    SettingsManager manager(path_);
+    ASSERT_TRUE(manager.InitState(state_path()));
+    ASSERT_TRUE(manager.LoadConfig());
+
+    // Publish a few generations so that the settings end up with different
+    // serials.
+    string error;
+    for (int i = 0; i < 3; ++i) {
+      SettingsMap changes;
+      (*changes.mutable_map())["Xft/DPI"] = new IntegerSetting(i);
+      ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+    }
+    theme_serial = manager.GetCurrentSetting("Net/ThemeName")->serial();
+    EXPECT_EQ(4, manager.GetCurrentSetting("Xft/DPI")->serial());
+  }
+
+  // After a restart, unchanged settings should keep their serials, and the
+  // one whose value differs from what was last published should get a new
+  // one.
+  SettingsManager manager(path_);
+  ASSERT_TRUE(manager.InitState(state_path()));
+  ASSERT_TRUE(manager.LoadConfig());
+  EXPECT_EQ(theme_serial,
+            manager.GetCurrentSetting("Net/ThemeName")->serial());
+  EXPECT_EQ(5, manager.GetCurrentSetting("Xft/DPI")->serial());
+
+  // A missing state file just means that we start from scratch.
+  unlink(state_path().c_str());
+  SettingsManager new_manager(path_);
+  ASSERT_TRUE(new_manager.InitState(state_path()));
+  ASSERT_TRUE(new_manager.LoadConfig());
+  EXPECT_EQ(1, new_manager.GetCurrentSetting("Xft/DPI")->serial());
+}
+
+TEST_F(SettingsManagerTest, CoalescePublishes) {
+  WriteConfig("Net/ThemeName \"Adwaita\"\nXft/DPI 98304\n");
+  SettingsManager manager(path_);
+  ASSERT_TRUE(manager.InitState(state_path()));
+  ASSERT_TRUE(manager.LoadConfig());
+  manager.SetPublishSchedule(60, 0);
+
+  // Changes made within the delay go out in a single publish.
+  string error;
+  for (int i = 0; i < 3; ++i) {
+    SettingsMap changes;
+    (*changes.mutable_map())["Xft/DPI"] = new IntegerSetting(i);
+    ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  }
+  manager.UpdateScreenSize(3840, 508);
+  EXPECT_EQ(0U, manager.stats_.counter(Stats::COUNTER_PUBLISHES));
+  EXPECT_EQ(3U, manager.stats_.counter(Stats::COUNTER_PUBLISHES_COALESCED));
+  const double deadline = manager.publish_deadline_;
+  ASSERT_GT(deadline, 0);
+  manager.PublishIfDue(deadline - 1);
+  EXPECT_EQ(0U, manager.stats_.counter(Stats::COUNTER_PUBLISHES));
+
+  // Subscribers aren't notified until the changes are published.
+  EXPECT_EQ(1U, manager.notify_names_.count("Xft/DPI"));
+  EXPECT_EQ(1U, manager.notify_names_.count("Gdk/WindowScalingFactor"));
+  manager.PublishIfDue(deadline);
+  EXPECT_EQ(1U, manager.stats_.counter(Stats::COUNTER_PUBLISHES));
+  EXPECT_EQ(0, manager.publish_deadline_);
+  EXPECT_TRUE(manager.notify_names_.empty());
+  {
+    SettingsManager restored(path_);
+    ASSERT_TRUE(restored.InitState(state_path()));
+    EXPECT_EQ("2", restored.GetCurrentSetting("Xft/DPI")->FormatValue());
+    EXPECT_EQ("2", restored.GetCurrentSetting("Gdk/WindowScalingFactor")->
+                       FormatValue());
+  }
+
+  // Without a delay, changes are published immediately unless the last
+  // publish was too recent.
+  manager.SetPublishSchedule(0, 60);
+  SettingsMap changes;
+  (*changes.mutable_map())["Xft/DPI"] = new IntegerSetting(5);
+  ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  EXPECT_EQ(1U, manager.stats_.counter(Stats::COUNTER_PUBLISHES));
+  EXPECT_GE(manager.publish_deadline_, manager.last_publish_time_ + 60);
+  manager.PublishIfDue(manager.publish_deadline_);
+  EXPECT_EQ(2U, manager.stats_.counter(Stats::COUNTER_PUBLISHES));
+
+  manager.SetPublishSchedule(0, 0);
+  (*changes.mutable_map())["Xft/DPI"] = new IntegerSetting(6);
+  ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  EXPECT_EQ(3U, manager.stats_.counter(Stats::COUNTER_PUBLISHES));
+  EXPECT_EQ(0, manager.publish_deadline_);
+}
+
+TEST_F(SettingsManagerTest, RollBack) {
+  WriteConfig("Net/ThemeName \"Adwaita\"\nXft/DPI 98304\n");
+  SettingsManager manager(path_);
+  ASSERT_TRUE(manager.InitState(state_path()));
+  ASSERT_TRUE(manager.LoadConfig());
+  SettingsMap changes;
+  (*changes.mutable_map())["Xft/Hinting"] = new IntegerSetting(1);
+  string error;
+  ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  EXPECT_FALSE(manager.RollBack(1, &error));
+  EXPECT_EQ("Only 0 earlier generations are available", error);
+
+  // A bad config is published.
+  WriteConfig("Net/ThemeName \"Broken\"\n");
+  manager.ReloadConfig();
+  EXPECT_EQ("\"Broken\"",
+            manager.GetCurrentSetting("Net/ThemeName")->FormatValue());
+  EXPECT_TRUE(manager.GetCurrentSetting("Xft/Hinting") == NULL);
+  const uint32_t bad_serial = manager.serial_;
+
+  // Rolling back restores the earlier settings with new serials, and the
+  // republished property matches them.
+  ASSERT_TRUE(manager.RollBack(1, &error)) << error;
+  EXPECT_EQ(bad_serial + 1, manager.serial_);
+  EXPECT_EQ("\"Adwaita\"",
+            manager.GetCurrentSetting("Net/ThemeName")->FormatValue());
+  EXPECT_EQ("98304", manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  EXPECT_EQ("1", manager.GetCurrentSetting("Xft/Hinting")->FormatValue());
+  EXPECT_EQ(bad_serial + 1,
+            manager.GetCurrentSetting("Net/ThemeName")->serial());
+  EXPECT_EQ(1U, manager.stats_.counter(Stats::COUNTER_ROLLBACKS));
+  {
+    SettingsManager restored(path_);
+    ASSERT_TRUE(restored.InitState(state_path()));
+    EXPECT_EQ(bad_serial + 1, restored.serial_);
+    for (SettingsMap::Map::const_iterator it =
+             manager.settings_.map().begin();
+         it != manager.settings_.map().end(); ++it) {
+      const Setting* setting = restored.GetCurrentSetting(it->first);
+      ASSERT_TRUE(setting != NULL) << it->first;
+      EXPECT_TRUE(*setting == *it->second) << it->first;
+      EXPECT_EQ(it->second->serial(), setting->serial()) << it->first;
+    }
+    EXPECT_EQ(manager.settings_.map().size(),
+              restored.settings_.map().size());
+  }
+
+  // The rollback lasts until the next reload.
+  manager.ReloadConfig();
+  EXPECT_EQ("\"Broken\"",
+            manager.GetCurrentSetting("Net/ThemeName")->FormatValue());
+
+  // Only the configured number of generations is kept.
+  manager.SetHistorySize(1);
+  EXPECT_FALSE(manager.RollBack(1, &error));
+  EXPECT_EQ("Only 0 earlier generations are available", error);
+}
+
+TEST_F(SettingsManagerTest, RollBackRepeatedly) {
+  WriteConfig("Xft/DPI 98304\n");
+  SettingsManager manager(path_);
+  ASSERT_TRUE(manager.LoadConfig());
+  string error;
+  for (int i = 1; i <= 3; ++i) {
+    SettingsMap changes;
+    (*changes.mutable_map())["Xft/Hinting"] = new IntegerSetting(i);
+    ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  }
+
+  // Rolling back by one again keeps going back instead of returning to the
+  // settings that were rolled back from.
+  ASSERT_TRUE(manager.RollBack(1, &error)) << error;
+  EXPECT_EQ("2", manager.GetCurrentSetting("Xft/Hinting")->FormatValue());
+  ASSERT_TRUE(manager.RollBack(1, &error)) << error;
+  EXPECT_EQ("1", manager.GetCurrentSetting("Xft/Hinting")->FormatValue());
+  EXPECT_FALSE(manager.RollBack(1, &error));
+  EXPECT_EQ("Only 0 earlier generations are available", error);
+
+  // Changes that are waiting for a coalesced publish aren't in the
+  // history yet.  Rolling back by one discards them and restores the
+  // settings that were last published.
+  SettingsMap changes;
+  (*changes.mutable_map())["Xft/Hinting"] = new IntegerSetting(5);
+  ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  manager.SetPublishSchedule(60, 0);
+  (*changes.mutable_map())["Xft/Hinting"] = new IntegerSetting(6);
+  ASSERT_TRUE(manager.ApplyChanges(&changes, &error)) << error;
+  ASSERT_GT(manager.publish_deadline_, 0);
+  ASSERT_TRUE(manager.RollBack(1, &error)) << error;
+  EXPECT_EQ("5", manager.GetCurrentSetting("Xft/Hinting")->FormatValue());
+  manager.PublishIfDue(manager.publish_deadline_);
+  ASSERT_TRUE(manager.RollBack(1, &error)) << error;
+  EXPECT_EQ("1", manager.GetCurrentSetting("Xft/Hinting")->FormatValue());
+}
+
+TEST_F(SettingsManagerTest, ScreenChangeAfterRollBack) {
+  WriteConfig("Net/ThemeName \"Adwaita\"\n");
+  SettingsManager manager(path_);
+  ASSERT_TRUE(manager.LoadConfig());
+  manager.UpdateScreenSize(1920, 508);
+  manager.UpdateScreenSize(3840, 508);
+  EXPECT_EQ(StringPrintf("%d", 192 * 1024),
+            manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+
+  // The earlier derived settings are restored as runtime changes, so they
+  // hide later screen changes.
+  string error;
+  ASSERT_TRUE(manager.RollBack(1, &error)) << error;
+  EXPECT_EQ(StringPrintf("%d", 96 * 1024),
+            manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  manager.UpdateScreenSize(2560, 508);
+  EXPECT_EQ(StringPrintf("%d", 96 * 1024),
+            manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+
+  // Reloading discards the rollback, revealing the current screen's
+  // settings.
+  ASSERT_TRUE(manager.LoadConfig());
+  EXPECT_EQ(StringPrintf("%d", 128 * 1024),
+            manager.GetCurrentSetting("Xft/DPI")->FormatValue());
+  EXPECT_EQ("\"Adwaita\"",
+            manager.GetCurrentSetting("Net/ThemeName")->FormatValue());
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,156 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include "sha256.h"
+
+#include <algorithm>
+#include <cstring>
+
+using std::string;
+
+namespace xsettingsd {
+
+namespace {
+
+const uint32_t kRoundConstants[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t RotateRight(uint32_t value, int bits) {
+  return (value >> bits) | (value << (32 - bits));
+}
+
+}  // namespace
+
+const size_t Sha256::kDigestSize;
+
+Sha256::Sha256()
+    : buffer_size_(0),
+      message_size_(0) {
+  state_[0] = 0x6a09e667;
+  state_[1] = 0xbb67ae85;
+  state_[2] = 0x3c6ef372;
+  state_[3] = 0xa54ff53a;
+  state_[4] = 0x510e527f;
+  state_[5] = 0x9b05688c;
+  state_[6] = 0x1f83d9ab;
+  state_[7] = 0x5be0cd19;
+}
+
+void Sha256::Update(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  message_size_ += size;
+
+  if (buffer_size_ > 0) {
+    const size_t num_bytes = std::min(size, sizeof(buffer_) - buffer_size_);
+    memcpy(buffer_ + buffer_size_, bytes, num_bytes);
+    buffer_size_ += num_bytes;
+    bytes += num_bytes;
+    size -= num_bytes;
+    if (buffer_size_ < sizeof(buffer_))
+      return;
+    ProcessBlock(buffer_);
+    buffer_size_ = 0;
+  }
+
+  // Hash whole blocks straight out of the caller's buffer.
+  for (; size >= sizeof(buffer_); bytes += sizeof(buffer_),
+       size -= sizeof(buffer_)) {
+    ProcessBlock(bytes);
+  }
+  memcpy(buffer_, bytes, size);
+  buffer_size_ = size;
+}
+
+void Sha256::Finish(uint8_t* digest_out) {
+  // Append a 1 bit, pad with zeros to 56 bytes mod 64, and append the
+  // message's size in bits as a big-endian 64-bit number.
+  const uint64_t num_bits = message_size_ * 8;
+  const uint8_t padding[64] = { 0x80 };
+  const size_t padding_size = (buffer_size_ < 56) ?
+      56 - buffer_size_ : 120 - buffer_size_;
+  Update(padding, padding_size);
+  uint8_t size_bytes[8];
+  for (int i = 0; i < 8; ++i)
+    size_bytes[i] = num_bits >> (56 - 8 * i);
+  Update(size_bytes, sizeof(size_bytes));
+
+  for (int i = 0; i < 8; ++i) {
+    digest_out[4 * i] = state_[i] >> 24;
+    digest_out[4 * i + 1] = state_[i] >> 16;
+    digest_out[4 * i + 2] = state_[i] >> 8;
+    digest_out[4 * i + 3] = state_[i];
+  }
+}
+
+// static
+string Sha256::Hash(const void* data, size_t size) {
+  Sha256 sha;
+  sha.Update(data, size);
+  uint8_t digest[kDigestSize];
+  sha.Finish(digest);
+  return string(reinterpret_cast<const char*>(digest), sizeof(digest));
+}
+
+void Sha256::ProcessBlock(const uint8_t* block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = (static_cast<uint32_t>(block[4 * i]) << 24) |
+           (static_cast<uint32_t>(block[4 * i + 1]) << 16) |
+           (static_cast<uint32_t>(block[4 * i + 2]) << 8) |
+           static_cast<uint32_t>(block[4 * i + 3]);
+  }
+  for (int i = 16; i < 64; ++i) {
+    const uint32_t s0 = RotateRight(w[i - 15], 7) ^
+                        RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const uint32_t s1 = RotateRight(w[i - 2], 17) ^
+                        RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+  for (int i = 0; i < 64; ++i) {
+    const uint32_t s1 =
+        RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+    const uint32_t ch = (e & f) ^ (~e & g);
+    const uint32_t temp1 = h + s1 + ch + kRoundConstants[i] + w[i];
+    const uint32_t s0 =
+        RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+    const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    const uint32_t temp2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + temp1;
+    d = c;
+    c = b;
+    b = a;
+    a = temp1 + temp2;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
+
+}  // namespace xsettingsd
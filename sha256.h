@@ -0,0 +1,52 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_SHA256_H__
+#define __XSETTINGSD_SHA256_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "common.h"
+
+namespace xsettingsd {
+
+// Computes a SHA-256 digest (FIPS 180-4) incrementally.
+class Sha256 {
+ public:
+  // Size of a digest in bytes.
+  static const size_t kDigestSize = 32;
+
+  Sha256();
+
+  // Add 'size' bytes from 'data' to the message.
+  void Update(const void* data, size_t size);
+
+  // Finish the message and write its digest to 'digest_out', which must
+  // hold kDigestSize bytes.  The object may not be used afterward.
+  void Finish(uint8_t* digest_out);
+
+  // Convenience method that returns the digest of 'data' as a string of
+  // kDigestSize bytes.
+  static std::string Hash(const void* data, size_t size);
+
+ private:
+  // Process the 64-byte block in 'block'.
+  void ProcessBlock(const uint8_t* block);
+
+  uint32_t state_[8];
+
+  // Bytes that don't yet fill a block.
+  uint8_t buffer_[64];
+  size_t buffer_size_;
+
+  // Total size of the message in bytes.
+  uint64_t message_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(Sha256);
+};
+
+}  // namespace xsettingsd
+
+#endif
@@ -0,0 +1,62 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <algorithm>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "common.h"
+#include "sha256.h"
+
+using std::string;
+
+namespace xsettingsd {
+
+// Format 'digest' as lowercase hexadecimal.
+static string FormatDigest(const string& digest) {
+  string output;
+  for (size_t i = 0; i < digest.size(); ++i)
+    output += StringPrintf("%02x", static_cast<unsigned char>(digest[i]));
+  return output;
+}
+
+TEST(Sha256Test, Hash) {
+  // Test vectors from FIPS 180-4's examples.
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb924"
+            "27ae41e4649b934ca495991b7852b855",
+            FormatDigest(Sha256::Hash("", 0)));
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223"
+            "b00361a396177a9cb410ff61f20015ad",
+            FormatDigest(Sha256::Hash("abc", 3)));
+  const string message =
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039"
+            "a33ce45964ff2167f6ecedd419db06c1",
+            FormatDigest(Sha256::Hash(message.data(), message.size())));
+}
+
+TEST(Sha256Test, Update) {
+  // A million 'a's, fed in pieces that don't line up with blocks.
+  const string data(1000, 'a');
+  Sha256 sha;
+  size_t total = 0;
+  for (size_t size = 1; total < 1000000; size = size % 997 + 1) {
+    const size_t num_bytes = std::min(size, 1000000 - total);
+    sha.Update(data.data(), num_bytes);
+    total += num_bytes;
+  }
+  uint8_t digest[Sha256::kDigestSize];
+  sha.Finish(digest);
+  EXPECT_EQ("cdc76e5c9914fb9281a1c7e284d73e67"
+            "f1809a48a497200e046d39ccc7112cd0",
+            FormatDigest(string(reinterpret_cast<char*>(digest),
+                                sizeof(digest))));
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,380 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+#include "data_reader.h"
+#include "logging.h"
+#include "setting.h"
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace xsettingsd {
+
+static const char kMagic[8] = { 'X', 'S', 'E', 'T', 'S', 'N', 'A', 'P' };
+static const uint32_t kVersion = 1;
+
+// Initial number of bytes available for data and the index.
+static const size_t kInitialCapacity = 16 * 1024;
+
+// Number of times that readers retry before giving up on a writer that
+// seems to have died mid-update.
+static const int kMaxReadAttempts = 100000;
+
+// Returns the offset of the index within the part of the file following the
+// header.
+static size_t GetIndexOffset(size_t data_size) {
+  return data_size + GetPadding(data_size, 4);
+}
+
+// Walk the property read by 'reader', appending an index entry for each
+// setting to 'index_out' and saving the header serial to 'serial_out'.  The
+// decoded settings are also saved to 'settings_out' if it is non-NULL.
+template <bool kReverseBytes>
+static bool BuildIndex(BasicDataReader<kReverseBytes>* reader,
+                       uint32_t* serial_out,
+                       vector<SnapshotIndexEntry>* index_out,
+                       SettingsMap* settings_out) {
+  uint32_t num_settings = 0;
+  if (!reader->ReadBytes(NULL, 4) ||
+      !reader->ReadInt32(reinterpret_cast<int32_t*>(serial_out)) ||
+      !reader->ReadInt32(reinterpret_cast<int32_t*>(&num_settings)))
+    return false;
+
+  for (uint32_t i = 0; i < num_settings; ++i) {
+    SnapshotIndexEntry entry;
+    entry.record_offset = reader->bytes_read();
+    string name;
+    Setting* setting = Setting::Read(reader, &name);
+    if (!setting)
+      return false;
+    entry.record_size = reader->bytes_read() - entry.record_offset;
+    entry.name_offset = entry.record_offset + 4;
+    entry.name_size = name.size();
+    entry.serial = setting->serial();
+    entry.type = setting->type();
+    index_out->push_back(entry);
+    if (settings_out)
+      settings_out->mutable_map()->insert(make_pair(name, setting));
+    else
+      delete setting;
+  }
+  return true;
+}
+
+// Like the above, but handles the byte order of the property in 'data'.
+static bool BuildIndex(const char* data,
+                       size_t size,
+                       uint32_t* serial_out,
+                       vector<SnapshotIndexEntry>* index_out,
+                       SettingsMap* settings_out) {
+  return ReadProperty(data, size, [&](auto* reader) {
+    return BuildIndex(reader, serial_out, index_out, settings_out);
+  });
+}
+
+SnapshotWriter::SnapshotWriter(const string& path)
+    : path_(path),
+      mapping_(NULL),
+      mapping_size_(0) {
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  if (mapping_) {
+    Unmap();
+    unlink(path_.c_str());
+  }
+}
+
+bool SnapshotWriter::Init() {
+  return CreateFile(kInitialCapacity);
+}
+
+bool SnapshotWriter::Publish(const char* data, size_t size) {
+  assert(mapping_);
+
+  uint32_t serial = 0;
+  vector<SnapshotIndexEntry> index;
+  if (!BuildIndex(data, size, &serial, &index, NULL)) {
+    LOG(ERROR, "Unable to index property for snapshot");
+    return false;
+  }
+  // Readers binary-search the index by name.
+  std::sort(index.begin(), index.end(),
+            [data](const SnapshotIndexEntry& a, const SnapshotIndexEntry& b) {
+              return string_view(data + a.name_offset, a.name_size) <
+                     string_view(data + b.name_offset, b.name_size);
+            });
+
+  size_t needed =
+      GetIndexOffset(size) + index.size() * sizeof(SnapshotIndexEntry);
+  SnapshotHeader* header = reinterpret_cast<SnapshotHeader*>(mapping_);
+  if (needed > header->capacity) {
+    if (!CreateFile(needed * 2))
+      return false;
+    header = reinterpret_cast<SnapshotHeader*>(mapping_);
+  }
+
+  char* body = mapping_ + sizeof(SnapshotHeader);
+  uint32_t sequence = header->sequence | 1;
+  __atomic_store_n(&header->sequence, sequence, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  header->serial = serial;
+  header->data_size = size;
+  header->num_settings = index.size();
+  memcpy(body, data, size);
+  if (!index.empty()) {
+    memcpy(body + GetIndexOffset(size), &index[0],
+           index.size() * sizeof(SnapshotIndexEntry));
+  }
+
+  __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool SnapshotWriter::CreateFile(size_t capacity) {
+  string temp_path = path_ + ".tmp";
+  int fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+  if (fd < 0) {
+    LOG(ERROR, "Unable to create %s: %s", temp_path.c_str(), strerror(errno));
+    return false;
+  }
+
+  size_t size = sizeof(SnapshotHeader) + capacity;
+  void* mapping = MAP_FAILED;
+  if (ftruncate(fd, size) == 0)
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    LOG(ERROR, "Unable to map %s: %s", temp_path.c_str(), strerror(errno));
+    close(fd);
+    unlink(temp_path.c_str());
+    return false;
+  }
+  close(fd);
+
+  // Leave the sequence odd so that readers who open the new file wait for
+  // the first Publish() call to fill it in.
+  SnapshotHeader* header = static_cast<SnapshotHeader*>(mapping);
+  memcpy(header->magic, kMagic, sizeof(kMagic));
+  header->version = kVersion;
+  header->sequence = 1;
+  header->capacity = capacity;
+
+  if (rename(temp_path.c_str(), path_.c_str()) != 0) {
+    LOG(ERROR, "Unable to rename %s to %s: %s", temp_path.c_str(),
+        path_.c_str(), strerror(errno));
+    munmap(mapping, size);
+    unlink(temp_path.c_str());
+    return false;
+  }
+
+  if (mapping_) {
+    __atomic_store_n(&reinterpret_cast<SnapshotHeader*>(mapping_)->superseded,
+                     1, __ATOMIC_RELEASE);
+    Unmap();
+  }
+
+  mapping_ = static_cast<char*>(mapping);
+  mapping_size_ = size;
+  return true;
+}
+
+void SnapshotWriter::Unmap() {
+  if (mapping_) {
+    munmap(mapping_, mapping_size_);
+    mapping_ = NULL;
+    mapping_size_ = 0;
+  }
+}
+
+SnapshotReader::SnapshotReader(const string& path)
+    : path_(path),
+      mapping_(NULL),
+      mapping_size_(0) {
+}
+
+SnapshotReader::~SnapshotReader() {
+  Unmap();
+}
+
+bool SnapshotReader::Open() {
+  Unmap();
+
+  int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  void* mapping = MAP_FAILED;
+  if (fstat(fd, &st) == 0 &&
+      static_cast<size_t>(st.st_size) >= sizeof(SnapshotHeader)) {
+    mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return false;
+
+  const SnapshotHeader* header = static_cast<const SnapshotHeader*>(mapping);
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kVersion ||
+      sizeof(SnapshotHeader) + header->capacity >
+          static_cast<size_t>(st.st_size)) {
+    munmap(mapping, st.st_size);
+    return false;
+  }
+
+  mapping_ = static_cast<const char*>(mapping);
+  mapping_size_ = st.st_size;
+  return true;
+}
+
+bool SnapshotReader::ReadProperty(string* data_out, uint32_t* serial_out) {
+  if (!ReopenIfSuperseded())
+    return false;
+
+  const SnapshotHeader* header =
+      reinterpret_cast<const SnapshotHeader*>(mapping_);
+  const char* body = mapping_ + sizeof(SnapshotHeader);
+  for (int attempt = 0; attempt < kMaxReadAttempts; ++attempt) {
+    uint32_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+    if (sequence % 2)
+      continue;
+
+    uint32_t serial = header->serial;
+    uint32_t data_size = header->data_size;
+    if (data_size > header->capacity)
+      continue;
+    if (data_out)
+      data_out->assign(body, data_size);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&header->sequence, __ATOMIC_RELAXED) != sequence)
+      continue;
+    if (serial_out)
+      *serial_out = serial;
+    return true;
+  }
+  return false;
+}
+
+bool SnapshotReader::ReadSettings(SettingsMap* settings_out,
+                                  uint32_t* serial_out) {
+  assert(settings_out);
+
+  string data;
+  uint32_t serial = 0;
+  if (!ReadProperty(&data, &serial))
+    return false;
+
+  SettingsMap settings;
+  vector<SnapshotIndexEntry> index;
+  if (!BuildIndex(data.data(), data.size(), &serial, &index, &settings))
+    return false;
+
+  settings_out->swap(&settings);
+  if (serial_out)
+    *serial_out = serial;
+  return true;
+}
+
+Setting* SnapshotReader::ReadSetting(const string& name) {
+  if (!ReopenIfSuperseded())
+    return NULL;
+
+  const SnapshotHeader* header =
+      reinterpret_cast<const SnapshotHeader*>(mapping_);
+  const char* body = mapping_ + sizeof(SnapshotHeader);
+  for (int attempt = 0; attempt < kMaxReadAttempts; ++attempt) {
+    uint32_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+    if (sequence % 2)
+      continue;
+
+    // Everything read from the mapping may be torn until we've checked the
+    // sequence again, so validate offsets before following them.
+    // The index offset is rounded up from the data size, so it needs to be
+    // checked separately.
+    uint32_t capacity = header->capacity;
+    uint32_t data_size = header->data_size;
+    uint32_t num_settings = header->num_settings;
+    size_t index_offset = GetIndexOffset(data_size);
+    if (capacity > mapping_size_ - sizeof(SnapshotHeader) ||
+        data_size > capacity || index_offset > capacity ||
+        num_settings > (capacity - index_offset) / sizeof(SnapshotIndexEntry))
+      continue;
+    const SnapshotIndexEntry* index =
+        reinterpret_cast<const SnapshotIndexEntry*>(body + index_offset);
+
+    // Binary search for the name.
+    string record;
+    bool found = false;
+    size_t low = 0, high = num_settings;
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      SnapshotIndexEntry entry = index[mid];
+      if (entry.name_offset > data_size ||
+          entry.name_size > data_size - entry.name_offset ||
+          entry.record_offset > data_size ||
+          entry.record_size > data_size - entry.record_offset)
+        break;
+      int result = name.compare(0, string::npos,
+                                body + entry.name_offset, entry.name_size);
+      if (result == 0) {
+        record.assign(body + entry.record_offset, entry.record_size);
+        found = true;
+        break;
+      } else if (result < 0) {
+        high = mid;
+      } else {
+        low = mid + 1;
+      }
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&header->sequence, __ATOMIC_RELAXED) != sequence)
+      continue;
+    if (!found)
+      return NULL;
+
+    // The snapshot always uses the host's byte order.
+    DataReader reader(record.data(), record.size());
+    string record_name;
+    return Setting::Read(&reader, &record_name);
+  }
+  return NULL;
+}
+
+bool SnapshotReader::ReopenIfSuperseded() {
+  if (mapping_ &&
+      !__atomic_load_n(&reinterpret_cast<const SnapshotHeader*>(
+          mapping_)->superseded, __ATOMIC_ACQUIRE)) {
+    return true;
+  }
+  return Open();
+}
+
+void SnapshotReader::Unmap() {
+  if (mapping_) {
+    munmap(const_cast<char*>(mapping_), mapping_size_);
+    mapping_ = NULL;
+    mapping_size_ = 0;
+  }
+}
+
+}  // namespace xsettingsd
@@ -0,0 +1,135 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_SNAPSHOT_H__
+#define __XSETTINGSD_SNAPSHOT_H__
+
+#include <cstdlib>  // for size_t
+#include <stdint.h>
+#include <string>
+
+#include "common.h"
+
+namespace xsettingsd {
+
+class Setting;
+class SettingsMap;
+
+// A snapshot file holds a copy of the most-recently-published
+// _XSETTINGS_SETTINGS property so that local processes can read the
+// current settings without connecting to the X server.  It's laid out as a
+// SnapshotHeader, followed by the property data (in exactly the format
+// that's set on the X11 windows), followed by one SnapshotIndexEntry per
+// setting (sorted by name).  All fields use the host's byte order.
+//
+// The header's 'sequence' field is a seqlock: the writer makes it odd
+// before modifying the file and even again afterwards, so readers can copy
+// data without taking any locks and retry if the sequence changed.  When
+// the data outgrows the file, the writer renames a larger file into place
+// and sets 'superseded' in the old one so that readers know to reopen it.
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t sequence;
+  uint32_t superseded;
+
+  // Number of bytes available for data and the index after the header.
+  uint32_t capacity;
+
+  // Header serial from the property.
+  uint32_t serial;
+
+  // Size of the property data, which starts immediately after the header.
+  uint32_t data_size;
+
+  // Number of entries in the index, which starts immediately after the
+  // property data (rounded up to a multiple of 4 bytes).
+  uint32_t num_settings;
+
+  uint32_t reserved;
+};
+
+struct SnapshotIndexEntry {
+  // Offset of the setting's record within the property data.
+  uint32_t record_offset;
+  uint32_t record_size;
+
+  // Offset and size of the setting's name within the property data.
+  uint32_t name_offset;
+  uint32_t name_size;
+
+  uint32_t serial;
+  uint32_t type;
+};
+
+// Mirrors published properties into a snapshot file.
+class SnapshotWriter {
+ public:
+  explicit SnapshotWriter(const std::string& path);
+  ~SnapshotWriter();
+
+  const std::string& path() const { return path_; }
+
+  // Create the file.  Returns false and prints an error on failure.
+  bool Init();
+
+  // Copy 'data' (a complete _XSETTINGS_SETTINGS property) into the file.
+  bool Publish(const char* data, size_t size);
+
+ private:
+  // Create a new file with room for 'capacity' bytes after the header,
+  // map it, and atomically move it into place at 'path_'.
+  bool CreateFile(size_t capacity);
+
+  // Unmap the current file.
+  void Unmap();
+
+  std::string path_;
+
+  // Mapping of the current file, or NULL.
+  char* mapping_;
+  size_t mapping_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(SnapshotWriter);
+};
+
+// Reads settings from a snapshot file.  After Open() succeeds, reads don't
+// make any system calls unless the writer has replaced the file.
+class SnapshotReader {
+ public:
+  explicit SnapshotReader(const std::string& path);
+  ~SnapshotReader();
+
+  // Map the file.  Returns false if it doesn't exist or is invalid.
+  bool Open();
+
+  // Copy a consistent version of the property data to 'data_out' and its
+  // header serial to 'serial_out' (either may be NULL).
+  bool ReadProperty(std::string* data_out, uint32_t* serial_out);
+
+  // Decode all of the current settings into 'settings_out'.
+  bool ReadSettings(SettingsMap* settings_out, uint32_t* serial_out);
+
+  // Look up a single setting by name, returning a newly-allocated copy of
+  // it (which the caller is responsible for deleting) or NULL if it isn't
+  // set.
+  Setting* ReadSetting(const std::string& name);
+
+ private:
+  // Reopen the file if the writer has replaced it.
+  bool ReopenIfSuperseded();
+
+  // Unmap the current file.
+  void Unmap();
+
+  std::string path_;
+
+  const char* mapping_;
+  size_t mapping_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(SnapshotReader);
+};
+
+}  // namespace xsettingsd
+
+#endif
@@ -0,0 +1,205 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <X11/X.h>
+
+#include "data_writer.h"
+#include "setting.h"
+#include "snapshot.h"
+
+using std::string;
+
+namespace xsettingsd {
+
+class SnapshotTest : public testing::Test {
+ protected:
+  void SetUp() {
+    char dir[] = "/tmp/snapshot_test.XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+    path_ = dir_ + "/snapshot";
+  }
+
+  void TearDown() {
+    unlink(path_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  // Serialize 'settings' the same way that SettingsManager does.
+  string WriteProperty(const SettingsMap& settings, uint32_t serial) {
+    static const size_t kBufSize = 128 * 1024;
+    char buffer[kBufSize];
+    DataWriter writer(buffer, kBufSize);
+    EXPECT_TRUE(writer.WriteInt8(IsLittleEndian() ? LSBFirst : MSBFirst));
+    EXPECT_TRUE(writer.WriteZeros(3));
+    EXPECT_TRUE(writer.WriteInt32(serial));
+    EXPECT_TRUE(writer.WriteInt32(settings.map().size()));
+    for (SettingsMap::Map::const_iterator it = settings.map().begin();
+         it != settings.map().end(); ++it) {
+      EXPECT_TRUE(it->second->Write(it->first, &writer));
+    }
+    return string(buffer, writer.bytes_written());
+  }
+
+  // Add a setting to 'settings' with serial 'serial'.
+  void AddSetting(SettingsMap* settings,
+                  const string& name,
+                  Setting* setting,
+                  uint32_t serial) {
+    setting->UpdateSerial(NULL, serial);
+    settings->mutable_map()->insert(make_pair(name, setting));
+  }
+
+  string dir_;
+  string path_;
+};
+
+TEST_F(SnapshotTest, ReadAndWrite) {
+  SettingsMap settings;
+  AddSetting(&settings, "Net/ThemeName", new StringSetting("Adwaita"), 2);
+  AddSetting(&settings, "Xft/DPI", new IntegerSetting(98304), 3);
+  AddSetting(&settings, "Gtk/Color", new ColorSetting(1, 2, 3, 4), 3);
+  const string property = WriteProperty(settings, 3);
+
+  SnapshotReader reader(path_);
+  EXPECT_FALSE(reader.Open());
+
+  SnapshotWriter writer(path_);
+  ASSERT_TRUE(writer.Init());
+  ASSERT_TRUE(writer.Publish(property.data(), property.size()));
+
+  ASSERT_TRUE(reader.Open());
+  string data;
+  uint32_t serial = 0;
+  ASSERT_TRUE(reader.ReadProperty(&data, &serial));
+  EXPECT_EQ(property, data);
+  EXPECT_EQ(3, serial);
+
+  SettingsMap read_settings;
+  ASSERT_TRUE(reader.ReadSettings(&read_settings, &serial));
+  ASSERT_EQ(3, read_settings.map().size());
+  for (SettingsMap::Map::const_iterator it = settings.map().begin();
+       it != settings.map().end(); ++it) {
+    const Setting* read_setting = read_settings.GetSetting(it->first);
+    ASSERT_TRUE(read_setting != NULL) << it->first;
+    EXPECT_TRUE(*read_setting == *it->second) << it->first;
+    EXPECT_EQ(it->second->serial(), read_setting->serial()) << it->first;
+  }
+
+  Setting* setting = reader.ReadSetting("Xft/DPI");
+  ASSERT_TRUE(setting != NULL);
+  EXPECT_EQ("98304", setting->FormatValue());
+  EXPECT_EQ(3, setting->serial());
+  delete setting;
+
+  setting = reader.ReadSetting("Gtk/Color");
+  ASSERT_TRUE(setting != NULL);
+  EXPECT_EQ("(1, 2, 3, 4)", setting->FormatValue());
+  delete setting;
+
+  EXPECT_TRUE(reader.ReadSetting("Missing") == NULL);
+  EXPECT_TRUE(reader.ReadSetting("") == NULL);
+}
+
+TEST_F(SnapshotTest, Grow) {
+  SnapshotWriter writer(path_);
+  ASSERT_TRUE(writer.Init());
+
+  SettingsMap settings;
+  AddSetting(&settings, "Short", new StringSetting("short"), 1);
+  string property = WriteProperty(settings, 1);
+  ASSERT_TRUE(writer.Publish(property.data(), property.size()));
+
+  SnapshotReader reader(path_);
+  ASSERT_TRUE(reader.Open());
+  Setting* setting = reader.ReadSetting("Short");
+  ASSERT_TRUE(setting != NULL);
+  delete setting;
+
+  // Publishing more data than fits in the file should make the writer
+  // replace it, and the reader should follow along.
+  AddSetting(&settings, "Long", new StringSetting(string(64 * 1024, 'x')), 2);
+  property = WriteProperty(settings, 2);
+  ASSERT_TRUE(writer.Publish(property.data(), property.size()));
+
+  string data;
+  uint32_t serial = 0;
+  ASSERT_TRUE(reader.ReadProperty(&data, &serial));
+  EXPECT_EQ(property, data);
+  EXPECT_EQ(2, serial);
+  setting = reader.ReadSetting("Long");
+  ASSERT_TRUE(setting != NULL);
+  EXPECT_EQ(2, setting->serial());
+  delete setting;
+}
+
+TEST_F(SnapshotTest, UnsortedProperty) {
+  // Write the records in reverse order.
+  SettingsMap settings;
+  AddSetting(&settings, "A", new IntegerSetting(1), 1);
+  AddSetting(&settings, "B", new IntegerSetting(2), 1);
+  AddSetting(&settings, "C", new IntegerSetting(3), 1);
+  char buffer[1024];
+  DataWriter writer(buffer, sizeof(buffer));
+  ASSERT_TRUE(writer.WriteInt8(IsLittleEndian() ? LSBFirst : MSBFirst));
+  ASSERT_TRUE(writer.WriteZeros(3));
+  ASSERT_TRUE(writer.WriteInt32(1));
+  ASSERT_TRUE(writer.WriteInt32(settings.map().size()));
+  for (SettingsMap::Map::const_reverse_iterator it =
+           settings.map().rbegin();
+       it != settings.map().rend(); ++it) {
+    ASSERT_TRUE(it->second->Write(it->first, &writer));
+  }
+
+  SnapshotWriter snapshot_writer(path_);
+  ASSERT_TRUE(snapshot_writer.Init());
+  ASSERT_TRUE(snapshot_writer.Publish(buffer, writer.bytes_written()));
+  SnapshotReader reader(path_);
+  ASSERT_TRUE(reader.Open());
+  for (SettingsMap::Map::const_iterator it = settings.map().begin();
+       it != settings.map().end(); ++it) {
+    Setting* setting = reader.ReadSetting(it->first);
+    ASSERT_TRUE(setting != NULL) << it->first;
+    EXPECT_TRUE(*setting == *it->second) << it->first;
+    delete setting;
+  }
+}
+
+TEST_F(SnapshotTest, TornHeader) {
+  SettingsMap settings;
+  AddSetting(&settings, "Xft/DPI", new IntegerSetting(98304), 1);
+  const string property = WriteProperty(settings, 1);
+  SnapshotWriter writer(path_);
+  ASSERT_TRUE(writer.Init());
+  ASSERT_TRUE(writer.Publish(property.data(), property.size()));
+
+  // A data size just below the capacity puts the (rounded-up) index past
+  // the end of the file.  The reader should give up rather than read it.
+  FILE* file = fopen(path_.c_str(), "r+");
+  ASSERT_TRUE(file != NULL);
+  SnapshotHeader header;
+  ASSERT_EQ(1U, fread(&header, sizeof(header), 1, file));
+  header.data_size = header.capacity - 1;
+  header.num_settings = 1000;
+  ASSERT_EQ(0, fseek(file, 0, SEEK_SET));
+  ASSERT_EQ(1U, fwrite(&header, sizeof(header), 1, file));
+  ASSERT_EQ(0, fclose(file));
+
+  SnapshotReader reader(path_);
+  ASSERT_TRUE(reader.Open());
+  EXPECT_TRUE(reader.ReadSetting("Xft/DPI") == NULL);
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
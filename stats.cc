@@ -0,0 +1,163 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include "stats.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include "logging.h"
+
+using std::string;
+
+namespace xsettingsd {
+
+static const char* kCounterNames[Stats::NUM_COUNTERS] = {
+  "reloads",
+  "reloads_skipped",
+  "reload_failures",
+  "publishes",
+  "publish_failures",
+  "publishes_coalesced",
+  "bytes_published",
+  "settings_added",
+  "settings_changed",
+  "settings_removed",
+  "profile_switches",
+  "rollbacks",
+  "log_messages_dropped",
+};
+
+static const char* kCounterDescriptions[Stats::NUM_COUNTERS] = {
+  "Config reloads that were parsed successfully.",
+  "Reloads that didn't change any settings and weren't published.",
+  "Reloads that failed because the config couldn't be read or parsed.",
+  "Times that the settings property was published.",
+  "Times that the settings property couldn't be serialized.",
+  "Changes that went out with an already-scheduled publish.",
+  "Bytes of settings property data published.",
+  "Settings added by reloads or runtime changes.",
+  "Settings changed by reloads or runtime changes.",
+  "Settings removed by reloads or runtime changes.",
+  "Times that a different profile was published.",
+  "Times that an earlier generation of settings was republished.",
+  "Log messages dropped because the log buffer was full.",
+};
+
+static const char* kStageNames[Stats::NUM_STAGES] = {
+  "reload",
+  "read",
+  "parse",
+  "diff",
+  "serialize",
+  "set_property",
+};
+
+Stats::ScopedTimer::ScopedTimer(Stats* stats, Stage stage)
+    : stats_(stats),
+      stage_(stage),
+      start_time_(GetMonotonicTime()) {
+  assert(stats_);
+}
+
+Stats::ScopedTimer::~ScopedTimer() {
+  stats_->AddTiming(stage_, GetMonotonicTime() - start_time_);
+}
+
+Stats::Stats() {
+  for (int i = 0; i < NUM_COUNTERS; ++i)
+    counters_[i] = 0;
+}
+
+void Stats::Increment(Counter counter, uint64_t amount) {
+  assert(counter >= 0 && counter < NUM_COUNTERS);
+  counters_[counter] += amount;
+}
+
+void Stats::Set(Counter counter, uint64_t value) {
+  assert(counter >= 0 && counter < NUM_COUNTERS);
+  counters_[counter] = value;
+}
+
+void Stats::AddTiming(Stage stage, double seconds) {
+  assert(stage >= 0 && stage < NUM_STAGES);
+  StageTimes* times = &stages_[stage];
+  times->count++;
+  times->total += seconds;
+  times->last = seconds;
+  if (seconds > times->max)
+    times->max = seconds;
+}
+
+string Stats::FormatPrometheus() const {
+  string output;
+  for (int i = 0; i < NUM_COUNTERS; ++i) {
+    output += StringPrintf(
+        "# HELP xsettingsd_%s_total %s\n"
+        "# TYPE xsettingsd_%s_total counter\n"
+        "xsettingsd_%s_total %llu\n",
+        kCounterNames[i], kCounterDescriptions[i], kCounterNames[i],
+        kCounterNames[i], static_cast<unsigned long long>(counters_[i]));
+  }
+
+  output +=
+      "# HELP xsettingsd_stage_runs_total Times that each stage has run.\n"
+      "# TYPE xsettingsd_stage_runs_total counter\n";
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    output += StringPrintf("xsettingsd_stage_runs_total{stage=\"%s\"} %llu\n",
+        kStageNames[i], static_cast<unsigned long long>(stages_[i].count));
+  }
+  output +=
+      "# HELP xsettingsd_stage_seconds_total Time spent in each stage.\n"
+      "# TYPE xsettingsd_stage_seconds_total counter\n";
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    output += StringPrintf(
+        "xsettingsd_stage_seconds_total{stage=\"%s\"} %.9f\n",
+        kStageNames[i], stages_[i].total);
+  }
+  output +=
+      "# HELP xsettingsd_stage_last_seconds Duration of each stage's most "
+      "recent run.\n"
+      "# TYPE xsettingsd_stage_last_seconds gauge\n";
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    output += StringPrintf(
+        "xsettingsd_stage_last_seconds{stage=\"%s\"} %.9f\n",
+        kStageNames[i], stages_[i].last);
+  }
+  output +=
+      "# HELP xsettingsd_stage_max_seconds Duration of each stage's slowest "
+      "run.\n"
+      "# TYPE xsettingsd_stage_max_seconds gauge\n";
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    output += StringPrintf(
+        "xsettingsd_stage_max_seconds{stage=\"%s\"} %.9f\n",
+        kStageNames[i], stages_[i].max);
+  }
+  return output;
+}
+
+string Stats::FormatSummary() const {
+  string output;
+  for (int i = 0; i < NUM_COUNTERS; ++i) {
+    output += StringPrintf("%s%s=%llu", output.empty() ? "" : " ",
+                           kCounterNames[i],
+                           static_cast<unsigned long long>(counters_[i]));
+  }
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    output += StringPrintf(" %s_runs=%llu %s_last=%.6f %s_max=%.6f",
+        kStageNames[i], static_cast<unsigned long long>(stages_[i].count),
+        kStageNames[i], stages_[i].last, kStageNames[i], stages_[i].max);
+  }
+  return output;
+}
+
+bool Stats::WriteToFile(const string& path) const {
+  if (!WriteFileAtomically(path, FormatPrometheus())) {
+    LOG(ERROR, "Unable to write %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+}  // namespace xsettingsd
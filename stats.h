@@ -0,0 +1,109 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_STATS_H__
+#define __XSETTINGSD_STATS_H__
+
+#include <stdint.h>
+#include <string>
+
+#include "common.h"
+
+namespace xsettingsd {
+
+// Stats holds counters and per-stage timings describing the work that the
+// daemon has done, so that slow reloads can be attributed to reading the
+// config file, parsing it, or talking to the X server.
+class Stats {
+ public:
+  enum Counter {
+    COUNTER_RELOADS = 0,
+    COUNTER_RELOADS_SKIPPED,
+    COUNTER_RELOAD_FAILURES,
+    COUNTER_PUBLISHES,
+    COUNTER_PUBLISH_FAILURES,
+    COUNTER_PUBLISHES_COALESCED,
+    COUNTER_BYTES_PUBLISHED,
+    COUNTER_SETTINGS_ADDED,
+    COUNTER_SETTINGS_CHANGED,
+    COUNTER_SETTINGS_REMOVED,
+    COUNTER_PROFILE_SWITCHES,
+    COUNTER_ROLLBACKS,
+    COUNTER_LOG_MESSAGES_DROPPED,
+    NUM_COUNTERS,
+  };
+
+  enum Stage {
+    // Applying a reloaded config and the subsequent publish (unless it's
+    // deferred).  Reading and parsing may happen on another thread
+    // beforehand.
+    STAGE_RELOAD = 0,
+    // Reading the config file from disk.
+    STAGE_READ,
+    // Parsing the config file.
+    STAGE_PARSE,
+    // Finding the settings that changed.
+    STAGE_DIFF,
+    // Serializing the property.
+    STAGE_SERIALIZE,
+    // Setting the property on all of the windows and flushing.
+    STAGE_SET_PROPERTY,
+    NUM_STAGES,
+  };
+
+  // Records the time between its creation and destruction for a stage.
+  class ScopedTimer {
+   public:
+    ScopedTimer(Stats* stats, Stage stage);
+    ~ScopedTimer();
+
+   private:
+    Stats* stats_;  // not owned
+    Stage stage_;
+    double start_time_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedTimer);
+  };
+
+  Stats();
+
+  uint64_t counter(Counter counter) const { return counters_[counter]; }
+  uint64_t stage_count(Stage stage) const { return stages_[stage].count; }
+
+  void Increment(Counter counter, uint64_t amount);
+
+  // Set a counter that's maintained elsewhere.
+  void Set(Counter counter, uint64_t value);
+
+  // Record that 'stage' took 'seconds'.
+  void AddTiming(Stage stage, double seconds);
+
+  // Format all of the stats in Prometheus's text exposition format.
+  std::string FormatPrometheus() const;
+
+  // Format all of the stats as space-separated NAME=VALUE pairs.
+  std::string FormatSummary() const;
+
+  // Atomically replace the file at 'path' with FormatPrometheus()'s
+  // output.
+  bool WriteToFile(const std::string& path) const;
+
+ private:
+  struct StageTimes {
+    StageTimes() : count(0), total(0.0), last(0.0), max(0.0) {}
+
+    uint64_t count;
+    double total;
+    double last;
+    double max;
+  };
+
+  uint64_t counters_[NUM_COUNTERS];
+  StageTimes stages_[NUM_STAGES];
+
+  DISALLOW_COPY_AND_ASSIGN(Stats);
+};
+
+}  // namespace xsettingsd
+
+#endif
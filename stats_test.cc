@@ -0,0 +1,62 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "stats.h"
+
+using std::string;
+
+namespace xsettingsd {
+
+TEST(StatsTest, Counters) {
+  Stats stats;
+  EXPECT_EQ(0, stats.counter(Stats::COUNTER_RELOADS));
+  stats.Increment(Stats::COUNTER_RELOADS, 1);
+  stats.Increment(Stats::COUNTER_BYTES_PUBLISHED, 100);
+  stats.Increment(Stats::COUNTER_BYTES_PUBLISHED, 20);
+  EXPECT_EQ(1, stats.counter(Stats::COUNTER_RELOADS));
+  EXPECT_EQ(120, stats.counter(Stats::COUNTER_BYTES_PUBLISHED));
+
+  string output = stats.FormatPrometheus();
+  EXPECT_NE(string::npos, output.find("\nxsettingsd_reloads_total 1\n"));
+  EXPECT_NE(string::npos,
+            output.find("\nxsettingsd_bytes_published_total 120\n"));
+  EXPECT_NE(string::npos,
+            output.find("# TYPE xsettingsd_reloads_total counter\n"));
+
+  output = stats.FormatSummary();
+  EXPECT_EQ(0, output.find("reloads=1 "));
+  EXPECT_NE(string::npos, output.find(" bytes_published=120 "));
+}
+
+TEST(StatsTest, Timings) {
+  Stats stats;
+  stats.AddTiming(Stats::STAGE_PARSE, 0.5);
+  stats.AddTiming(Stats::STAGE_PARSE, 0.25);
+  {
+    Stats::ScopedTimer timer(&stats, Stats::STAGE_READ);
+  }
+  EXPECT_EQ(2, stats.stage_count(Stats::STAGE_PARSE));
+  EXPECT_EQ(1, stats.stage_count(Stats::STAGE_READ));
+  EXPECT_EQ(0, stats.stage_count(Stats::STAGE_DIFF));
+
+  string output = stats.FormatPrometheus();
+  EXPECT_NE(string::npos, output.find(
+      "\nxsettingsd_stage_runs_total{stage=\"parse\"} 2\n"));
+  EXPECT_NE(string::npos, output.find(
+      "\nxsettingsd_stage_seconds_total{stage=\"parse\"} 0.750000000\n"));
+  EXPECT_NE(string::npos, output.find(
+      "\nxsettingsd_stage_last_seconds{stage=\"parse\"} 0.250000000\n"));
+  EXPECT_NE(string::npos, output.find(
+      "\nxsettingsd_stage_max_seconds{stage=\"parse\"} 0.500000000\n"));
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,154 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include "well_known_settings.h"
+
+#include <cassert>
+#include <stdint.h>
+
+namespace xsettingsd {
+
+namespace {
+
+struct WellKnownSetting {
+  std::string_view name;
+  Setting::Type type;
+};
+
+// See https://www.freedesktop.org/wiki/Specifications/XSettingsRegistry/
+// and GTK's gdksettings.c.
+constexpr WellKnownSetting kSettings[] = {
+  { "Gtk/AutoMnemonics",              Setting::TYPE_INTEGER },
+  { "Gtk/ButtonImages",               Setting::TYPE_INTEGER },
+  { "Gtk/CanChangeAccels",            Setting::TYPE_INTEGER },
+  { "Gtk/ColorPalette",               Setting::TYPE_STRING  },
+  { "Gtk/ColorScheme",                Setting::TYPE_STRING  },
+  { "Gtk/CursorBlinkTimeout",         Setting::TYPE_INTEGER },
+  { "Gtk/CursorThemeName",            Setting::TYPE_STRING  },
+  { "Gtk/CursorThemeSize",            Setting::TYPE_INTEGER },
+  { "Gtk/DecorationLayout",           Setting::TYPE_STRING  },
+  { "Gtk/DialogsUseHeader",           Setting::TYPE_INTEGER },
+  { "Gtk/EnableAnimations",           Setting::TYPE_INTEGER },
+  { "Gtk/EnablePrimaryPaste",         Setting::TYPE_INTEGER },
+  { "Gtk/FileChooserBackend",         Setting::TYPE_STRING  },
+  { "Gtk/FontName",                   Setting::TYPE_STRING  },
+  { "Gtk/IMModule",                   Setting::TYPE_STRING  },
+  { "Gtk/IMPreeditStyle",             Setting::TYPE_STRING  },
+  { "Gtk/IMStatusStyle",              Setting::TYPE_STRING  },
+  { "Gtk/KeyThemeName",               Setting::TYPE_STRING  },
+  { "Gtk/KeynavUseCaret",             Setting::TYPE_INTEGER },
+  { "Gtk/MenuBarAccel",               Setting::TYPE_STRING  },
+  { "Gtk/MenuImages",                 Setting::TYPE_INTEGER },
+  { "Gtk/OverlayScrolling",           Setting::TYPE_INTEGER },
+  { "Gtk/PrimaryButtonWarpsSlider",   Setting::TYPE_INTEGER },
+  { "Gtk/RecentFilesEnabled",         Setting::TYPE_INTEGER },
+  { "Gtk/RecentFilesMaxAge",          Setting::TYPE_INTEGER },
+  { "Gtk/ShellShowsAppMenu",          Setting::TYPE_INTEGER },
+  { "Gtk/ShellShowsDesktop",          Setting::TYPE_INTEGER },
+  { "Gtk/ShellShowsMenubar",          Setting::TYPE_INTEGER },
+  { "Gtk/ShowInputMethodMenu",        Setting::TYPE_INTEGER },
+  { "Gtk/ShowUnicodeMenu",            Setting::TYPE_INTEGER },
+  { "Gtk/TimeoutInitial",             Setting::TYPE_INTEGER },
+  { "Gtk/TimeoutRepeat",              Setting::TYPE_INTEGER },
+  { "Gtk/TitlebarDoubleClick",        Setting::TYPE_STRING  },
+  { "Gtk/TitlebarMiddleClick",        Setting::TYPE_STRING  },
+  { "Gtk/TitlebarRightClick",         Setting::TYPE_STRING  },
+  { "Gtk/ToolbarIconSize",            Setting::TYPE_STRING  },
+  { "Gtk/ToolbarStyle",               Setting::TYPE_STRING  },
+  { "Net/CursorBlink",                Setting::TYPE_INTEGER },
+  { "Net/CursorBlinkTime",            Setting::TYPE_INTEGER },
+  { "Net/DndDragThreshold",           Setting::TYPE_INTEGER },
+  { "Net/DoubleClickDistance",        Setting::TYPE_INTEGER },
+  { "Net/DoubleClickTime",            Setting::TYPE_INTEGER },
+  { "Net/EnableEventSounds",          Setting::TYPE_INTEGER },
+  { "Net/EnableInputFeedbackSounds",  Setting::TYPE_INTEGER },
+  { "Net/FallbackIconTheme",          Setting::TYPE_STRING  },
+  { "Net/IconThemeName",              Setting::TYPE_STRING  },
+  { "Net/SoundThemeName",             Setting::TYPE_STRING  },
+  { "Net/ThemeName",                  Setting::TYPE_STRING  },
+  { "Xft/Antialias",                  Setting::TYPE_INTEGER },
+  { "Xft/DPI",                        Setting::TYPE_INTEGER },
+  { "Xft/HintStyle",                  Setting::TYPE_STRING  },
+  { "Xft/Hinting",                    Setting::TYPE_INTEGER },
+  { "Xft/RGBA",                       Setting::TYPE_STRING  },
+  { "Xft/lcdfilter",                  Setting::TYPE_STRING  },
+};
+
+constexpr int kNumSettings = sizeof(kSettings) / sizeof(kSettings[0]);
+
+// Number of slots in the hash table.  With this many empty slots, a seed
+// that maps every name to a distinct slot turns up after a few dozen tries.
+constexpr uint32_t kNumSlots = 512;
+static_assert(kNumSettings < 128, "Too many settings for int8_t slots");
+
+// FNV-1a, with 'seed' mixed into the offset basis.
+constexpr uint32_t Hash(std::string_view name, uint32_t seed) {
+  uint32_t hash = 2166136261u ^ seed;
+  for (size_t i = 0; i < name.size(); ++i) {
+    hash ^= static_cast<uint8_t>(name[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Returns true if 'seed' maps every setting to a different slot.
+constexpr bool IsPerfectSeed(uint32_t seed) {
+  bool used[kNumSlots] = {};
+  for (int i = 0; i < kNumSettings; ++i) {
+    uint32_t slot = Hash(kSettings[i].name, seed) % kNumSlots;
+    if (used[slot])
+      return false;
+    used[slot] = true;
+  }
+  return true;
+}
+
+constexpr uint32_t FindSeed() {
+  uint32_t seed = 0;
+  while (!IsPerfectSeed(seed))
+    seed++;
+  return seed;
+}
+
+constexpr uint32_t kSeed = FindSeed();
+
+struct SlotTable {
+  // Index into 'kSettings' of the setting in each slot, or -1.
+  int8_t ids[kNumSlots];
+};
+
+constexpr SlotTable BuildSlotTable() {
+  SlotTable table = {};
+  for (uint32_t i = 0; i < kNumSlots; ++i)
+    table.ids[i] = -1;
+  for (int i = 0; i < kNumSettings; ++i)
+    table.ids[Hash(kSettings[i].name, kSeed) % kNumSlots] = i;
+  return table;
+}
+
+constexpr SlotTable kSlotTable = BuildSlotTable();
+
+}  // namespace
+
+int LookupWellKnownSetting(std::string_view name) {
+  int id = kSlotTable.ids[Hash(name, kSeed) % kNumSlots];
+  if (id < 0 || kSettings[id].name != name)
+    return -1;
+  return id;
+}
+
+int GetNumWellKnownSettings() {
+  return kNumSettings;
+}
+
+std::string_view GetWellKnownSettingName(int id) {
+  assert(id >= 0 && id < kNumSettings);
+  return kSettings[id].name;
+}
+
+Setting::Type GetWellKnownSettingType(int id) {
+  assert(id >= 0 && id < kNumSettings);
+  return kSettings[id].type;
+}
+
+}  // namespace xsettingsd
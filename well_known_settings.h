@@ -0,0 +1,35 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#ifndef __XSETTINGSD_WELL_KNOWN_SETTINGS_H__
+#define __XSETTINGSD_WELL_KNOWN_SETTINGS_H__
+
+#include <string_view>
+
+#include "setting.h"
+
+namespace xsettingsd {
+
+// Well-known settings are the standard Net/, Gtk/, and Xft/ settings that
+// clients read, along with the types that they expect.  Each one has a
+// small integer ID in [0, GetNumWellKnownSettings()).  Names are resolved
+// through a perfect hash table that's built by the compiler, so a lookup
+// costs one hash and at most one comparison.
+
+// Returns the ID of the well-known setting named 'name', or -1 if 'name'
+// isn't well-known.
+int LookupWellKnownSetting(std::string_view name);
+
+// Returns the number of well-known settings.
+int GetNumWellKnownSettings();
+
+// Returns the name of the well-known setting with ID 'id'.
+std::string_view GetWellKnownSettingName(int id);
+
+// Returns the type that clients expect for the well-known setting with ID
+// 'id'.
+Setting::Type GetWellKnownSettingType(int id);
+
+}  // namespace xsettingsd
+
+#endif
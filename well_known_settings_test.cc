@@ -0,0 +1,41 @@
+// Copyright 2009 Daniel Erat <dan@erat.org>
+// All rights reserved.
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "well_known_settings.h"
+
+using std::string;
+
+namespace xsettingsd {
+
+TEST(WellKnownSettingsTest, Lookup) {
+  ASSERT_GT(GetNumWellKnownSettings(), 0);
+  for (int id = 0; id < GetNumWellKnownSettings(); ++id) {
+    // Copy the name so that the lookup can't just compare pointers.
+    string name(GetWellKnownSettingName(id));
+    EXPECT_EQ(id, LookupWellKnownSetting(name)) << name;
+  }
+
+  int id = LookupWellKnownSetting("Xft/DPI");
+  ASSERT_GE(id, 0);
+  EXPECT_EQ(Setting::TYPE_INTEGER, GetWellKnownSettingType(id));
+  id = LookupWellKnownSetting("Net/ThemeName");
+  ASSERT_GE(id, 0);
+  EXPECT_EQ(Setting::TYPE_STRING, GetWellKnownSettingType(id));
+
+  EXPECT_EQ(-1, LookupWellKnownSetting(""));
+  EXPECT_EQ(-1, LookupWellKnownSetting("Xft/DP"));
+  EXPECT_EQ(-1, LookupWellKnownSetting("Xft/DPIx"));
+  EXPECT_EQ(-1, LookupWellKnownSetting("xft/dpi"));
+  EXPECT_EQ(-1, LookupWellKnownSetting("Custom/Setting"));
+}
+
+}  // namespace xsettingsd
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
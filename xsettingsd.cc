@@ -4,15 +4,21 @@
 #include <getopt.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <cerrno>
-#include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "baseline_image.h"
 #include "common.h"
 #include "config_parser.h"
+#include "logging.h"
+#include "setting.h"
 #include "settings_manager.h"
 
 using std::string;
@@ -20,9 +26,6 @@ using std::vector;
 
 namespace {
 
-void HandleSignal(int signum) {
-}
-
 // Returns the first path in |paths| that is readable, or an empty string if
 // none of the paths can be read.
 string GetFirstReadablePath(const vector<string>& paths) {
@@ -34,39 +37,213 @@ string GetFirstReadablePath(const vector<string>& paths) {
   return string();
 }
 
+// The outcome of checking a config file.
+struct CheckResult {
+  CheckResult() : is_defaults(false) {}
+
+  string path;
+
+  // Is this the defaults file?  It may be a baseline image, and it may not
+  // contain profiles.
+  bool is_defaults;
+
+  // Empty if the file was valid.
+  string error;
+};
+
+// Read and parse the config file at 'result->path', saving any error to
+// 'result'.
+void CheckConfig(CheckResult* result) {
+  if (result->is_defaults && xsettingsd::IsBaselineImage(result->path)) {
+    std::shared_ptr<const string> identity;
+    xsettingsd::SettingsMap settings;
+    // The details are logged.
+    if (!xsettingsd::LoadBaselineImage(result->path, NULL, &identity,
+                                       &settings)) {
+      result->error = "Invalid baseline image";
+    }
+    return;
+  }
+
+  std::shared_ptr<string> data(new string);
+  if (!xsettingsd::ReadFile(result->path, data.get())) {
+    result->error = strerror(errno);
+    return;
+  }
+  xsettingsd::ConfigParser parser(
+      new xsettingsd::ConfigParser::StringCharStream(data));
+  xsettingsd::SettingsMap settings;
+  xsettingsd::ProfileMap profiles;
+  if (!parser.Parse(&settings, NULL, 0,
+                    result->is_defaults ? NULL : &profiles)) {
+    result->error = parser.FormatError();
+  }
+}
+
+// Check each config file in 'results' using 'num_jobs' threads and print
+// a line for each one.  Returns false if any file is invalid.
+bool CheckConfigs(int num_jobs, vector<CheckResult>* results) {
+  // Files are handed out one at a time so that a few large ones don't
+  // leave the other threads idle.
+  std::atomic<size_t> next_index(0);
+  auto worker = [&]() {
+    size_t index;
+    while ((index = next_index++) < results->size())
+      CheckConfig(&(*results)[index]);
+  };
+  vector<std::thread> threads;
+  for (int i = 0; i < num_jobs; ++i)
+    threads.push_back(std::thread(worker));
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+
+  bool success = true;
+  string output;
+  for (size_t i = 0; i < results->size(); ++i) {
+    const CheckResult& result = (*results)[i];
+    if (result.error.empty()) {
+      output += result.path + ": OK\n";
+    } else {
+      output += result.path + ": " + result.error + "\n";
+      success = false;
+    }
+  }
+  fwrite(output.data(), 1, output.size(), stdout);
+  return success;
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
   static const char* kUsage =
       "Usage: xsettingsd [OPTION] ...\n"
+      "       xsettingsd --check [OPTION] ... [FILE] ...\n"
       "\n"
       "Daemon implementing the XSETTINGS spec to control settings for X11\n"
       "applications.\n"
       "\n"
-      "Options: -c, --config=FILE    config file (default is ~/.xsettingsd)\n"
+      "Options: -b, --build-image=FILE\n"
+      "                              compile the defaults file into a\n"
+      "                              baseline image at FILE and exit\n"
+      "         -c, --config=FILE    config file (default is ~/.xsettingsd)\n"
+      "         -C, --control=PATH   listen for runtime changes on Unix\n"
+      "                              socket PATH\n"
+      "         -d, --defaults=FILE  load default settings from FILE (a\n"
+      "                              config file or baseline image), which\n"
+      "                              the config file overrides\n"
+      "         -g, --digest         publish a digest of the settings in\n"
+      "                              the _XSETTINGS_DIGEST property\n"
       "         -h, --help           print this help message\n"
-      "         -s, --screen=SCREEN  screen to use (default is all)\n";
+      "         -H, --history=NUM    keep NUM published generations for\n"
+      "                              rolling back to (default is 8)\n"
+      "         -j, --jobs=NUM       files to check at once with -n\n"
+      "                              (default is the number of CPUs)\n"
+      "         -m, --snapshot=FILE  mirror settings to memory-mappable\n"
+      "                              FILE for non-X11 readers\n"
+      "         -n, --check          check that each FILE (or the config\n"
+      "                              file) is valid and exit\n"
+      "         -p, --publish-delay=MS\n"
+      "                              wait MS milliseconds after a change to\n"
+      "                              publish it along with any that follow\n"
+      "         -P, --publish-interval=MS\n"
+      "                              leave at least MS milliseconds between\n"
+      "                              publishes\n"
+      "         -r, --randr          derive DPI and scaling settings from the\n"
+      "                              screen's size as it changes\n"
+      "         -s, --screen=SCREEN  screen to use (default is all)\n"
+      "         -S, --stats=FILE     write stats in Prometheus's text format\n"
+      "                              to FILE\n"
+      "         -t, --state=FILE     keep settings' serial numbers in FILE\n"
+      "                              across restarts\n"
+      "         -v, --verbose        log debugging messages\n";
 
   int screen = -1;
+  int publish_delay_ms = 0;
+  int publish_interval_ms = 0;
+  bool check_configs = false;
+  int num_jobs = std::thread::hardware_concurrency();
+  bool track_screen_size = false;
+  bool publish_digest = false;
+  int history_size = xsettingsd::SettingsManager::kDefaultHistorySize;
+  string image_file;
   string config_file;
+  string control_socket;
+  string defaults_file;
+  string snapshot_file;
+  string stats_file;
+  string state_file;
 
   struct option options[] = {
+    { "build-image", 1, NULL, 'b', },
+    { "check", 0, NULL, 'n', },
     { "config", 1, NULL, 'c', },
+    { "control", 1, NULL, 'C', },
+    { "defaults", 1, NULL, 'd', },
+    { "digest", 0, NULL, 'g', },
     { "help", 0, NULL, 'h', },
+    { "history", 1, NULL, 'H', },
+    { "jobs", 1, NULL, 'j', },
+    { "publish-delay", 1, NULL, 'p', },
+    { "publish-interval", 1, NULL, 'P', },
+    { "randr", 0, NULL, 'r', },
     { "screen", 1, NULL, 's', },
+    { "snapshot", 1, NULL, 'm', },
+    { "state", 1, NULL, 't', },
+    { "stats", 1, NULL, 'S', },
+    { "verbose", 0, NULL, 'v', },
     { NULL, 0, NULL, 0 },
   };
 
   opterr = 0;
   while (true) {
-    int ch = getopt_long(argc, argv, "c:hs:", options, NULL);
+    int ch = getopt_long(argc, argv, "b:c:C:d:ghH:j:m:np:P:rs:S:t:v", options,
+                         NULL);
     if (ch == -1) {
       break;
+    } else if (ch == 'b') {
+      image_file = optarg;
     } else if (ch == 'c') {
       config_file = optarg;
+    } else if (ch == 'C') {
+      control_socket = optarg;
+    } else if (ch == 'd') {
+      defaults_file = optarg;
+    } else if (ch == 'g') {
+      publish_digest = true;
     } else if (ch == 'h' || ch == '?') {
       fprintf(stderr, "%s", kUsage);
       return 1;
+    } else if (ch == 'H') {
+      char* endptr = NULL;
+      history_size = strtol(optarg, &endptr, 10);
+      if (optarg[0] == '\0' || endptr[0] != '\0' || history_size < 0) {
+        fprintf(stderr, "Invalid history size \"%s\"\n", optarg);
+        return 1;
+      }
+    } else if (ch == 'j') {
+      char* endptr = NULL;
+      num_jobs = strtol(optarg, &endptr, 10);
+      if (optarg[0] == '\0' || endptr[0] != '\0' || num_jobs <= 0) {
+        fprintf(stderr, "Invalid number of jobs \"%s\"\n", optarg);
+        return 1;
+      }
+    } else if (ch == 'm') {
+      snapshot_file = optarg;
+    } else if (ch == 'n') {
+      check_configs = true;
+    } else if (ch == 'p' || ch == 'P') {
+      char* endptr = NULL;
+      const int ms = strtol(optarg, &endptr, 10);
+      if (optarg[0] == '\0' || endptr[0] != '\0' || ms < 0) {
+        fprintf(stderr, "Invalid number of milliseconds \"%s\"\n", optarg);
+        return 1;
+      }
+      if (ch == 'p')
+        publish_delay_ms = ms;
+      else
+        publish_interval_ms = ms;
+    } else if (ch == 'r') {
+      track_screen_size = true;
     } else if (ch == 's') {
       char* endptr = NULL;
       screen = strtol(optarg, &endptr, 10);
@@ -74,7 +251,43 @@ int main(int argc, char** argv) {
         fprintf(stderr, "Invalid screen \"%s\"\n", optarg);
         return 1;
       }
+    } else if (ch == 'S') {
+      stats_file = optarg;
+    } else if (ch == 't') {
+      state_file = optarg;
+    } else if (ch == 'v') {
+      xsettingsd::SetMinLogSeverity(xsettingsd::LOG_SEVERITY_DEBUG);
+    }
+  }
+
+  if (!image_file.empty()) {
+    if (defaults_file.empty()) {
+      fprintf(stderr, "%s: --build-image requires --defaults\n",
+              xsettingsd::kProgName);
+      return 1;
+    }
+    return xsettingsd::BuildBaselineImage(defaults_file, image_file) ? 0 : 1;
+  }
+
+  // The defaults file (if any) is checked along with the config files, since
+  // the daemon would fail to start if it were invalid.
+  vector<CheckResult> results;
+  if (check_configs && !defaults_file.empty()) {
+    results.push_back(CheckResult());
+    results.back().path = defaults_file;
+    results.back().is_defaults = true;
+  }
+
+  if (check_configs && optind < argc) {
+    for (int i = optind; i < argc; ++i) {
+      results.push_back(CheckResult());
+      results.back().path = argv[i];
     }
+    if (num_jobs <= 0)
+      num_jobs = 1;
+    if (num_jobs > static_cast<int>(results.size()))
+      num_jobs = results.size();
+    return CheckConfigs(num_jobs, &results) ? 0 : 1;
   }
 
   // Check default config file locations if one wasn't supplied via a flag.
@@ -90,14 +303,46 @@ int main(int argc, char** argv) {
     }
   }
 
+  if (check_configs) {
+    results.push_back(CheckResult());
+    results.back().path = config_file;
+    return CheckConfigs(1, &results) ? 0 : 1;
+  }
+
   xsettingsd::SettingsManager manager(config_file);
+  if (!defaults_file.empty())
+    manager.SetDefaultsFilename(defaults_file);
+  if (!state_file.empty() && !manager.InitState(state_file))
+    return 1;
+  manager.SetHistorySize(history_size);
+  manager.SetPublishSchedule(publish_delay_ms / 1000.0,
+                             publish_interval_ms / 1000.0);
   if (!manager.LoadConfig())
     return 1;
+  if (!snapshot_file.empty() && !manager.InitSnapshot(snapshot_file))
+    return 1;
+  if (publish_digest)
+    manager.EnableDigest();
   if (!manager.InitX11(screen, true))
     return 1;
+  if (track_screen_size && !manager.InitRandR())
+    return 1;
+  if (!control_socket.empty() && !manager.InitControlServer(control_socket))
+    return 1;
+  if (!stats_file.empty() && !manager.InitStats(stats_file))
+    return 1;
+  if (!manager.InitConfigLoader())
+    return 1;
+  if (!manager.InitFileWriter())
+    return 1;
 
-  signal(SIGHUP, HandleSignal);
+  xsettingsd::SettingsManager::InstallSignalHandlers();
 
+  // Startup messages are written synchronously, but once we're running,
+  // writing to a slow stderr shouldn't hold up the event loop.
+  if (!xsettingsd::StartLogThread())
+    return 1;
   manager.RunEventLoop();
+  xsettingsd::StopLogThread();
   return 0;
 }